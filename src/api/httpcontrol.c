@@ -26,6 +26,8 @@
 #include "event.h"
 #include "image/image.h"
 #include "misc/str.h"
+#include "misc/pool.h"
+#include "task.h"
 #include "backend/backend.h"
 #include "notifications.h"
 #include "fileaccess/fileaccess.h"
@@ -419,6 +421,50 @@ hc_logfile(http_connection_t *hc, const char *remain, void *opaque,
 }
 
 
+#if !PS3
+/**
+ * On PS3 this endpoint is provided by the TLSF allocator
+ */
+static int
+hc_pool_memstats(http_connection_t *hc, const char *remain, void *opaque,
+                 http_cmd_t method)
+{
+  htsbuf_queue_t out;
+  htsbuf_queue_init(&out, 0);
+  pool_stats_print(&out);
+  return http_send_reply(hc, 0, "text/plain", NULL, NULL, 0, &out);
+}
+#endif
+
+
+/**
+ *
+ */
+static int
+hc_propstats(http_connection_t *hc, const char *remain, void *opaque,
+             http_cmd_t method)
+{
+  htsbuf_queue_t out;
+  htsbuf_queue_init(&out, 0);
+  prop_courier_stats_print(&out);
+  return http_send_reply(hc, 0, "text/plain", NULL, NULL, 0, &out);
+}
+
+
+/**
+ *
+ */
+static int
+hc_taskstats(http_connection_t *hc, const char *remain, void *opaque,
+             http_cmd_t method)
+{
+  htsbuf_queue_t out;
+  htsbuf_queue_init(&out, 0);
+  task_stats_print(&out);
+  return http_send_reply(hc, 0, "text/plain", NULL, NULL, 0, &out);
+}
+
+
 #if 0
 
 extern void my_malloc_stats(void (*fn)(const char *fmt, ...));
@@ -684,6 +730,11 @@ httpcontrol_init(void)
   http_path_add("/api/notifyuser", NULL, hc_notify_user, 1);
   http_path_add("/api/diag", NULL, hc_diagnostics, 1);
   http_path_add("/api/logfile", NULL, hc_logfile, 0);
+#if !PS3
+  http_path_add("/api/memstats", NULL, hc_pool_memstats, 1);
+#endif
+  http_path_add("/api/taskstats", NULL, hc_taskstats, 1);
+  http_path_add("/api/propstats", NULL, hc_propstats, 1);
   http_path_add("/api/replace", NULL, hc_binreplace, 1);
   http_add_websocket("/api/ws/echo", NULL,
 		     hc_echo_init, hc_echo_data, hc_echo_fini, NULL);
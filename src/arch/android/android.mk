@@ -4,6 +4,7 @@ SRCS += src/arch/android/android.c \
         src/video/h264_annexb.c \
 	src/networking/net_posix.c \
 	src/networking/asyncio_posix.c \
+	src/networking/asyncio_test.c \
 	src/networking/net_android.c \
 	src/fileaccess/fa_funopen.c \
 	src/fileaccess/fa_fs.c \
@@ -10,6 +10,7 @@ SRCS += src/arch/osx/osx_app.m \
 	src/arch/posix/posix_threads.c \
 	src/networking/net_posix.c \
 	src/networking/asyncio_posix.c \
+	src/networking/asyncio_test.c \
 	src/networking/net_ifaddr.c \
 	src/fileaccess/fa_funopen.c \
 	src/fileaccess/fa_fs.c \
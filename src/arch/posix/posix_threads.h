@@ -35,6 +35,28 @@ typedef pthread_mutex_t hts_lwmutex_t;
 #define hts_mutex_destroy(m)         pthread_mutex_destroy(m)
 extern void hts_mutex_init_recursive(hts_mutex_t *m);
 
+/**
+ * Adaptive mutexes spin for a short while before going to sleep in
+ * the kernel. Good for heavily contended locks with short critical
+ * sections. Falls back to a normal mutex where not supported.
+ *
+ * glibc declares PTHREAD_MUTEX_ADAPTIVE_NP regardless of _GNU_SOURCE
+ * (unlike the static initializer) so test for glibc itself
+ */
+static inline void
+hts_mutex_init_adaptive(pthread_mutex_t *m)
+{
+#if defined(__GLIBC__)
+  pthread_mutexattr_t a;
+  pthread_mutexattr_init(&a);
+  pthread_mutexattr_settype(&a, PTHREAD_MUTEX_ADAPTIVE_NP);
+  pthread_mutex_init(m, &a);
+  pthread_mutexattr_destroy(&a);
+#else
+  pthread_mutex_init(m, NULL);
+#endif
+}
+
 #define hts_lwmutex_init(m)            pthread_mutex_init((m), NULL)
 #define hts_lwmutex_lock(m)            pthread_mutex_lock(m)
 #define hts_lwmutex_unlock(m)          pthread_mutex_unlock(m)
@@ -66,6 +66,7 @@ extern void hts_lwmutex_destroy(hts_lwmutex_t *m);
 
 extern void hts_mutex_init(hts_mutex_t *m);
 extern void hts_mutex_init_recursive(hts_mutex_t *m);
+#define hts_mutex_init_adaptive(m) hts_mutex_init(m)
 extern void hts_mutex_lock(hts_mutex_t *m);
 extern int hts_mutex_trylock(hts_mutex_t *m);
 extern void hts_mutex_unlock(hts_mutex_t *m);
@@ -108,6 +109,7 @@ extern void hts_mutex_destroyx(hts_mutex_t *m, const char *file, int line);
 
 #define hts_mutex_init(m) hts_mutex_initx(m, __FILE__, __LINE__, 0)
 #define hts_mutex_init_recursive(m) hts_mutex_initx_recursive(m, __FILE__, __LINE__)
+#define hts_mutex_init_adaptive(m) hts_mutex_initx(m, __FILE__, __LINE__, 0)
 #define hts_mutex_dbg(m) hts_mutex_initx(m, __FILE__, __LINE__, 1)
 #define hts_mutex_lock(m) hts_mutex_lockx(m, __FILE__, __LINE__)
 #define hts_mutex_unlock(m) hts_mutex_unlockx(m, __FILE__, __LINE__)
@@ -30,6 +30,7 @@
 #include "ext/tlsf/tlsf.h"
 #include "networking/http_server.h"
 #include "arch/halloc.h"
+#include "misc/pool.h"
 
 #define USE_VIRTUAL_MEM
 
@@ -338,7 +339,9 @@ memstats(http_connection_t *hc, const char *remain, void *opaque,
   }
 
   hfree(as.ptr, size);
-  
+
+  htsbuf_qprintf(&out, "\n");
+  pool_stats_print(&out);
 
   return http_send_reply(hc, 0, "text/plain", NULL, NULL, 0, &out);
 }
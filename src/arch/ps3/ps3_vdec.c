@@ -525,6 +525,7 @@ picture_out(vdec_decoder_t *vdd)
   vp->fi.fi_prescaled = 0;
   vp->fi.fi_color_space = COLOR_SPACE_UNSET;
   vp->fi.fi_user_time = pm->user_time;
+  vp->fi.fi_enq_time = 0;
   vp->fi.fi_drive_clock = pm->drive_clock;
 
   vdec_get_picture(vdd->handle, &picfmt, rsx_to_ppu(vp->vp_offset[0]));
@@ -18,6 +18,7 @@ SRCS += src/arch/linux/linux_misc.c \
 	src/arch/posix/posix.c \
 	src/arch/posix/posix_threads.c \
 	src/networking/asyncio_posix.c \
+	src/networking/asyncio_test.c \
 	src/networking/net_posix.c \
 	src/networking/net_ifaddr.c \
 	src/ipc/devevent.c \
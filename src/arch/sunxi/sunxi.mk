@@ -10,6 +10,7 @@ SRCS += src/arch/sunxi/sunxi_main.c \
 	src/arch/linux/linux_trap.c \
 	src/fileaccess/fa_opencookie.c \
 	src/networking/asyncio_posix.c \
+	src/networking/asyncio_test.c \
 	src/arch/posix/posix.c \
 	src/arch/posix/posix_threads.c \
 	src/networking/net_posix.c \
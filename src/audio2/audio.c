@@ -143,6 +143,20 @@ audio_init(void)
                    SETTING_VALUE_ORIGIN("global"),
                    NULL);
 
+  settings_create_separator(asettings,
+			    _p("Music playback"));
+
+  setting_create(SETTING_INT, asettings,
+                 SETTINGS_INITIAL_UPDATE,
+                 SETTING_TITLE(_p("Preload next track")),
+                 SETTING_VALUE(15),
+                 SETTING_RANGE(0, 60),
+                 SETTING_UNIT_CSTR("s"),
+                 SETTING_ZERO_TEXT(_p("Off")),
+                 SETTING_STORE("audio2", "preload"),
+                 SETTING_WRITE_INT(&gconf.audio_preload_lead),
+                 NULL);
+
 
 #if CONFIG_AUDIOTEST
   audio_test_init(asettings);
@@ -219,6 +233,7 @@ audio_decoder_destroy(struct audio_decoder *ad)
     avresample_free(&ad->ad_avr);
   }
 
+  av_freep(&ad->ad_dsp_buf);
   audio_cleanup_spdif_muxer(ad);
   free(ad);
 }
@@ -351,6 +366,148 @@ update_abitrate(media_pipe_t *mp, media_queue_t *mq,
 }
 
 
+/**
+ * Decide if the sample conversion can be done by our own kernels
+ */
+static int
+audio_dsp_select(audio_decoder_t *ad)
+{
+  const int64_t il = ad->ad_in_channel_layout;
+  const int64_t ol = ad->ad_out_channel_layout;
+  const int ich = av_get_channel_layout_nb_channels(il);
+
+  if(ad->ad_in_sample_rate != ad->ad_out_sample_rate)
+    return AD_DSP_NONE;
+
+  if(ad->ad_out_sample_format != AV_SAMPLE_FMT_FLT &&
+     ad->ad_out_sample_format != AV_SAMPLE_FMT_S16)
+    return AD_DSP_NONE;
+
+  if(ich < 1 || ich > AUDIO_DSP_MAX_CHANNELS)
+    return AD_DSP_NONE;
+
+  if(ad->ad_in_sample_format == ad->ad_out_sample_format && il == ol)
+    return AD_DSP_NONE; // Nothing to do, avresample will just copy
+
+  switch(ad->ad_in_sample_format) {
+  case AV_SAMPLE_FMT_S16:
+  case AV_SAMPLE_FMT_S16P:
+  case AV_SAMPLE_FMT_S32:
+  case AV_SAMPLE_FMT_S32P:
+  case AV_SAMPLE_FMT_FLT:
+  case AV_SAMPLE_FMT_FLTP:
+    break;
+  default:
+    return AD_DSP_NONE;
+  }
+
+  if(il == ol)
+    return AD_DSP_CONVERT;
+
+  if(ol == AV_CH_LAYOUT_STEREO &&
+     !audio_dsp_stereo_matrix(ad->ad_dsp_matrix, il))
+    return AD_DSP_MIX;
+
+  return AD_DSP_NONE;
+}
+
+
+/**
+ * Convert a decoded frame to the output format / layout.
+ * Returned pointer is valid until next call
+ */
+static uint8_t *
+audio_dsp_convert(audio_decoder_t *ad, const AVFrame *frame)
+{
+  const int frames = frame->nb_samples;
+  const int ich = av_get_channel_layout_nb_channels(ad->ad_in_channel_layout);
+  const int och = ad->ad_dsp_mode == AD_DSP_MIX ? 2 : ich;
+  const size_t size = frames * (MAX(ich, och) + ich + och) * sizeof(float);
+  const float *src[AUDIO_DSP_MAX_CHANNELS];
+  float *planes[AUDIO_DSP_MAX_CHANNELS];
+  const float *flt;
+  float *tmp;
+  int c;
+
+  if(size > ad->ad_dsp_buf_size) {
+    av_free(ad->ad_dsp_buf);
+    ad->ad_dsp_buf = av_malloc(size);
+    ad->ad_dsp_buf_size = size;
+  }
+
+  /*
+   * Scratch layout:
+   *   tmp:    Interleaved float, MAX(ich, och) channels
+   *   planes: Planar float, ich channels
+   *   s16:    Interleaved output if converting to S16
+   */
+  tmp = ad->ad_dsp_buf;
+  for(c = 0; c < ich; c++)
+    planes[c] = tmp + frames * MAX(ich, och) + frames * c;
+
+  switch(frame->format) {
+  case AV_SAMPLE_FMT_FLTP:
+    for(c = 0; c < ich; c++)
+      src[c] = (const float *)frame->data[c];
+    break;
+
+  case AV_SAMPLE_FMT_S16P:
+    for(c = 0; c < ich; c++) {
+      audio_dsp_s16_to_flt(planes[c], (const int16_t *)frame->data[c],
+                           frames);
+      src[c] = planes[c];
+    }
+    break;
+
+  case AV_SAMPLE_FMT_S32P:
+    for(c = 0; c < ich; c++) {
+      audio_dsp_s32_to_flt(planes[c], (const int32_t *)frame->data[c],
+                           frames);
+      src[c] = planes[c];
+    }
+    break;
+
+  case AV_SAMPLE_FMT_S16:
+    audio_dsp_s16_to_flt(tmp, (const int16_t *)frame->data[0],
+                         frames * ich);
+    break;
+
+  case AV_SAMPLE_FMT_S32:
+    audio_dsp_s32_to_flt(tmp, (const int32_t *)frame->data[0],
+                         frames * ich);
+    break;
+  }
+
+  if(av_sample_fmt_is_planar(frame->format)) {
+
+    if(ad->ad_dsp_mode == AD_DSP_MIX)
+      audio_dsp_mix_stereo_flt(tmp, src, ich, frames, ad->ad_dsp_matrix);
+    else
+      audio_dsp_interleave_flt(tmp, src, ich, frames);
+    flt = tmp;
+
+  } else {
+
+    flt = frame->format == AV_SAMPLE_FMT_FLT ?
+      (const float *)frame->data[0] : tmp;
+
+    if(ad->ad_dsp_mode == AD_DSP_MIX) {
+      audio_dsp_deinterleave_flt(planes, flt, ich, frames);
+      audio_dsp_mix_stereo_flt(tmp, (const float **)planes, ich, frames,
+                               ad->ad_dsp_matrix);
+      flt = tmp;
+    }
+  }
+
+  if(ad->ad_out_sample_format == AV_SAMPLE_FMT_S16) {
+    int16_t *s16 = (int16_t *)(planes[0] + frames * ich);
+    audio_dsp_flt_to_s16(s16, flt, frames * och);
+    return (uint8_t *)s16;
+  }
+  return (uint8_t *)flt;
+}
+
+
 
 /**
  * Return 1 if packet should be retained (more data to be extracted)
@@ -469,7 +626,9 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
       }
     }
 
+    const int64_t ts = arch_get_ts();
     r = avcodec_decode_audio4(ctx, frame, &got_frame, &mb->mb_pkt);
+    media_latency_add(&mq->mq_latency_decode, arch_get_ts() - ts);
     if(r < 0)
       return 0;
     update_abitrate(mp, mq, r, ad);
@@ -555,11 +714,15 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
     else
       avresample_close(ad->ad_avr);
 
+    ad->ad_dsp_mode = audio_dsp_select(ad);
+
     av_opt_set_int(ad->ad_avr, "in_sample_fmt",
+                   ad->ad_dsp_mode ? ad->ad_out_sample_format :
                    ad->ad_in_sample_format, 0);
     av_opt_set_int(ad->ad_avr, "in_sample_rate",
                    ad->ad_in_sample_rate, 0);
     av_opt_set_int(ad->ad_avr, "in_channel_layout",
+                   ad->ad_dsp_mode ? ad->ad_out_channel_layout :
                    ad->ad_in_channel_layout, 0);
 
     av_opt_set_int(ad->ad_avr, "out_sample_fmt",
@@ -578,11 +741,14 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
                                  -1, ad->ad_out_channel_layout);
 
     TRACE(TRACE_DEBUG, "Audio",
-          "Converting from [%s %dHz %s] to [%s %dHz %s]",
+          "Converting from [%s %dHz %s] to [%s %dHz %s]%s",
           buf1, ad->ad_in_sample_rate,
           av_get_sample_fmt_name(ad->ad_in_sample_format),
           buf2, ad->ad_out_sample_rate,
-          av_get_sample_fmt_name(ad->ad_out_sample_format));
+          av_get_sample_fmt_name(ad->ad_out_sample_format),
+          ad->ad_dsp_mode == AD_DSP_MIX ? " using mix kernels" :
+          ad->ad_dsp_mode == AD_DSP_CONVERT ? " using conversion kernels" :
+          "");
 
     if(avresample_open(ad->ad_avr)) {
       TRACE(TRACE_ERROR, "Audio", "Unable to open resampler");
@@ -598,7 +764,11 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
   ad->ad_estimated_duration =
     1000000LL * frame->nb_samples / frame->sample_rate;
 
-  if(ad->ad_avr != NULL) {
+  if(ad->ad_avr != NULL && ad->ad_dsp_mode != AD_DSP_NONE) {
+    uint8_t *data = audio_dsp_convert(ad, frame);
+    avresample_convert(ad->ad_avr, NULL, 0, 0,
+                       &data, 0, frame->nb_samples);
+  } else if(ad->ad_avr != NULL) {
     avresample_convert(ad->ad_avr, NULL, 0, 0,
                        frame->data, frame->linesize[0],
                        frame->nb_samples);
@@ -643,12 +813,15 @@ audio_decode_thread(void *aux)
     } else {
       avail = ad->ad_avr != NULL ? avresample_available(ad->ad_avr) : 0;
     }
+    mq_ring_drain_locked(mp, mq);
+
     media_buf_t *data = TAILQ_FIRST(&mq->mq_q_data);
     media_buf_t *ctrl = TAILQ_FIRST(&mq->mq_q_ctrl);
     if(avail >= ad->ad_tile_size && blocked == 0 && !ad->ad_paused && !ctrl) {
       assert(avail != 0);
 
       int samples = MIN(ad->ad_tile_size, avail);
+      const int64_t ts = arch_get_ts();
       int r;
 
       if(ac->ac_deliver_locked != NULL) {
@@ -671,6 +844,7 @@ audio_decode_thread(void *aux)
 	blocked = 1;
       } else {
 	ad->ad_pts = AV_NOPTS_VALUE;
+        media_latency_add(&mq->mq_latency_output, arch_get_ts() - ts);
       }
       continue;
     }
@@ -684,6 +858,8 @@ audio_decode_thread(void *aux)
       mb = data;
       if(mb->mb_dts != PTS_UNSET)
         mq->mq_last_deq_dts = mb->mb_dts;
+      mq_latency_dequeued(mq, mb);
+      mb->mb_enq_time = 0; // Don't count it again if it's put back
     } else {
       hts_cond_wait(&mq->mq_avail, &mp->mp_mutex);
       continue;
@@ -23,6 +23,7 @@
 
 #include "arch/threads.h"
 #include "media/media.h"
+#include "audio_dsp.h"
 
 extern float audio_master_volume;
 extern int   audio_master_mute;
@@ -97,6 +98,20 @@ typedef struct audio_decoder {
 
   AVAudioResampleContext *ad_avr;
 
+  /**
+   * When no resampling is needed, sample format conversion and
+   * channel mixing is done by the audio_dsp kernels and ad_avr is
+   * configured as a pass-through FIFO for the output driver
+   */
+#define AD_DSP_NONE    0
+#define AD_DSP_CONVERT 1
+#define AD_DSP_MIX     2
+
+  int ad_dsp_mode;
+  float ad_dsp_matrix[2 * AUDIO_DSP_MAX_CHANNELS];
+  float *ad_dsp_buf;
+  size_t ad_dsp_buf_size;
+
   void *ad_mux_buffer;
   
   struct AVFormatContext *ad_spdif_muxer;
@@ -0,0 +1,397 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <math.h>
+
+#include <libavutil/channel_layout.h>
+
+#include "audio_dsp.h"
+
+#if defined(__SSE2__) || defined(__x86_64)
+#define AUDIO_DSP_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#define AUDIO_DSP_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define S16_SCALE   (1.0f / 32768.0f)
+#define S32_SCALE   (1.0f / 2147483648.0f)
+
+
+/**
+ *
+ */
+static inline int16_t
+flt_to_s16(float f)
+{
+  f *= 32768.0f;
+  if(f >= 32767.0f)
+    return 32767;
+  if(f <= -32768.0f)
+    return -32768;
+  return lrintf(f);
+}
+
+
+/**
+ *
+ */
+void
+audio_dsp_gain_flt(float *dst, const float *src, int n, float gain)
+{
+  int i = 0;
+#if defined(AUDIO_DSP_SSE2)
+  const __m128 g = _mm_set1_ps(gain);
+  for(; i + 8 <= n; i += 8) {
+    __m128 a = _mm_loadu_ps(src + i);
+    __m128 b = _mm_loadu_ps(src + i + 4);
+    _mm_storeu_ps(dst + i,     _mm_mul_ps(a, g));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(b, g));
+  }
+#elif defined(AUDIO_DSP_NEON)
+  const float32x4_t g = vdupq_n_f32(gain);
+  for(; i + 8 <= n; i += 8) {
+    float32x4_t a = vld1q_f32(src + i);
+    float32x4_t b = vld1q_f32(src + i + 4);
+    vst1q_f32(dst + i,     vmulq_f32(a, g));
+    vst1q_f32(dst + i + 4, vmulq_f32(b, g));
+  }
+#endif
+  for(; i < n; i++)
+    dst[i] = src[i] * gain;
+}
+
+
+/**
+ *
+ */
+void
+audio_dsp_clip_flt(float *dst, const float *src, int n)
+{
+  int i = 0;
+#if defined(AUDIO_DSP_SSE2)
+  const __m128 lo = _mm_set1_ps(-1.0f);
+  const __m128 hi = _mm_set1_ps(1.0f);
+  for(; i + 4 <= n; i += 4)
+    _mm_storeu_ps(dst + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i),
+                                                 lo), hi));
+#elif defined(AUDIO_DSP_NEON)
+  const float32x4_t lo = vdupq_n_f32(-1.0f);
+  const float32x4_t hi = vdupq_n_f32(1.0f);
+  for(; i + 4 <= n; i += 4)
+    vst1q_f32(dst + i, vminq_f32(vmaxq_f32(vld1q_f32(src + i), lo), hi));
+#endif
+  for(; i < n; i++)
+    dst[i] = src[i] > 1.0f ? 1.0f : src[i] < -1.0f ? -1.0f : src[i];
+}
+
+
+/**
+ *
+ */
+void
+audio_dsp_s16_to_flt(float *dst, const int16_t *src, int n)
+{
+  int i = 0;
+#if defined(AUDIO_DSP_SSE2)
+  const __m128 scale = _mm_set1_ps(S16_SCALE);
+  for(; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+    // Sign extend by putting the sample in the upper half and shifting down
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(dst + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+#elif defined(AUDIO_DSP_NEON)
+  for(; i + 8 <= n; i += 8) {
+    int16x8_t x = vld1q_s16(src + i);
+    int32x4_t lo = vmovl_s16(vget_low_s16(x));
+    int32x4_t hi = vmovl_s16(vget_high_s16(x));
+    vst1q_f32(dst + i,     vmulq_n_f32(vcvtq_f32_s32(lo), S16_SCALE));
+    vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(hi), S16_SCALE));
+  }
+#endif
+  for(; i < n; i++)
+    dst[i] = src[i] * S16_SCALE;
+}
+
+
+/**
+ *
+ */
+void
+audio_dsp_s32_to_flt(float *dst, const int32_t *src, int n)
+{
+  int i = 0;
+#if defined(AUDIO_DSP_SSE2)
+  const __m128 scale = _mm_set1_ps(S32_SCALE);
+  for(; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+  }
+#elif defined(AUDIO_DSP_NEON)
+  for(; i + 4 <= n; i += 4)
+    vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)),
+                                   S32_SCALE));
+#endif
+  for(; i < n; i++)
+    dst[i] = src[i] * S32_SCALE;
+}
+
+
+/**
+ * Scale, clip and round to nearest
+ */
+void
+audio_dsp_flt_to_s16(int16_t *dst, const float *src, int n)
+{
+  int i = 0;
+#if defined(AUDIO_DSP_SSE2)
+  const __m128 scale = _mm_set1_ps(32768.0f);
+  const __m128 lo = _mm_set1_ps(-32768.0f);
+  const __m128 hi = _mm_set1_ps(32767.0f);
+  for(; i + 8 <= n; i += 8) {
+    __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i),     scale);
+    __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+    a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+    b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+  }
+#elif defined(AUDIO_DSP_NEON)
+  const float32x4_t lo = vdupq_n_f32(-32768.0f);
+  const float32x4_t hi = vdupq_n_f32(32767.0f);
+  const float32x4_t half = vdupq_n_f32(0.5f);
+  const uint32x4_t sign = vdupq_n_u32(0x80000000);
+  for(; i + 8 <= n; i += 8) {
+    float32x4_t a = vmulq_n_f32(vld1q_f32(src + i),     32768.0f);
+    float32x4_t b = vmulq_n_f32(vld1q_f32(src + i + 4), 32768.0f);
+    a = vminq_f32(vmaxq_f32(a, lo), hi);
+    b = vminq_f32(vmaxq_f32(b, lo), hi);
+    // vcvtq truncates, so add +-0.5 first to round away from zero
+    float32x4_t ra = vreinterpretq_f32_u32(
+      vorrq_u32(vandq_u32(vreinterpretq_u32_f32(a), sign),
+                vreinterpretq_u32_f32(half)));
+    float32x4_t rb = vreinterpretq_f32_u32(
+      vorrq_u32(vandq_u32(vreinterpretq_u32_f32(b), sign),
+                vreinterpretq_u32_f32(half)));
+    int32x4_t ia = vcvtq_s32_f32(vaddq_f32(a, ra));
+    int32x4_t ib = vcvtq_s32_f32(vaddq_f32(b, rb));
+    vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(ia), vqmovn_s32(ib)));
+  }
+#endif
+  for(; i < n; i++)
+    dst[i] = flt_to_s16(src[i]);
+}
+
+
+/**
+ *
+ */
+void
+audio_dsp_interleave_flt(float *dst, const float * const *src,
+                         int channels, int frames)
+{
+  int i = 0;
+
+  if(channels == 2) {
+    const float *l = src[0];
+    const float *r = src[1];
+#if defined(AUDIO_DSP_SSE2)
+    for(; i + 4 <= frames; i += 4) {
+      __m128 a = _mm_loadu_ps(l + i);
+      __m128 b = _mm_loadu_ps(r + i);
+      _mm_storeu_ps(dst + i * 2,     _mm_unpacklo_ps(a, b));
+      _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(a, b));
+    }
+#elif defined(AUDIO_DSP_NEON)
+    for(; i + 4 <= frames; i += 4) {
+      float32x4x2_t v;
+      v.val[0] = vld1q_f32(l + i);
+      v.val[1] = vld1q_f32(r + i);
+      vst2q_f32(dst + i * 2, v);
+    }
+#endif
+    for(; i < frames; i++) {
+      dst[i * 2]     = l[i];
+      dst[i * 2 + 1] = r[i];
+    }
+    return;
+  }
+
+  for(int c = 0; c < channels; c++) {
+    const float *s = src[c];
+    float *d = dst + c;
+    for(i = 0; i < frames; i++)
+      d[i * channels] = s[i];
+  }
+}
+
+
+/**
+ *
+ */
+void
+audio_dsp_deinterleave_flt(float * const *dst, const float *src,
+                           int channels, int frames)
+{
+  int i = 0;
+
+  if(channels == 2) {
+    float *l = dst[0];
+    float *r = dst[1];
+#if defined(AUDIO_DSP_SSE2)
+    for(; i + 4 <= frames; i += 4) {
+      __m128 a = _mm_loadu_ps(src + i * 2);
+      __m128 b = _mm_loadu_ps(src + i * 2 + 4);
+      _mm_storeu_ps(l + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+      _mm_storeu_ps(r + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+#elif defined(AUDIO_DSP_NEON)
+    for(; i + 4 <= frames; i += 4) {
+      float32x4x2_t v = vld2q_f32(src + i * 2);
+      vst1q_f32(l + i, v.val[0]);
+      vst1q_f32(r + i, v.val[1]);
+    }
+#endif
+    for(; i < frames; i++) {
+      l[i] = src[i * 2];
+      r[i] = src[i * 2 + 1];
+    }
+    return;
+  }
+
+  for(int c = 0; c < channels; c++) {
+    const float *s = src + c;
+    float *d = dst[c];
+    for(i = 0; i < frames; i++)
+      d[i] = s[i * channels];
+  }
+}
+
+
+/**
+ *
+ */
+void
+audio_dsp_mix_stereo_flt(float *dst, const float * const *src,
+                         int channels, int frames, const float *matrix)
+{
+  const float *ml = matrix;
+  const float *mr = matrix + channels;
+  int i = 0;
+
+#if defined(AUDIO_DSP_SSE2)
+  for(; i + 4 <= frames; i += 4) {
+    __m128 l = _mm_setzero_ps();
+    __m128 r = _mm_setzero_ps();
+    for(int c = 0; c < channels; c++) {
+      __m128 x = _mm_loadu_ps(src[c] + i);
+      l = _mm_add_ps(l, _mm_mul_ps(x, _mm_set1_ps(ml[c])));
+      r = _mm_add_ps(r, _mm_mul_ps(x, _mm_set1_ps(mr[c])));
+    }
+    _mm_storeu_ps(dst + i * 2,     _mm_unpacklo_ps(l, r));
+    _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(l, r));
+  }
+#elif defined(AUDIO_DSP_NEON)
+  for(; i + 4 <= frames; i += 4) {
+    float32x4x2_t v;
+    v.val[0] = vdupq_n_f32(0);
+    v.val[1] = vdupq_n_f32(0);
+    for(int c = 0; c < channels; c++) {
+      float32x4_t x = vld1q_f32(src[c] + i);
+      v.val[0] = vmlaq_n_f32(v.val[0], x, ml[c]);
+      v.val[1] = vmlaq_n_f32(v.val[1], x, mr[c]);
+    }
+    vst2q_f32(dst + i * 2, v);
+  }
+#endif
+  for(; i < frames; i++) {
+    float l = 0, r = 0;
+    for(int c = 0; c < channels; c++) {
+      l += src[c][i] * ml[c];
+      r += src[c][i] * mr[c];
+    }
+    dst[i * 2]     = l;
+    dst[i * 2 + 1] = r;
+  }
+}
+
+
+/**
+ * Same coefficients as avresample uses for its default (normalized)
+ * matrix when mixing down to stereo, LFE is dropped.
+ */
+int
+audio_dsp_stereo_matrix(float *matrix, uint64_t layout)
+{
+  const int channels = av_get_channel_layout_nb_channels(layout);
+  float *ml = matrix;
+  float *mr = matrix + channels;
+  float suml = 0, sumr = 0;
+  int c = 0;
+
+  if(channels < 1 || channels > AUDIO_DSP_MAX_CHANNELS)
+    return -1;
+
+  for(int i = 0; i < 64; i++) {
+    const uint64_t ch = 1ULL << i;
+    if(!(layout & ch))
+      continue;
+
+    switch(ch) {
+    case AV_CH_FRONT_LEFT:
+      ml[c] = 1.0f;      mr[c] = 0;
+      break;
+    case AV_CH_FRONT_RIGHT:
+      ml[c] = 0;         mr[c] = 1.0f;
+      break;
+    case AV_CH_FRONT_CENTER:
+      ml[c] = M_SQRT1_2; mr[c] = M_SQRT1_2;
+      break;
+    case AV_CH_LOW_FREQUENCY:
+      ml[c] = 0;         mr[c] = 0;
+      break;
+    case AV_CH_BACK_LEFT:
+    case AV_CH_SIDE_LEFT:
+      ml[c] = M_SQRT1_2; mr[c] = 0;
+      break;
+    case AV_CH_BACK_RIGHT:
+    case AV_CH_SIDE_RIGHT:
+      ml[c] = 0;         mr[c] = M_SQRT1_2;
+      break;
+    default:
+      return -1;
+    }
+    suml += ml[c];
+    sumr += mr[c];
+    c++;
+  }
+
+  const float maxsum = suml > sumr ? suml : sumr;
+  if(maxsum > 1.0f) {
+    for(c = 0; c < channels; c++) {
+      ml[c] /= maxsum;
+      mr[c] /= maxsum;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+#include <stdint.h>
+
+/**
+ * Sample kernels used for the simple conversion cases (no resampling)
+ * so we don't have to go through the generic avresample paths.
+ *
+ * Sample counts are total number of samples (ie. frames * channels)
+ * unless the argument is named 'frames'. Source and destination may
+ * be the same buffer for the 1:1 kernels (gain, clip).
+ */
+
+#define AUDIO_DSP_MAX_CHANNELS 8
+
+void audio_dsp_gain_flt(float *dst, const float *src, int n, float gain);
+
+void audio_dsp_clip_flt(float *dst, const float *src, int n);
+
+void audio_dsp_s16_to_flt(float *dst, const int16_t *src, int n);
+
+void audio_dsp_s32_to_flt(float *dst, const int32_t *src, int n);
+
+void audio_dsp_flt_to_s16(int16_t *dst, const float *src, int n);
+
+void audio_dsp_interleave_flt(float *dst, const float * const *src,
+                              int channels, int frames);
+
+void audio_dsp_deinterleave_flt(float * const *dst, const float *src,
+                                int channels, int frames);
+
+/**
+ * Mix planar input down (or up) to interleaved stereo.
+ *
+ * 'matrix' holds 2 * channels coefficients, all left coefficients
+ * followed by all right coefficients
+ */
+void audio_dsp_mix_stereo_flt(float *dst, const float * const *src,
+                              int channels, int frames, const float *matrix);
+
+/**
+ * Build a stereo mix matrix for the given (libav) channel layout.
+ * Returns -1 if the layout contains channels we have no rule for
+ */
+int audio_dsp_stereo_matrix(float *matrix, uint64_t layout);
+
+void audio_dsp_benchmark(void);
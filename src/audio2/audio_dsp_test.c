@@ -0,0 +1,217 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+#include <libavresample/avresample.h>
+
+#include "main.h"
+#include "misc/minmax.h"
+#include "audio_dsp.h"
+
+/**
+ * Microbenchmark of the sample kernels against avresample doing the
+ * same conversion. Each round converts and reads back one decoder
+ * sized frame, same as the audio decoder thread + output driver does.
+ */
+
+#define BENCH_FRAMES 1152
+#define BENCH_ROUNDS 2000
+
+typedef struct bench_case {
+  const char *name;
+  enum AVSampleFormat in_fmt;
+  uint64_t in_layout;
+  enum AVSampleFormat out_fmt;
+  uint64_t out_layout;
+} bench_case_t;
+
+static const bench_case_t bench_cases[] = {
+  { "s16 -> flt stereo",
+    AV_SAMPLE_FMT_S16,  AV_CH_LAYOUT_STEREO,
+    AV_SAMPLE_FMT_FLT,  AV_CH_LAYOUT_STEREO },
+  { "s32 -> flt stereo",
+    AV_SAMPLE_FMT_S32,  AV_CH_LAYOUT_STEREO,
+    AV_SAMPLE_FMT_FLT,  AV_CH_LAYOUT_STEREO },
+  { "fltp -> flt stereo",
+    AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO,
+    AV_SAMPLE_FMT_FLT,  AV_CH_LAYOUT_STEREO },
+  { "fltp -> s16 stereo",
+    AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO,
+    AV_SAMPLE_FMT_S16,  AV_CH_LAYOUT_STEREO },
+  { "fltp 5.1 -> flt stereo",
+    AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_5POINT1,
+    AV_SAMPLE_FMT_FLT,  AV_CH_LAYOUT_STEREO },
+  { "fltp mono -> flt stereo",
+    AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_MONO,
+    AV_SAMPLE_FMT_FLT,  AV_CH_LAYOUT_STEREO },
+};
+
+
+/**
+ *
+ */
+static int64_t
+bench_avr(const bench_case_t *bc, uint8_t **in, uint8_t *out)
+{
+  AVAudioResampleContext *avr = avresample_alloc_context();
+  int64_t ts;
+
+  av_opt_set_int(avr, "in_sample_fmt",      bc->in_fmt, 0);
+  av_opt_set_int(avr, "in_sample_rate",     48000, 0);
+  av_opt_set_int(avr, "in_channel_layout",  bc->in_layout, 0);
+  av_opt_set_int(avr, "out_sample_fmt",     bc->out_fmt, 0);
+  av_opt_set_int(avr, "out_sample_rate",    48000, 0);
+  av_opt_set_int(avr, "out_channel_layout", bc->out_layout, 0);
+
+  if(avresample_open(avr)) {
+    avresample_free(&avr);
+    return -1;
+  }
+
+  ts = arch_get_ts();
+  for(int i = 0; i < BENCH_ROUNDS; i++) {
+    avresample_convert(avr, NULL, 0, 0, in, 0, BENCH_FRAMES);
+    avresample_read(avr, &out, BENCH_FRAMES);
+  }
+  ts = arch_get_ts() - ts;
+
+  avresample_free(&avr);
+  return ts;
+}
+
+
+/**
+ * Same conversion steps as audio_dsp_convert() in audio.c
+ */
+static int64_t
+bench_dsp(const bench_case_t *bc, uint8_t **in, uint8_t *out)
+{
+  const int ich = av_get_channel_layout_nb_channels(bc->in_layout);
+  float *tmp = malloc(BENCH_FRAMES * MAX(ich, 2) * sizeof(float));
+  float matrix[AUDIO_DSP_MAX_CHANNELS * 2];
+  int mix = bc->in_layout != bc->out_layout;
+  int64_t ts;
+
+  if(mix && audio_dsp_stereo_matrix(matrix, bc->in_layout)) {
+    free(tmp);
+    return -1;
+  }
+
+  ts = arch_get_ts();
+  for(int i = 0; i < BENCH_ROUNDS; i++) {
+    const float *flt = tmp;
+
+    switch(bc->in_fmt) {
+    case AV_SAMPLE_FMT_S16:
+      audio_dsp_s16_to_flt(tmp, (const int16_t *)in[0], BENCH_FRAMES * ich);
+      break;
+    case AV_SAMPLE_FMT_S32:
+      audio_dsp_s32_to_flt(tmp, (const int32_t *)in[0], BENCH_FRAMES * ich);
+      break;
+    case AV_SAMPLE_FMT_FLTP:
+      if(mix) {
+        audio_dsp_mix_stereo_flt(tmp, (const float **)in, ich,
+                                 BENCH_FRAMES, matrix);
+      } else {
+        audio_dsp_interleave_flt(tmp, (const float **)in, ich, BENCH_FRAMES);
+      }
+      break;
+    default:
+      break;
+    }
+
+    if(bc->out_fmt == AV_SAMPLE_FMT_S16) {
+      audio_dsp_flt_to_s16((int16_t *)out, flt, BENCH_FRAMES * 2);
+    } else {
+      memcpy(out, flt, BENCH_FRAMES * 2 * sizeof(float));
+    }
+  }
+  ts = arch_get_ts() - ts;
+
+  free(tmp);
+  return ts;
+}
+
+
+/**
+ *
+ */
+static int64_t
+bench_gain(float *buf, int n, int simd)
+{
+  int64_t ts = arch_get_ts();
+
+  for(int i = 0; i < BENCH_ROUNDS; i++) {
+    if(simd) {
+      audio_dsp_gain_flt(buf, buf, n, 0.999f);
+    } else {
+      for(int j = 0; j < n; j++)
+        buf[j] *= 0.999f;
+    }
+  }
+  return arch_get_ts() - ts;
+}
+
+
+/**
+ *
+ */
+void
+audio_dsp_benchmark(void)
+{
+  const int total = BENCH_FRAMES * BENCH_ROUNDS;
+  uint8_t *in[AUDIO_DSP_MAX_CHANNELS];
+  uint8_t *out = malloc(BENCH_FRAMES * 2 * sizeof(float));
+  float *buf;
+  int i;
+
+  for(i = 0; i < AUDIO_DSP_MAX_CHANNELS; i++) {
+    float *p = malloc(BENCH_FRAMES * AUDIO_DSP_MAX_CHANNELS * sizeof(float));
+    for(int j = 0; j < BENCH_FRAMES * AUDIO_DSP_MAX_CHANNELS; j++)
+      p[j] = (rand() & 0xffff) / 32768.0f - 1.0f;
+    in[i] = (uint8_t *)p;
+  }
+
+  printf("%-24s %14s %14s\n", "Conversion",
+         "Kernel ns/fr", "avresample ns/fr");
+
+  for(i = 0; i < ARRAYSIZE(bench_cases); i++) {
+    const bench_case_t *bc = &bench_cases[i];
+    int64_t dsp = bench_dsp(bc, in, out);
+    int64_t avr = bench_avr(bc, in, out);
+
+    printf("%-24s %14.2f %14.2f\n", bc->name,
+           dsp * 1000.0 / total, avr * 1000.0 / total);
+  }
+
+  buf = (float *)in[0];
+  int64_t simd   = bench_gain(buf, BENCH_FRAMES * 2, 1);
+  int64_t scalar = bench_gain(buf, BENCH_FRAMES * 2, 0);
+  printf("%-24s %14.2f %14.2f (scalar)\n", "gain flt stereo",
+         simd * 1000.0 / total, scalar * 1000.0 / total);
+
+  for(i = 0; i < AUDIO_DSP_MAX_CHANNELS; i++)
+    free(in[i]);
+  free(out);
+}
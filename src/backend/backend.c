@@ -180,6 +180,27 @@ backend_play_audio(const char *url, struct media_pipe *mp,
 }
 
 
+/**
+ * Prepare for playback of 'url' with backend_play_audio() in the near
+ * future. Returns -1 if the backend can't do this
+ */
+int
+backend_preload_audio(const char *url, char *errbuf, size_t errlen,
+                      const char *mimetype)
+{
+  backend_t *be = backend_resolve(url);
+
+  if(be == NULL || be->be_preload_audio == NULL) {
+    snprintf(errbuf, errlen, "Preload not supported");
+    backend_release(be);
+    return -1;
+  }
+  int r = be->be_preload_audio(url, errbuf, errlen, mimetype, be->be_opaque);
+  backend_release(be);
+  return r;
+}
+
+
 /**
  * Static content
  */
@@ -116,6 +116,9 @@ typedef struct backend {
 				 const char *mimetype,
                                  void *opaque);
 
+  int (*be_preload_audio)(const char *url, char *errbuf, size_t errlen,
+                          const char *mimetype, void *opaque);
+
   struct image *(*be_imageloader)(const char *url, const struct image_meta *im,
                                   char *errbuf, size_t errlen,
                                   int *cache_control,
@@ -167,6 +170,9 @@ struct event *backend_play_audio(const char *url, struct media_pipe *mp,
 				 const char *mimetype)
      attribute_unused_result;
 
+int backend_preload_audio(const char *url, char *errbuf, size_t errlen,
+                          const char *mimetype);
+
 
 struct image *backend_imageloader(rstr_t *url, const struct image_meta *im,
                                   char *errbuf, size_t errlen,
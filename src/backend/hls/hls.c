@@ -823,9 +823,9 @@ hls_variant_open(hls_variant_t *hv)
 
     mp_set_duration(mp, hv->hv_frozen ? hv->hv_duration :  AV_NOPTS_VALUE);
     if(hv->hv_frozen) {
-      mp_set_clr_flags(mp, MP_CAN_SEEK, 0);
+      mp_set_clr_flags(mp, MP_CAN_SEEK, MP_LIVE);
     } else {
-      mp_set_clr_flags(mp, 0, MP_CAN_SEEK);
+      mp_set_clr_flags(mp, MP_LIVE, MP_CAN_SEEK);
     }
   }
 }
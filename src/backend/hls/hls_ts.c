@@ -47,6 +47,8 @@ typedef struct ts_table {
 
 static const AVRational mpeg_tc = {1, 90000};
 
+#define TD_READ_SIZE (188 * 64)
+
 typedef struct ts_demuxer {
   struct ts_service_list td_services;
   struct ts_es_list td_elemtary_streams;
@@ -1286,12 +1288,17 @@ hls_ts_demuxer_read(hls_demuxer_t *hd)
     case TD_MUX_MODE_TS:
 
       assert(td->td_buf_bytes < 188);
-      r = fa_read(hs->hs_fh,
-                  td->td_buf + td->td_buf_bytes,
-                  188 - td->td_buf_bytes);
 
-      if(cancellable_is_cancelled(hd->hd_cancellable))
+      // Parse packets straight out of the buffer we get (decrypted in
+      // place if AES), td_buf is only used for packets that straddle
+      buf_t *b;
+      r = fa_read_buf(hs->hs_fh, &b, TD_READ_SIZE);
+
+      if(cancellable_is_cancelled(hd->hd_cancellable)) {
+        if(r > 0)
+          buf_release(b);
         return NULL;
+      }
 
       if(r < 0)
         return HLS_EOF;
@@ -1301,13 +1308,31 @@ hls_ts_demuxer_read(hls_demuxer_t *hd)
         continue;
       }
 
-      td->td_buf_bytes += r;
       hd->hd_download_counter += r;
 
-      if(td->td_buf_bytes == 188) {
-        td->td_buf_bytes = 0;
-        process_tsb(td, td->td_buf, hs);
+      const uint8_t *p = buf_c8(b);
+
+      if(td->td_buf_bytes > 0) {
+        const int n = MIN(188 - td->td_buf_bytes, r);
+        memcpy(td->td_buf + td->td_buf_bytes, p, n);
+        td->td_buf_bytes += n;
+        p += n;
+        r -= n;
+
+        if(td->td_buf_bytes == 188) {
+          td->td_buf_bytes = 0;
+          process_tsb(td, td->td_buf, hs);
+        }
+      }
+
+      for(; r >= 188; p += 188, r -= 188)
+        process_tsb(td, p, hs);
+
+      if(r > 0) {
+        memcpy(td->td_buf, p, r);
+        td->td_buf_bytes = r;
       }
+      buf_release(b);
       break;
     }
   }
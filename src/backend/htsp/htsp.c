@@ -465,6 +465,7 @@ update_events(htsp_connection_t *hc, prop_t *metadata, int id, int next)
       cnt++;
 
     prop_t **ordervec = alloca(sizeof(prop_t *) * cnt);
+    prop_batch_t *pb = prop_batch_create();
 
     cnt = 0;
     HTSMSG_FOREACH(f, events) {
@@ -483,20 +484,21 @@ update_events(htsp_connection_t *hc, prop_t *metadata, int id, int next)
       prop_unmark(e);
       ordervec[cnt++] = e;
 
-      prop_set(e, "type", PROP_SET_STRING, "event");
+      prop_batch_set(pb, e, "type", PROP_SET_STRING, "event");
       prop_t *m = prop_create(e, "metadata");
-      prop_set(m, "title", PROP_SET_STRING, htsmsg_get_str(map, "title"));
-      prop_set(m, "description", PROP_SET_STRING,
-               htsmsg_get_str(map, "description"));
+      prop_batch_set(pb, m, "title", PROP_SET_STRING,
+                     htsmsg_get_str(map, "title"));
+      prop_batch_set(pb, m, "description", PROP_SET_STRING,
+                     htsmsg_get_str(map, "description"));
 
-      prop_set(m, "subtitle", PROP_SET_STRING,
-               htsmsg_get_str(map, "subtitle"));
+      prop_batch_set(pb, m, "subtitle", PROP_SET_STRING,
+                     htsmsg_get_str(map, "subtitle"));
 
       if(!htsmsg_get_u32(map, "start", &u32))
-        prop_set(m, "start", PROP_SET_INT, u32);
+        prop_batch_set(pb, m, "start", PROP_SET_INT, u32);
 
       if(!htsmsg_get_u32(map, "stop", &u32))
-        prop_set(m, "stop", PROP_SET_INT, u32);
+        prop_batch_set(pb, m, "stop", PROP_SET_INT, u32);
 
 
       if(!htsmsg_get_u32(map, "dvrId", &u32)) {
@@ -507,8 +509,8 @@ update_events(htsp_connection_t *hc, prop_t *metadata, int id, int next)
         prop_ref_dec(dvritem);
       }
 
-      prop_set(m, "isCurrent", PROP_SET_INT, linkstate == 0);
-      prop_set(m, "isNext", PROP_SET_INT, linkstate == 1);
+      prop_batch_set(pb, m, "isCurrent", PROP_SET_INT, linkstate == 0);
+      prop_batch_set(pb, m, "isNext", PROP_SET_INT, linkstate == 1);
 
       switch(linkstate) {
       case 0:
@@ -521,6 +523,7 @@ update_events(htsp_connection_t *hc, prop_t *metadata, int id, int next)
       linkstate++;
     }
 
+    prop_batch_commit(pb);
     prop_destroy_marked_childs(list);
 
     if(cnt > 0) {
@@ -626,15 +629,19 @@ htsp_channelAddUpdate(htsp_connection_t *hc, htsmsg_t *m, int create)
 
   hts_mutex_unlock(&hc->hc_meta_mutex);
 
+  prop_batch_t *pb = prop_batch_create();
+
   if(icon != NULL)
-    prop_set_string(ch->ch_prop_icon, icon);
+    prop_batch_set(pb, ch->ch_prop_icon, NULL, PROP_SET_STRING, icon);
   if(title != NULL) {
     mystrset(&ch->ch_title, title);
-    prop_set_string(ch->ch_prop_title, title);
+    prop_batch_set(pb, ch->ch_prop_title, NULL, PROP_SET_STRING, title);
   }
 
   if(chnum > 0)
-    prop_set_int(ch->ch_prop_channelNumber, chnum);
+    prop_batch_set(pb, ch->ch_prop_channelNumber, NULL, PROP_SET_INT, chnum);
+
+  prop_batch_commit(pb);
 
   if(htsmsg_get_u32(m, "eventId", &id))
     id = 0;
@@ -1767,7 +1774,7 @@ htsp_subscriber(htsp_connection_t *hc, htsp_subscription_t *hs,
   // With a set mq_stream mp_configure things that we don't use
   // audio at all which might screw up A/V sync on some platforms (rpi)
   mp->mp_audio.mq_stream = 0;
-  mp_configure(mp, mp_flags, MP_BUFFER_DEEP, 0, "tv");
+  mp_configure(mp, mp_flags | MP_LIVE, MP_BUFFER_DEEP, 0, "tv");
 
   if(primary)
     mp_become_primary(mp);
@@ -258,7 +258,7 @@ es_fap_open(struct fa_protocol *fap, const char *url,
   hts_mutex_lock(&es_fa_mutex);
   fah->fah_status = ES_FA_WORKING;
 
-  task_run(es_fap_open_task, fah);
+  task_run_ex(es_fap_open_task, fah, TASK_PRIO_INTERACTIVE, 0);
 
   while(fah->fah_status == ES_FA_WORKING)
     hts_cond_wait(&es_fa_cond, &es_fa_mutex);
@@ -350,7 +350,7 @@ es_fap_read(fa_handle_t *fh, void *buf, size_t size)
   hts_mutex_lock(&es_fa_mutex);
   fah->fah_status = ES_FA_WORKING;
 
-  task_run(es_fap_read_task, fah_retain(fah));
+  task_run_ex(es_fap_read_task, fah_retain(fah), TASK_PRIO_INTERACTIVE, 0);
 
   while(fah->fah_status == ES_FA_WORKING)
     hts_cond_wait(&es_fa_cond, &es_fa_mutex);
@@ -561,7 +561,7 @@ es_fap_stat(struct fa_protocol *fap, const char *url,
   fah->fah_errbuf = errbuf;
   fah->fah_errsize = errsize;
   fah->fah_status = ES_FA_WORKING;
-  task_run(es_fap_stat_task, fah);
+  task_run_ex(es_fap_stat_task, fah, TASK_PRIO_INTERACTIVE, 0);
 
   hts_mutex_lock(&es_fa_mutex);
 
@@ -666,7 +666,7 @@ es_fap_redirect(struct fa_protocol *fap, const char *url)
   atomic_set(&fah->fah_refcount, 2);
 
   fah->fah_status = ES_FA_WORKING;
-  task_run(es_fap_redirect_task, fah);
+  task_run_ex(es_fap_redirect_task, fah, TASK_PRIO_INTERACTIVE, 0);
 
   hts_mutex_lock(&es_fa_mutex);
 
@@ -405,7 +405,7 @@ es_http_req(duk_context *ctx)
     // Async mode
     es_resource_link(&ehr->super, ec, 1);
     es_root_register(ctx, 2, ehr);
-    task_run(ehr_task, ehr);
+    task_run_ex(ehr_task, ehr, TASK_PRIO_BULK, 0);
     return 0;
   }
 
@@ -151,6 +151,8 @@ static struct strtab actionnames[] = {
   { "NextTrack",             ACTION_SKIP_FORWARD },
   { "SeekForward",           ACTION_SEEK_FORWARD },
   { "SeekReverse",           ACTION_SEEK_BACKWARD },
+  { "FastForward",           ACTION_FAST_FORWARD },
+  { "Rewind",                ACTION_REWIND },
 
   { "VolumeUp",              ACTION_VOLUME_UP },
   { "VolumeDown",            ACTION_VOLUME_DOWN },
@@ -588,6 +590,8 @@ event_dispatch(event_t *e)
 
   } else if(event_is_action(e, ACTION_SEEK_BACKWARD) ||
 	    event_is_action(e, ACTION_SEEK_FORWARD) ||
+	    event_is_action(e, ACTION_FAST_FORWARD) ||
+	    event_is_action(e, ACTION_REWIND) ||
 	    event_is_action(e, ACTION_PLAYPAUSE) ||
 	    event_is_action(e, ACTION_PLAY) ||
 	    event_is_action(e, ACTION_PAUSE) ||
@@ -81,6 +81,9 @@ typedef enum {
   ACTION_SEEK_FORWARD,
   ACTION_SEEK_BACKWARD,
 
+  ACTION_FAST_FORWARD,
+  ACTION_REWIND,
+
   ACTION_VOLUME_UP,
   ACTION_VOLUME_DOWN,
   ACTION_VOLUME_MUTE_TOGGLE,
@@ -173,6 +176,7 @@ typedef enum {
   EVENT_PROP_ACTION                   = 29,
   EVENT_SCROLL                        = 30,
   EVENT_INSERT_STRING                 = 31,
+  EVENT_TRICKPLAY                     = 32, // Trickplay speed (0 = off)
 } event_type_t;
 
 
@@ -29,18 +29,30 @@
 #define BLOCKSIZE 16
 
 /**
+ * Data is decrypted in place in buffers obtained with fa_read_buf().
  *
+ * The final block of the stream carries the PKCS#7 padding, and we
+ * don't know which block is the final one until the source hits EOF.
+ * So each decrypted chunk is held back in 'next' until the one after
+ * it has been read, and only then moved over to 'pending' to be handed
+ * out. That way chunks go out whole instead of being split around a
+ * held back block
  */
 typedef struct aes_fh {
   fa_handle_t h;
   fa_handle_t *src;
   uint8_t iv[16];
   struct AVAES *aes;
-  
-  uint8_t  inbuffer[BLOCKSIZE*MAX_BUFFER_BLOCKS];
-  uint8_t outbuffer[BLOCKSIZE*MAX_BUFFER_BLOCKS];
-  uint8_t *outptr;
-  int inlen, inlen_used, outlen, eof;
+
+  buf_t *pending;           // Decrypted, ready to be handed out
+  int pending_off;
+
+  buf_t *next;              // Decrypted, might be the final chunk
+
+  uint8_t tail[BLOCKSIZE];  // Ciphertext not yet making up a full block
+  int tail_len;
+
+  int eof;
 
 } aes_fh_t;
 
@@ -52,6 +64,8 @@ static void
 aes_close(fa_handle_t *h)
 {
   aes_fh_t *a = (aes_fh_t *)h;
+  buf_release(a->pending);
+  buf_release(a->next);
   av_freep(&a->aes);
   a->src->fh_proto->fap_close(a->src);
   free(a);
@@ -79,58 +93,167 @@ aescbc_fsize(fa_handle_t *handle)
 }
 
 
-
 /**
+ * Strip PKCS#7 padding from the final chunk.
  *
+ * A bogus pad byte usually means the source was cut short. Like before
+ * we don't fail the read over it, all data we got is passed on
  */
-static int
-aescbc_read(fa_handle_t *handle, void *buf, size_t size)
+static buf_t *
+aescbc_unpad(buf_t *b)
 {
-  int blocks;
-  aes_fh_t *a = (aes_fh_t *)handle;
+  const int pad = buf_c8(b)[buf_size(b) - 1];
 
-  while(1) {
+  if(pad == 0 || pad > BLOCKSIZE) {
+    TRACE(TRACE_DEBUG, "AES", "Invalid padding %d in final block, ignored",
+          pad);
+    return b;
+  }
+
+  b->b_size -= pad;
+  if(b->b_size > 0)
+    return b;
+  buf_release(b);
+  return NULL;
+}
 
-    if(a->outlen > 0) {
-      size = MIN(size, a->outlen);
-      memcpy(buf, a->outptr, size);
-      a->outptr += size;
-      a->outlen -= size;
-      return size;
+
+/**
+ * Read and decrypt one chunk from the source. Returns NULL if it
+ * didn't complete a single block (or if source is at EOF, a->eof is
+ * set then)
+ */
+static buf_t *
+aescbc_decrypt_chunk(aes_fh_t *a, size_t size)
+{
+  buf_t *b;
+
+  size = MAX(size & ~(BLOCKSIZE - 1), BLOCKSIZE * MAX_BUFFER_BLOCKS);
+
+  int r = fa_read_buf(a->src, &b, size);
+  if(r <= 0) {
+    a->eof = 1;
+    return NULL;
+  }
+
+  b = buf_make_writable(b);
+
+  if(a->tail_len > 0) {
+    // Previous read ended mid block
+    buf_t *nb = buf_create(a->tail_len + r);
+    if(nb == NULL) {
+      buf_release(b);
+      a->eof = 1;
+      return NULL;
     }
+    memcpy(nb->b_ptr, a->tail, a->tail_len);
+    memcpy(nb->b_ptr + a->tail_len, buf_data(b), r);
+    buf_release(b);
+    b = nb;
+  }
+
+  uint8_t *data = b->b_ptr;
+  const int blocks = buf_size(b) / BLOCKSIZE;
+
+  a->tail_len = buf_size(b) - blocks * BLOCKSIZE;
+  memcpy(a->tail, data + blocks * BLOCKSIZE, a->tail_len);
 
-    while(a->inlen - a->inlen_used < 2 * BLOCKSIZE) {
-      int n = a->src->fh_proto->fap_read(a->src, a->inbuffer + a->inlen,
-					 sizeof(a->inbuffer) - a->inlen);
-      if(n <= 0) {
-	a->eof = 1;
-	break;
+  if(blocks == 0) {
+    buf_release(b);
+    return NULL;
+  }
+
+  av_aes_crypt(a->aes, data, data, blocks, a->iv, 1);
+  b->b_size = blocks * BLOCKSIZE;
+  return b;
+}
+
+
+/**
+ * Move next chunk to 'pending'. Must only be called when 'pending' is
+ * drained. Leaves 'pending' empty at end of stream
+ */
+static void
+aescbc_fill(aes_fh_t *a, size_t size)
+{
+  while(1) {
+    if(a->eof) {
+      if(a->next != NULL) {
+        a->pending = aescbc_unpad(a->next);
+        a->pending_off = 0;
+        a->next = NULL;
       }
-      a->inlen += n;
+      return;
+    }
+
+    buf_t *b = aescbc_decrypt_chunk(a, size);
+    if(b == NULL)
+      continue;
+
+    if(a->next != NULL) {
+      a->pending = a->next;
+      a->pending_off = 0;
+      a->next = b;
+      return;
     }
+    a->next = b;
+  }
+}
 
-    if((blocks = (a->inlen - a->inlen_used) / BLOCKSIZE) == 0)
+
+/**
+ *
+ */
+static int
+aescbc_read(fa_handle_t *handle, void *buf, size_t size)
+{
+  aes_fh_t *a = (aes_fh_t *)handle;
+
+  if(a->pending == NULL) {
+    aescbc_fill(a, size);
+    if(a->pending == NULL)
       return 0;
+  }
 
-    if(!a->eof)
-      blocks--;
+  size = MIN(size, buf_size(a->pending) - a->pending_off);
+  memcpy(buf, buf_c8(a->pending) + a->pending_off, size);
+  a->pending_off += size;
+  if(a->pending_off == buf_size(a->pending)) {
+    buf_release(a->pending);
+    a->pending = NULL;
+  }
+  return size;
+}
 
-    av_aes_crypt(a->aes, a->outbuffer, a->inbuffer + a->inlen_used, blocks,
-                 a->iv, 1);
 
-    a->outlen = BLOCKSIZE * blocks;
-    a->outptr = a->outbuffer;
-    a->inlen_used += BLOCKSIZE * blocks;
+/**
+ * Hand out the decrypted buffer itself when it fits
+ */
+static int
+aescbc_read_buf(fa_handle_t *handle, buf_t **bp, size_t size)
+{
+  aes_fh_t *a = (aes_fh_t *)handle;
 
-    if(a->inlen_used >= sizeof(a->inbuffer) / 2) {
-      memmove(a->inbuffer, a->inbuffer + a->inlen_used,
-	      a->inlen - a->inlen_used);
-      a->inlen -= a->inlen_used;
-      a->inlen_used = 0;
-    }
-    if(a->eof)
-      a->outlen -= a->outbuffer[a->outlen - 1];
+  if(a->pending == NULL) {
+    aescbc_fill(a, size);
+    if(a->pending == NULL)
+      return 0;
   }
+
+  if(a->pending_off == 0 && buf_size(a->pending) <= size) {
+    int r = buf_size(a->pending);
+    *bp = a->pending;
+    a->pending = NULL;
+    return r;
+  }
+
+  buf_t *b = buf_create(MIN(size, buf_size(a->pending) - a->pending_off));
+  if(b == NULL)
+    return -1;
+
+  int r = aescbc_read(handle, b->b_ptr, buf_size(b));
+  *bp = b;
+  return r;
 }
 
 
@@ -141,6 +264,7 @@ static fa_protocol_t fa_protocol_aescbc = {
   .fap_name  = "aescbc",
   .fap_close = aes_close,
   .fap_read  = aescbc_read,
+  .fap_read_buf = aescbc_read_buf,
   .fap_seek  = aescbc_seek,
   .fap_fsize = aescbc_fsize,
 };
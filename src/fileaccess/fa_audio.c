@@ -102,44 +102,44 @@ rescale(AVFormatContext *fctx, int64_t ts, int si)
 
 #define MB_SPECIAL_EOF ((void *)-1)
 
+#define AUDIO_PRELOAD_PACKETS 32
+
+struct audio_preload;
+static void audio_preload_destroy(struct audio_preload *ap);
+
 /**
  *
  */
 static void
-seekflush(media_pipe_t *mp, media_buf_t **mbp)
+seekflush(media_pipe_t *mp, media_buf_t **mbp, struct audio_preload **app)
 {
   mp_flush(mp);
   
   if(*mbp != NULL && *mbp != MB_SPECIAL_EOF)
     media_buf_free_unlocked(mp, *mbp);
   *mbp = NULL;
+
+  // Pre-rolled packets are from before the seek
+  if(*app != NULL)
+    audio_preload_destroy(*app);
+  *app = NULL;
 }
 
 /**
+ * Open and probe an audio file
  *
+ * Returns NULL if libav can't play the file. Files that are played by
+ * other means (ZIP archives, native plugins) are played right away if
+ * 'mp' is given, and the resulting event is returned in *ep.
  */
-event_t *
-be_file_playaudio(const char *url, media_pipe_t *mp,
-		  char *errbuf, size_t errlen, int hold, const char *mimetype,
-                  void *opaque)
+static AVFormatContext *
+audio_open(const char *url, media_pipe_t *mp, char *errbuf, size_t errlen,
+           int hold, const char *mimetype, event_t **ep)
 {
   AVFormatContext *fctx;
-  AVCodecContext *ctx;
-  AVPacket pkt;
-  media_format_t *fw;
-  int i, r, si;
-  media_buf_t *mb = NULL;
-  media_queue_t *mq;
-  event_ts_t *ets;
-  int64_t ts;
-  media_codec_t *cw;
-  event_t *e;
-  int registered_play = 0;
   uint8_t pb[4096];
   size_t psiz;
 
-  mp->mp_seek_base = 0;
-
   fa_handle_t *fh = fa_open_ex(url, errbuf, errlen, FA_BUFFERED_SMALL, NULL);
   if(fh == NULL)
     return NULL;
@@ -152,31 +152,40 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
     return NULL;
   }
 
-  if(pb[0] == 0x50 && pb[1] == 0x4b && pb[2] == 0x03 && pb[3] == 0x04)
+  if(pb[0] == 0x50 && pb[1] == 0x4b && pb[2] == 0x03 && pb[3] == 0x04) {
     // ZIP File
-    return audio_play_zipfile(fh, mp, errbuf, errlen, hold);
+    if(mp == NULL) {
+      fa_close(fh);
+      snprintf(errbuf, errlen, "ZIP archive");
+      return NULL;
+    }
+    *ep = audio_play_zipfile(fh, mp, errbuf, errlen, hold);
+    return NULL;
+  }
 
 #if ENABLE_PLUGINS
-  plugin_probe_for_autoinstall(fh, pb, psiz, url);
+  if(mp != NULL)
+    plugin_probe_for_autoinstall(fh, pb, psiz, url);
 #endif
 
 #if ENABLE_VMIR
   metadata_t *md = metadata_create();
   if(np_fa_probe(fh, pb, psiz, md, url) == 0) {
     fa_close_with_park(fh, 1);
-    event_t *e = NULL;
-    if(md->md_redirect == NULL) {
+    if(mp == NULL) {
+      snprintf(errbuf, errlen, "Handled by external player");
+    } else if(md->md_redirect == NULL) {
       snprintf(errbuf, errlen, "External player provided no redirect URL");
     } else if(!strcmp(md->md_redirect, url)) {
       snprintf(errbuf, errlen, "Redirect loop %s -> %s", url, md->md_redirect);
     } else {
       TRACE(TRACE_DEBUG, "Audio", "%s redirects to %s",
             url, md->md_redirect);
-      e = backend_play_audio(md->md_redirect, mp, errbuf, errlen, hold,
-                             mimetype);
+      *ep = backend_play_audio(md->md_redirect, mp, errbuf, errlen, hold,
+                               mimetype);
     }
     metadata_destroy(md);
-    return e;
+    return NULL;
   }
   metadata_destroy(md);
 #endif
@@ -193,6 +202,174 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
     fa_libav_close(avio);
     return NULL;
   }
+  return fctx;
+}
+
+
+/**
+ * An audio file that has been opened, probed and had its first packets
+ * read ahead of time, so the playqueue doesn't stall on I/O moving on to it
+ */
+typedef struct audio_preload {
+  char *ap_url;
+  AVFormatContext *ap_fctx;
+  int ap_num_pkts;
+  int ap_next_pkt;
+  AVPacket ap_pkts[AUDIO_PRELOAD_PACKETS];
+} audio_preload_t;
+
+static hts_mutex_t audio_preload_mutex;
+static audio_preload_t *audio_preload; // Only one file is preloaded at a time
+
+
+/**
+ *
+ */
+static void
+audio_preload_destroy(audio_preload_t *ap)
+{
+  while(ap->ap_next_pkt < ap->ap_num_pkts)
+    av_packet_unref(&ap->ap_pkts[ap->ap_next_pkt++]);
+
+  if(ap->ap_fctx != NULL)
+    fa_libav_close_format(ap->ap_fctx, 0);
+  free(ap->ap_url);
+  free(ap);
+}
+
+
+/**
+ * Take the preloaded file if it matches 'url'. Any other preloaded
+ * file is discarded as it's no longer going to be played next
+ */
+static audio_preload_t *
+audio_preload_take(const char *url)
+{
+  hts_mutex_lock(&audio_preload_mutex);
+  audio_preload_t *ap = audio_preload;
+  audio_preload = NULL;
+  hts_mutex_unlock(&audio_preload_mutex);
+
+  if(ap != NULL && strcmp(ap->ap_url, url)) {
+    audio_preload_destroy(ap);
+    ap = NULL;
+  }
+  return ap;
+}
+
+
+/**
+ * Read next packet, starting with whatever was read during preload
+ */
+static int
+audio_read_frame(AVFormatContext *fctx, AVPacket *pkt, audio_preload_t *ap)
+{
+  if(ap != NULL && ap->ap_next_pkt < ap->ap_num_pkts) {
+    *pkt = ap->ap_pkts[ap->ap_next_pkt++];
+    return 0;
+  }
+  return av_read_frame(fctx, pkt);
+}
+
+
+/**
+ *
+ */
+int
+be_file_preload_audio(const char *url, char *errbuf, size_t errlen,
+                      const char *mimetype, void *opaque)
+{
+  event_t *e = NULL;
+  AVFormatContext *fctx;
+  AVPacket pkt;
+  int stream = -1;
+
+  hts_mutex_lock(&audio_preload_mutex);
+  int done = audio_preload != NULL && !strcmp(audio_preload->ap_url, url);
+  hts_mutex_unlock(&audio_preload_mutex);
+  if(done)
+    return 0;
+
+  fctx = audio_open(url, NULL, errbuf, errlen, 0, mimetype, &e);
+  if(fctx == NULL)
+    return -1;
+
+  for(int i = 0; i < fctx->nb_streams; i++) {
+    if(fctx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
+      stream = i;
+      break;
+    }
+  }
+
+  if(stream == -1) {
+    fa_libav_close_format(fctx, 0);
+    snprintf(errbuf, errlen, "No audio stream");
+    return -1;
+  }
+
+  audio_preload_t *ap = calloc(1, sizeof(audio_preload_t));
+  ap->ap_url = strdup(url);
+  ap->ap_fctx = fctx;
+
+  /*
+   * Demuxers may return packets pointing into their own buffers, which
+   * are reused by the next read, so take our own reference.
+   * Other streams are dropped by the player anyway
+   */
+  while(ap->ap_num_pkts < AUDIO_PRELOAD_PACKETS &&
+        av_read_frame(fctx, &pkt) == 0) {
+    if(pkt.stream_index == stream &&
+       !av_packet_ref(&ap->ap_pkts[ap->ap_num_pkts], &pkt))
+      ap->ap_num_pkts++;
+    av_packet_unref(&pkt);
+  }
+
+  TRACE(TRACE_DEBUG, "Audio", "Preloaded %s (%d packets)",
+        url, ap->ap_num_pkts);
+
+  hts_mutex_lock(&audio_preload_mutex);
+  audio_preload_t *old = audio_preload;
+  audio_preload = ap;
+  hts_mutex_unlock(&audio_preload_mutex);
+
+  if(old != NULL)
+    audio_preload_destroy(old);
+  return 0;
+}
+
+
+/**
+ *
+ */
+event_t *
+be_file_playaudio(const char *url, media_pipe_t *mp,
+		  char *errbuf, size_t errlen, int hold, const char *mimetype,
+                  void *opaque)
+{
+  AVFormatContext *fctx;
+  AVCodecContext *ctx;
+  AVPacket pkt;
+  media_format_t *fw;
+  int i, r, si;
+  media_buf_t *mb = NULL;
+  media_queue_t *mq;
+  event_ts_t *ets;
+  int64_t ts;
+  media_codec_t *cw;
+  event_t *e = NULL;
+  int registered_play = 0;
+
+  mp->mp_seek_base = 0;
+
+  audio_preload_t *ap = audio_preload_take(url);
+  if(ap != NULL) {
+    fctx = ap->ap_fctx;
+    ap->ap_fctx = NULL;
+  } else {
+    fctx = audio_open(url, mp, errbuf, errlen, hold, mimetype, &e);
+    if(fctx == NULL)
+      return e;
+  }
 
   usage_event("Play audio", 1, USAGE_SEG("format", fctx->iformat->name));
 
@@ -220,6 +397,8 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
   
   if(cw == NULL) {
     media_format_deref(fw);
+    if(ap != NULL)
+      audio_preload_destroy(ap);
     snprintf(errbuf, errlen, "Unable to open codec");
     return NULL;
   }
@@ -238,7 +417,7 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
     if(mb == NULL) {
       
       mp->mp_eof = 0;
-      r = av_read_frame(fctx, &pkt);
+      r = audio_read_frame(fctx, &pkt, ap);
       if(r == AVERROR(EAGAIN))
 	continue;
       
@@ -340,7 +519,7 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
 	ts = MAX(ets->ts, 0);
       }
       av_seek_frame(fctx, -1, ts, AVSEEK_FLAG_BACKWARD);
-      seekflush(mp, &mb);
+      seekflush(mp, &mb, &ap);
       
     } else if(event_is_action(e, ACTION_SKIP_BACKWARD)) {
 
@@ -348,7 +527,7 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
 	goto skip;
       int64_t z = fctx->start_time != PTS_UNSET ? fctx->start_time : 0;
       av_seek_frame(fctx, -1, z, AVSEEK_FLAG_BACKWARD);
-      seekflush(mp, &mb);
+      seekflush(mp, &mb, &ap);
 
     } else if(event_is_action(e, ACTION_SKIP_FORWARD) ||
 	      event_is_action(e, ACTION_STOP)) {
@@ -362,8 +541,23 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
   if(mb != NULL && mb != MB_SPECIAL_EOF)
     media_buf_free_unlocked(mp, mb);
 
+  if(ap != NULL)
+    audio_preload_destroy(ap);
+
   media_codec_deref(cw);
   media_format_deref(fw);
 
   return e;
 }
+
+
+/**
+ *
+ */
+static void
+audio_preload_init(void)
+{
+  hts_mutex_init(&audio_preload_mutex);
+}
+
+INITME(INIT_GROUP_API, audio_preload_init, NULL, 0);
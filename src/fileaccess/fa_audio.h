@@ -26,3 +26,6 @@ struct fa_handle;
 event_t *be_file_playaudio(const char *url, media_pipe_t *mp,
 			   char *errbuf, size_t errlen, int hold,
 			   const char *mimetype, void *opaque);
+
+int be_file_preload_audio(const char *url, char *errbuf, size_t errlen,
+                          const char *mimetype, void *opaque);
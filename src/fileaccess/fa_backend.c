@@ -316,6 +316,7 @@ static backend_t be_file = {
 #if ENABLE_METADATA
   .be_play_video = be_file_playvideo,
   .be_play_audio = be_file_playaudio,
+  .be_preload_audio = be_file_preload_audio,
   .be_probe = fa_check_url,
 #endif
 };
@@ -0,0 +1,229 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "misc/queue.h"
+#include "misc/minmax.h"
+#include "misc/murmur3.h"
+#include "fa_blockcache.h"
+
+#define BC_MAX_AGE    (300 * 1000000LL)  // Don't trust blocks older than this
+#define BC_HASH_SIZE  256
+
+LIST_HEAD(bc_block_list, bc_block);
+TAILQ_HEAD(bc_block_queue, bc_block);
+
+typedef struct bc_block {
+  LIST_ENTRY(bc_block) bcb_hash_link;
+  TAILQ_ENTRY(bc_block) bcb_lru_link;  // Head is most recently used
+  char *bcb_url;
+  int64_t bcb_index;
+  int64_t bcb_fsize;   // Size and mtime of file when the block was read
+  time_t bcb_mtime;
+  int64_t bcb_created;
+  uint32_t bcb_hash;
+  uint8_t bcb_data[FA_BLOCKCACHE_BLOCK_SIZE];
+} bc_block_t;
+
+static HTS_MUTEX_DECL(bc_mutex);
+static struct bc_block_list bc_hash[BC_HASH_SIZE];
+static struct bc_block_queue bc_lru = TAILQ_HEAD_INITIALIZER(bc_lru);
+static int bc_num_blocks;
+static int bc_budget;
+
+
+/**
+ * Sized after the largest video buffer the platform allows. That is
+ * what low memory platforms lower, giving 16MB by default and 8MB on
+ * 256MB systems
+ *
+ * Must be called with bc_mutex held
+ */
+static int
+bc_get_budget(void)
+{
+  if(bc_budget == 0)
+    bc_budget = (gconf.max_video_buffer_size ?: 128) * 1024 * 1024 / 8;
+  return bc_budget;
+}
+
+
+/**
+ *
+ */
+static uint32_t
+bc_hash_key(const char *url, int64_t index)
+{
+  return MurHash3_32(url, strlen(url), index ^ (index >> 32));
+}
+
+
+/**
+ *
+ */
+static void
+bc_block_destroy(bc_block_t *bcb)
+{
+  LIST_REMOVE(bcb, bcb_hash_link);
+  TAILQ_REMOVE(&bc_lru, bcb, bcb_lru_link);
+  bc_num_blocks--;
+  free(bcb->bcb_url);
+  free(bcb);
+}
+
+
+/**
+ * Must be called with bc_mutex held
+ */
+static bc_block_t *
+bc_find(const char *url, int64_t fsize, time_t mtime, int64_t index,
+        uint32_t hash)
+{
+  bc_block_t *bcb;
+
+  LIST_FOREACH(bcb, &bc_hash[hash & (BC_HASH_SIZE - 1)], bcb_hash_link) {
+    if(bcb->bcb_hash == hash && bcb->bcb_index == index &&
+       !strcmp(bcb->bcb_url, url))
+      break;
+  }
+
+  if(bcb == NULL)
+    return NULL;
+
+  // File has changed since the block was read, or it's simply too old
+  if(bcb->bcb_fsize != fsize || bcb->bcb_mtime != mtime ||
+     arch_get_ts() - bcb->bcb_created > BC_MAX_AGE) {
+    bc_block_destroy(bcb);
+    return NULL;
+  }
+
+  TAILQ_REMOVE(&bc_lru, bcb, bcb_lru_link);
+  TAILQ_INSERT_HEAD(&bc_lru, bcb, bcb_lru_link);
+  return bcb;
+}
+
+
+/**
+ * Copy data at 'pos' from the cache. Never crosses a block boundary.
+ * Returns number of bytes copied, 0 if the block is not cached
+ */
+int
+fa_blockcache_read(const char *url, int64_t fsize, time_t mtime,
+                   int64_t pos, void *buf, int size)
+{
+  const int64_t index = pos / FA_BLOCKCACHE_BLOCK_SIZE;
+  const int offset = pos % FA_BLOCKCACHE_BLOCK_SIZE;
+  const uint32_t hash = bc_hash_key(url, index);
+  int r = 0;
+
+  if(fsize < 0)
+    return 0;
+
+  size = MIN(size, FA_BLOCKCACHE_BLOCK_SIZE - offset);
+
+  hts_mutex_lock(&bc_mutex);
+  bc_block_t *bcb = bc_find(url, fsize, mtime, index, hash);
+  if(bcb != NULL) {
+    memcpy(buf, bcb->bcb_data + offset, size);
+    r = size;
+  }
+  hts_mutex_unlock(&bc_mutex);
+  return r;
+}
+
+
+/**
+ * Store all complete blocks covered by [pos, pos + size)
+ */
+void
+fa_blockcache_store(const char *url, int64_t fsize, time_t mtime,
+                    int64_t pos, const void *buf, int size)
+{
+  const int skip = (FA_BLOCKCACHE_BLOCK_SIZE - pos % FA_BLOCKCACHE_BLOCK_SIZE) %
+    FA_BLOCKCACHE_BLOCK_SIZE;
+
+  if(fsize < 0 || size < skip + FA_BLOCKCACHE_BLOCK_SIZE)
+    return;
+
+  pos += skip;
+  buf += skip;
+  size -= skip;
+
+  hts_mutex_lock(&bc_mutex);
+
+  for(; size >= FA_BLOCKCACHE_BLOCK_SIZE;
+      pos += FA_BLOCKCACHE_BLOCK_SIZE, buf += FA_BLOCKCACHE_BLOCK_SIZE,
+        size -= FA_BLOCKCACHE_BLOCK_SIZE) {
+
+    const int64_t index = pos / FA_BLOCKCACHE_BLOCK_SIZE;
+    const uint32_t hash = bc_hash_key(url, index);
+
+    if(bc_find(url, fsize, mtime, index, hash) != NULL)
+      continue;
+
+    bc_block_t *bcb;
+
+    if(bc_num_blocks * FA_BLOCKCACHE_BLOCK_SIZE >= bc_get_budget()) {
+      // Recycle least recently used block
+      bcb = TAILQ_LAST(&bc_lru, bc_block_queue);
+      LIST_REMOVE(bcb, bcb_hash_link);
+      TAILQ_REMOVE(&bc_lru, bcb, bcb_lru_link);
+      free(bcb->bcb_url);
+    } else {
+      bcb = malloc(sizeof(bc_block_t));
+      if(bcb == NULL)
+        break;
+      bc_num_blocks++;
+    }
+
+    bcb->bcb_url = strdup(url);
+    bcb->bcb_index = index;
+    bcb->bcb_fsize = fsize;
+    bcb->bcb_mtime = mtime;
+    bcb->bcb_hash = hash;
+    bcb->bcb_created = arch_get_ts();
+    memcpy(bcb->bcb_data, buf, FA_BLOCKCACHE_BLOCK_SIZE);
+
+    LIST_INSERT_HEAD(&bc_hash[hash & (BC_HASH_SIZE - 1)], bcb, bcb_hash_link);
+    TAILQ_INSERT_HEAD(&bc_lru, bcb, bcb_lru_link);
+  }
+
+  hts_mutex_unlock(&bc_mutex);
+}
+
+
+/**
+ * Drop all blocks for the given url (file written, deleted, etc)
+ */
+void
+fa_blockcache_invalidate(const char *url)
+{
+  bc_block_t *bcb, *next;
+
+  hts_mutex_lock(&bc_mutex);
+  for(bcb = TAILQ_FIRST(&bc_lru); bcb != NULL; bcb = next) {
+    next = TAILQ_NEXT(bcb, bcb_lru_link);
+    if(!strcmp(bcb->bcb_url, url))
+      bc_block_destroy(bcb);
+  }
+  hts_mutex_unlock(&bc_mutex);
+}
@@ -0,0 +1,43 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Process wide cache of file blocks, keyed by (url, block index)
+ *
+ * Shared by all buffered handles (fa_buffer.c) so reopening the same
+ * file (probe, thumbnail, subtitle scan, playback) is served from
+ * memory. Only complete blocks are stored
+ *
+ * Blocks also remember the size and mtime the file had when opened and
+ * are only returned to handles that saw the same. Files of unknown
+ * size (live streams, etc) are not cached at all
+ */
+#define FA_BLOCKCACHE_BLOCK_SIZE (64 * 1024)
+
+int fa_blockcache_read(const char *url, int64_t fsize, time_t mtime,
+                       int64_t pos, void *buf, int size);
+
+void fa_blockcache_store(const char *url, int64_t fsize, time_t mtime,
+                         int64_t pos, const void *buf, int size);
+
+void fa_blockcache_invalidate(const char *url);
@@ -22,8 +22,10 @@
 #include "main.h"
 #include "fileaccess.h"
 #include "fa_proto.h"
+#include "fa_blockcache.h"
 #include "misc/minmax.h"
 #include "misc/callout.h"
+#include "prop/prop.h"
 
 #define FILE_PARKING 1
 
@@ -32,6 +34,9 @@
 #define BF_ZONES 8
 #define BF_MASK (BF_ZONES - 1)
 
+#define BF_RA_SIZE     (4 * 1024 * 1024)
+#define BF_RA_TRIGGER  4   // Sequential bf_min_request:s before readahead starts
+
 static HTS_MUTEX_DECL(buffered_global_mutex);
 
 typedef struct buffered_zone {
@@ -66,12 +71,56 @@ typedef struct buffered_file {
 
   int64_t bf_size;
 
+  int64_t bf_src_size;   // Size and mtime of source when opened,
+  time_t bf_src_mtime;   // identifies the version in the block cache
+
   int bf_flags;
 
   char *bf_url;
 
   buffered_zone_t bf_zones[BF_ZONES];
 
+  /**
+   * Background readahead (FA_BUFFERED_BIG only)
+   *
+   * Once sequential access is detected a worker thread keeps a window
+   * of data ahead of bf_fpos in bf_ra_mem. bf_src is only touched by
+   * one thread at a time, see fab_src_acquire(). Everything below is
+   * protected by bf_ra_mutex except the fields noted as owned by the
+   * reading thread
+   */
+  hts_mutex_t bf_ra_mutex;
+  hts_cond_t bf_ra_cond;
+  hts_thread_t bf_ra_tid;
+
+  int bf_ra_enabled;        // Reading thread: Handle may do readahead
+  int bf_ra_running;        // Reading thread: Worker thread is started
+  int64_t bf_ra_seq;        // Reading thread: Sequential bytes read
+  int64_t bf_ra_next;       // Reading thread: Expected next source read
+
+  int bf_ra_run;
+  int bf_ra_active;         // Worker should keep the window filled
+  int bf_ra_src_busy;       // Someone is doing I/O on bf_src
+  int bf_ra_gen;            // Bumped when the window is moved
+  int bf_ra_eof;            // EOF or error, worker stops
+
+  uint8_t *bf_ra_mem;
+  int64_t bf_ra_start;      // File position of first byte in window
+  int bf_ra_rd;             // Offset of bf_ra_start in bf_ra_mem
+  int bf_ra_fill;           // Bytes available from bf_ra_start
+  int bf_ra_window;         // Target fill level
+  int bf_ra_window_min;     // Grows when the reader stalls
+
+  int bf_ra_read_time;      // Average time of one source read (µs)
+  int bf_ra_consume_rate;   // Bytes/s taken by the reader
+  int64_t bf_ra_consumed;
+  int64_t bf_ra_consume_ts;
+
+  int bf_ra_stalls;
+  int64_t bf_ra_stall_time; // µs
+  int64_t bf_ra_publish_ts;
+
+  prop_t *bf_stats;
 
 } buffered_file_t;
 
@@ -231,12 +280,374 @@ need_to_fill(const buffered_file_t *bf, int64_t fpos, size_t rd)
 }
 
 
+/**
+ * Get exclusive access to bf_src. Only needed once the readahead
+ * worker is running
+ */
+static void
+fab_src_acquire(buffered_file_t *bf)
+{
+  if(!bf->bf_ra_running)
+    return;
+
+  hts_mutex_lock(&bf->bf_ra_mutex);
+  while(bf->bf_ra_src_busy)
+    hts_cond_wait(&bf->bf_ra_cond, &bf->bf_ra_mutex);
+  bf->bf_ra_src_busy = 1;
+  hts_mutex_unlock(&bf->bf_ra_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+fab_src_release(buffered_file_t *bf)
+{
+  if(!bf->bf_ra_running)
+    return;
+
+  hts_mutex_lock(&bf->bf_ra_mutex);
+  bf->bf_ra_src_busy = 0;
+  hts_cond_broadcast(&bf->bf_ra_cond);
+  hts_mutex_unlock(&bf->bf_ra_mutex);
+}
+
+
+/**
+ * Size the window to cover what the reader consumes during a few
+ * source requests. If the source can't keep up we will stall and
+ * bf_ra_window_min grows instead
+ */
+static void
+fab_ra_update_window_locked(buffered_file_t *bf)
+{
+  int64_t w = (int64_t)bf->bf_ra_consume_rate * bf->bf_ra_read_time * 4 /
+    1000000;
+
+  w = MAX(w, bf->bf_ra_window_min);
+  bf->bf_ra_window = MIN(w, BF_RA_SIZE - bf->bf_min_request);
+}
+
+
+/**
+ *
+ */
+static void
+fab_ra_consume_locked(buffered_file_t *bf, int bytes)
+{
+  bf->bf_ra_start += bytes;
+  bf->bf_ra_rd = (bf->bf_ra_rd + bytes) % BF_RA_SIZE;
+  bf->bf_ra_fill -= bytes;
+}
+
+
+/**
+ *
+ */
+static void *
+fab_ra_thread(void *aux)
+{
+  buffered_file_t *bf = aux;
+  fa_handle_t *src = bf->bf_src;
+
+  hts_mutex_lock(&bf->bf_ra_mutex);
+
+  while(bf->bf_ra_run) {
+
+    if(!bf->bf_ra_active || bf->bf_ra_eof || bf->bf_ra_src_busy ||
+       bf->bf_ra_fill >= bf->bf_ra_window ||
+       BF_RA_SIZE - bf->bf_ra_fill < bf->bf_min_request) {
+      hts_cond_wait(&bf->bf_ra_cond, &bf->bf_ra_mutex);
+      continue;
+    }
+
+    const int gen = bf->bf_ra_gen;
+    const int64_t pos = bf->bf_ra_start + bf->bf_ra_fill;
+    const int off = (bf->bf_ra_rd + bf->bf_ra_fill) % BF_RA_SIZE;
+    // End requests on a block boundary so they can go into the block cache
+    const int len = MIN(bf->bf_min_request -
+                        pos % FA_BLOCKCACHE_BLOCK_SIZE, BF_RA_SIZE - off);
+
+    bf->bf_ra_src_busy = 1;
+    hts_mutex_unlock(&bf->bf_ra_mutex);
+
+    // Nobody else touches the ring beyond bf_ra_fill so no locking
+    uint8_t *dst = bf->bf_ra_mem + off;
+    int64_t ts = 0;
+    int r = fa_blockcache_read(bf->bf_url, bf->bf_src_size, bf->bf_src_mtime,
+                               pos, dst, len);
+
+    if(r == 0) {
+      ts = arch_get_ts();
+      r = -1;
+      if(src->fh_proto->fap_seek(src, pos, SEEK_SET, 0) == pos)
+        r = src->fh_proto->fap_read(src, dst, len);
+      ts = arch_get_ts() - ts;
+      if(r > 0)
+        fa_blockcache_store(bf->bf_url, bf->bf_src_size, bf->bf_src_mtime,
+                            pos, dst, r);
+    }
+
+    hts_mutex_lock(&bf->bf_ra_mutex);
+    bf->bf_ra_src_busy = 0;
+
+    if(gen == bf->bf_ra_gen) {
+      if(r > 0)
+        bf->bf_ra_fill += r;
+
+      if(ts) {
+        // Went to source
+        if(r > 0) {
+          bf->bf_ra_read_time = bf->bf_ra_read_time ?
+            (bf->bf_ra_read_time * 7 + ts) / 8 : ts;
+          fab_ra_update_window_locked(bf);
+        }
+
+        // On error the reader falls back to reading synchronously
+        if(r != len)
+          bf->bf_ra_eof = 1;
+      }
+    }
+    hts_cond_broadcast(&bf->bf_ra_cond);
+  }
+
+  hts_mutex_unlock(&bf->bf_ra_mutex);
+  return NULL;
+}
+
+
+/**
+ * (Re)start readahead at the given position
+ */
+static void
+fab_ra_start(buffered_file_t *bf, int64_t pos)
+{
+  if(bf->bf_ra_mem == NULL) {
+    bf->bf_ra_mem = halloc(BF_RA_SIZE);
+    if(bf->bf_ra_mem == NULL) {
+      bf->bf_ra_enabled = 0;
+      return;
+    }
+  }
+
+  hts_mutex_lock(&bf->bf_ra_mutex);
+  bf->bf_ra_gen++;
+  bf->bf_ra_active = 1;
+  bf->bf_ra_eof = 0;
+  bf->bf_ra_start = pos;
+  bf->bf_ra_rd = 0;
+  bf->bf_ra_fill = 0;
+  bf->bf_ra_consumed = 0;
+  bf->bf_ra_consume_ts = arch_get_ts();
+  if(bf->bf_ra_window_min == 0)
+    bf->bf_ra_window_min = bf->bf_min_request * 2;
+  fab_ra_update_window_locked(bf);
+  hts_cond_broadcast(&bf->bf_ra_cond);
+  hts_mutex_unlock(&bf->bf_ra_mutex);
+
+  if(!bf->bf_ra_running) {
+    bf->bf_ra_run = 1;
+    bf->bf_ra_running = 1;
+    hts_thread_create_joinable("readahead", &bf->bf_ra_tid,
+                               fab_ra_thread, bf, THREAD_PRIO_DEMUXER);
+  }
+}
+
+
+/**
+ * Called for every read served from source or the block cache, starts
+ * readahead when access looks sequential
+ */
+static void
+fab_ra_track(buffered_file_t *bf, int64_t pos, int len)
+{
+  if(!bf->bf_ra_enabled)
+    return;
+
+  bf->bf_ra_seq = pos == bf->bf_ra_next ? bf->bf_ra_seq + len : len;
+  bf->bf_ra_next = pos + len;
+
+  if(bf->bf_ra_seq >= BF_RA_TRIGGER * bf->bf_min_request)
+    fab_ra_start(bf, bf->bf_ra_next);
+}
+
+
+/**
+ * Copy data at bf_fpos out of the readahead window. If the worker is
+ * currently fetching it we wait. Returns 0 if the data is not in the
+ * window, the caller should then read from source itself
+ */
+static int
+fab_ra_read(buffered_file_t *bf, void *buf, size_t size)
+{
+  int r = 0;
+  int64_t stall_start = 0;
+
+  hts_mutex_lock(&bf->bf_ra_mutex);
+
+  while(bf->bf_ra_active) {
+    const int64_t d = bf->bf_fpos - bf->bf_ra_start;
+
+    if(d < 0 || d > bf->bf_ra_fill) {
+      // Seek outside of the window. Stop and restart readahead
+      // after the first synchronous read at the new position
+      bf->bf_ra_gen++;
+      bf->bf_ra_active = 0;
+      bf->bf_ra_fill = 0;
+      bf->bf_ra_seq = BF_RA_TRIGGER * bf->bf_min_request - 1;
+      bf->bf_ra_next = bf->bf_fpos;
+      break;
+    }
+
+    fab_ra_consume_locked(bf, d);
+
+    if(bf->bf_ra_fill > 0) {
+      r = MIN(size, bf->bf_ra_fill);
+      r = MIN(r, BF_RA_SIZE - bf->bf_ra_rd);
+      memcpy(buf, bf->bf_ra_mem + bf->bf_ra_rd, r);
+      fab_ra_consume_locked(bf, r);
+      break;
+    }
+
+    if(bf->bf_ra_eof)
+      break;
+
+    if(stall_start == 0) {
+      stall_start = arch_get_ts();
+      bf->bf_ra_stalls++;
+      bf->bf_ra_window_min = MIN(bf->bf_ra_window_min * 2, BF_RA_SIZE);
+      fab_ra_update_window_locked(bf);
+    }
+    hts_cond_wait(&bf->bf_ra_cond, &bf->bf_ra_mutex);
+  }
+
+  const int64_t now = arch_get_ts();
+
+  if(stall_start)
+    bf->bf_ra_stall_time += now - stall_start;
+
+  if(r > 0) {
+    bf->bf_ra_consumed += r;
+
+    if(now - bf->bf_ra_consume_ts >= 500000) {
+      int rate = bf->bf_ra_consumed * 1000000 / (now - bf->bf_ra_consume_ts);
+      bf->bf_ra_consume_rate = bf->bf_ra_consume_rate ?
+        (bf->bf_ra_consume_rate + rate) / 2 : rate;
+      bf->bf_ra_consumed = 0;
+      bf->bf_ra_consume_ts = now;
+      fab_ra_update_window_locked(bf);
+    }
+    // Worker might be waiting for room
+    hts_cond_broadcast(&bf->bf_ra_cond);
+  }
+
+  hts_mutex_unlock(&bf->bf_ra_mutex);
+  return r;
+}
+
+
+/**
+ * Return true if the given position is in the readahead window
+ */
+static int
+fab_ra_has(buffered_file_t *bf, int64_t pos)
+{
+  int r;
+
+  if(!bf->bf_ra_running)
+    return 0;
+
+  hts_mutex_lock(&bf->bf_ra_mutex);
+  r = bf->bf_ra_active &&
+    pos >= bf->bf_ra_start && pos < bf->bf_ra_start + bf->bf_ra_fill;
+  hts_mutex_unlock(&bf->bf_ra_mutex);
+  return r;
+}
+
+
+/**
+ * Publish fill level and stall counters to the stats prop
+ * given at open (usually the media pipe's io node)
+ */
+static void
+fab_ra_publish(buffered_file_t *bf)
+{
+  if(bf->bf_stats == NULL || !bf->bf_ra_running)
+    return;
+
+  const int64_t now = arch_get_ts();
+  if(now < bf->bf_ra_publish_ts)
+    return;
+  bf->bf_ra_publish_ts = now + 250000;
+
+  hts_mutex_lock(&bf->bf_ra_mutex);
+  const int fill   = bf->bf_ra_fill;
+  const int window = bf->bf_ra_window;
+  const int stalls = bf->bf_ra_stalls;
+  const int stall_time = bf->bf_ra_stall_time / 1000;
+  hts_mutex_unlock(&bf->bf_ra_mutex);
+
+  prop_t *p = prop_create(bf->bf_stats, "readahead");
+  prop_set(p, "fill",      PROP_SET_INT, fill);
+  prop_set(p, "window",    PROP_SET_INT, window);
+  prop_set(p, "stalls",    PROP_SET_INT, stalls);
+  prop_set(p, "stallTime", PROP_SET_INT, stall_time);
+}
+
+
+/**
+ * Stop readahead worker and drop the window
+ */
+static void
+fab_ra_stop(buffered_file_t *bf)
+{
+  if(bf->bf_ra_running) {
+    hts_mutex_lock(&bf->bf_ra_mutex);
+    bf->bf_ra_run = 0;
+    hts_cond_broadcast(&bf->bf_ra_cond);
+    hts_mutex_unlock(&bf->bf_ra_mutex);
+
+    hts_thread_join(&bf->bf_ra_tid);
+    bf->bf_ra_running = 0;
+
+    TRACE(TRACE_DEBUG, "FABuffer", "%s: Readahead stalled %d times, %d ms",
+          bf->bf_url, bf->bf_ra_stalls, (int)(bf->bf_ra_stall_time / 1000));
+  }
+
+  bf->bf_ra_gen++;
+  bf->bf_ra_active = 0;
+  bf->bf_ra_fill = 0;
+  bf->bf_ra_seq = 0;
+  bf->bf_ra_window_min = 0;
+  bf->bf_ra_read_time = 0;
+  bf->bf_ra_consume_rate = 0;
+  bf->bf_ra_stalls = 0;
+  bf->bf_ra_stall_time = 0;
+
+  if(bf->bf_ra_mem != NULL) {
+    hfree(bf->bf_ra_mem, BF_RA_SIZE);
+    bf->bf_ra_mem = NULL;
+  }
+
+  prop_ref_dec(bf->bf_stats);
+  bf->bf_stats = NULL;
+}
+
+
 /**
  *
  */
 static void
 fab_destroy(buffered_file_t *bf)
 {
+  // Handle is going away, no point in waiting for an in-flight read
+  if(bf->bf_ra_running)
+    cancellable_cancel(bf->bf_outbound_cancellable);
+  fab_ra_stop(bf);
+  hts_cond_destroy(&bf->bf_ra_cond);
+  hts_mutex_destroy(&bf->bf_ra_mutex);
+
   bf->bf_src->fh_proto->fap_close(bf->bf_src);
 
   if(bf->bf_mem != NULL)
@@ -275,6 +686,8 @@ fab_park(fa_handle_t *handle)
   cancellable_unbind(bf->bf_inbound_cancellable, bf);
   bf->bf_inbound_cancellable = NULL;
 
+  fab_ra_stop(bf);
+
   buffered_file_t *closeme = NULL;
   fa_handle_t *src = bf->bf_src;
 
@@ -334,7 +747,9 @@ fab_seek(fa_handle_t *handle, int64_t pos, int whence, int lazy)
     break;
 
   case SEEK_END:
+    fab_src_acquire(bf);
     np = src->fh_proto->fap_seek(src, pos, whence, lazy);
+    fab_src_release(bf);
     break;
 
   default:
@@ -347,11 +762,14 @@ fab_seek(fa_handle_t *handle, int64_t pos, int whence, int lazy)
   int mpos;
   int cs = resolve_zone(bf, np, 1, &mpos);
 
-  if(cs == -1) {
+  if(cs == -1 && !fab_ra_has(bf, np)) {
     // If seeked to position is not mapped in our buffers, seek in
     // source to check if it's possible to reach position at all.
 
-    if(src->fh_proto->fap_seek(src, np, SEEK_SET, lazy) != np)
+    fab_src_acquire(bf);
+    int64_t r = src->fh_proto->fap_seek(src, np, SEEK_SET, lazy);
+    fab_src_release(bf);
+    if(r != np)
       return -1;
   }
 
@@ -371,11 +789,24 @@ fab_fsize(fa_handle_t *handle)
     return bf->bf_size;
 
   fa_handle_t *src = bf->bf_src;
+  fab_src_acquire(bf);
   bf->bf_size = src->fh_proto->fap_fsize(src);
+  fab_src_release(bf);
   return bf->bf_size;
 }
 
 
+/**
+ *
+ */
+static time_t
+fab_mtime(fa_handle_t *handle)
+{
+  buffered_file_t *bf = (buffered_file_t *)handle;
+  return bf->bf_src_mtime;
+}
+
+
 /**
  *
  */
@@ -435,6 +866,8 @@ fab_read(fa_handle_t *handle, void *buf, size_t size)
   if(bf->bf_size != -1 && bf->bf_fpos + size > bf->bf_size)
     size = bf->bf_size - bf->bf_fpos;
 
+  fab_ra_publish(bf);
+
   size_t rval = 0;
   while(size > 0) {
     int mpos = -1;
@@ -449,14 +882,46 @@ fab_read(fa_handle_t *handle, void *buf, size_t size)
       continue;
     }
 
+    if(bf->bf_ra_running) {
+      cs = fab_ra_read(bf, buf, size);
+      if(cs > 0) {
+        // Readahead hit, keep it in the cache for short backward seeks
+        store_in_cache(bf, buf, cs);
+        rval += cs;
+        buf += cs;
+        bf->bf_fpos += cs;
+        size -= cs;
+        continue;
+      }
+    }
+
+    cs = fa_blockcache_read(bf->bf_url, bf->bf_src_size, bf->bf_src_mtime,
+                            bf->bf_fpos, buf, size);
+    if(cs > 0) {
+      fab_ra_track(bf, bf->bf_fpos, cs);
+      store_in_cache(bf, buf, cs);
+      rval += cs;
+      buf += cs;
+      bf->bf_fpos += cs;
+      size -= cs;
+      continue;
+    }
+
     int rreq = need_to_fill(bf, bf->bf_fpos, size);
     if(rreq >= bf->bf_min_request) {
 
-      if(src->fh_proto->fap_seek(src, bf->bf_fpos, SEEK_SET, 0) != bf->bf_fpos)
+      fab_src_acquire(bf);
+      if(src->fh_proto->fap_seek(src, bf->bf_fpos, SEEK_SET, 0) != bf->bf_fpos) {
+        fab_src_release(bf);
 	return -1;
+      }
 
       int r = src->fh_proto->fap_read(src, buf, rreq);
+      fab_src_release(bf);
       if(r > 0) {
+        fab_ra_track(bf, bf->bf_fpos, r);
+        fa_blockcache_store(bf->bf_url, bf->bf_src_size, bf->bf_src_mtime,
+                            bf->bf_fpos, buf, r);
 	store_in_cache(bf, buf, r);
 	rval += r;
 	buf += r;
@@ -475,16 +940,24 @@ fab_read(fa_handle_t *handle, void *buf, size_t size)
     
     erase_zone(bf, bf->bf_mem_ptr, bf->bf_min_request);
 
-    if(src->fh_proto->fap_seek(src, bf->bf_fpos, SEEK_SET, 0) != bf->bf_fpos)
+    fab_src_acquire(bf);
+    if(src->fh_proto->fap_seek(src, bf->bf_fpos, SEEK_SET, 0) != bf->bf_fpos) {
+      fab_src_release(bf);
       return -1;
+    }
 
     int r = src->fh_proto->fap_read(src, bf->bf_mem + bf->bf_mem_ptr,
 				    bf->bf_min_request);
+    fab_src_release(bf);
     if(r < 1) {
       bf->bf_size = bf->bf_fpos;
       return r < 0 ? r : rval;
     }
 
+    fab_ra_track(bf, bf->bf_fpos, r);
+    fa_blockcache_store(bf->bf_url, bf->bf_src_size, bf->bf_src_mtime,
+                        bf->bf_fpos, bf->bf_mem + bf->bf_mem_ptr, r);
+
     map_zone(bf, bf->bf_mem_ptr, r, bf->bf_fpos);
 
     if(r != bf->bf_min_request) {
@@ -578,6 +1051,7 @@ static fa_protocol_t fa_protocol_buffered = {
 #endif
   .fap_seek  = fab_seek,
   .fap_fsize = fab_fsize,
+  .fap_mtime = fab_mtime,
   .fap_set_read_timeout = fab_set_read_timeout,
 };
 
@@ -628,12 +1102,14 @@ fa_buffered_open(const char *url, char *errbuf, size_t errsize, int flags,
     fap_release(fap);
     free(filename);
 
+    buffered_file_t *bf = (buffered_file_t *)fh;
     if(foe != NULL && foe->foe_cancellable != NULL) {
-      buffered_file_t *bf = (buffered_file_t *)fh;
       assert(bf->bf_inbound_cancellable == NULL);
       bf->bf_inbound_cancellable =
         cancellable_bind(foe->foe_cancellable, fab_cancel, fh);
     }
+    if(foe != NULL)
+      bf->bf_stats = prop_ref_inc(foe->foe_stats);
     return fh;
   }
 
@@ -647,6 +1123,8 @@ fa_buffered_open(const char *url, char *errbuf, size_t errsize, int flags,
   bf->bf_outbound_cancellable = cancellable_create();
 
   if(foe != NULL) {
+    bf->bf_stats = prop_ref_inc(foe->foe_stats);
+
     if(foe->foe_cancellable != NULL) {
       bf->bf_inbound_cancellable =
         cancellable_bind(foe->foe_cancellable, fab_cancel, bf);
@@ -664,6 +1142,7 @@ fa_buffered_open(const char *url, char *errbuf, size_t errsize, int flags,
   free(filename);
   if(fh == NULL) {
     cancellable_unbind(bf->bf_inbound_cancellable, bf);
+    prop_ref_dec(bf->bf_stats);
     free(bf);
     return NULL;
   }
@@ -673,9 +1152,14 @@ fa_buffered_open(const char *url, char *errbuf, size_t errsize, int flags,
     bf->bf_min_request = mflags & FA_BUFFERED_BIG ? 256 * 1024 : 64 * 1024;
   bf->bf_mem_size = 1024 * 1024;
   bf->bf_flags = flags;
+  bf->bf_ra_enabled = !!(mflags & FA_BUFFERED_BIG) && bf->bf_min_request;
+  hts_mutex_init(&bf->bf_ra_mutex);
+  hts_cond_init(&bf->bf_ra_cond, &bf->bf_ra_mutex);
 
   bf->bf_src = fh;
   bf->bf_size = -1;
+  bf->bf_src_size = fa_fsize(fh);
+  bf->bf_src_mtime = fa_mtime(fh);
   bf->h.fh_proto = &fa_protocol_buffered;
 #if BF_CHK
   bf->bf_chk = fa_open_ex(url, NULL, 0, 0, NULL);
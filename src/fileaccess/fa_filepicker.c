@@ -179,7 +179,7 @@ filepicker_load_dir(filepicker_t *fp, const char *path, const char *title)
   op->path = strdup(path);
   op->model = model; // Transfer refcount
   op->flags = fp->fp_flags;
-  task_run(filepicker_scandir_task, op);
+  task_run_ex(filepicker_scandir_task, op, TASK_PRIO_INTERACTIVE, 0);
 }
 
 
@@ -361,5 +361,5 @@ filepicker_pick_to_prop(const char *title, prop_t *target, const char *current,
   a->target = prop_ref_inc(target);
   a->url = current ? strdup(current) : NULL;
   a->flags = flags;
-  task_run(filepicker_pick_to_prop_task, a);
+  task_run_ex(filepicker_pick_to_prop_task, a, TASK_PRIO_INTERACTIVE, 0);
 }
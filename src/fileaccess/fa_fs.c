@@ -370,6 +370,20 @@ fs_fsize(fa_handle_t *fh0)
 }
 
 
+/**
+ * Return mtime of file (first part for split files)
+ */
+static time_t
+fs_mtime(fa_handle_t *fh0)
+{
+  fs_handle_t *fh = (fs_handle_t *)fh0;
+  struct stat st;
+  if(fstat(fh->parts[0].fd, &st) < 0)
+    return 0;
+  return st.st_mtime;
+}
+
+
 /**
  * Standard unix stat
  */
@@ -871,6 +885,7 @@ fa_protocol_t fa_protocol_fs = {
   .fap_write = fs_write,
   .fap_seek  = fs_seek,
   .fap_fsize = fs_fsize,
+  .fap_mtime = fs_mtime,
   .fap_stat  = fs_stat,
   .fap_unlink= fs_unlink,
   .fap_rmdir = fs_rmdir,
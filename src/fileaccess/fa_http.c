@@ -1365,6 +1365,9 @@ http_read_response(http_file_t *hf, struct http_header_list *headers)
 	hf->hf_filesize = i64;
     }
     
+    if(!strcasecmp(argv[0], "Last-Modified") && (code == 200 || code == 206))
+      http_ctime(&hf->hf_mtime, argv[1]);
+
     if(!strcasecmp(argv[0], "Content-Type")) {
       free(hf->hf_content_type);
       hf->hf_content_type = strdup(argv[1]);
@@ -2194,6 +2197,17 @@ http_fsize(fa_handle_t *handle)
 }
 
 
+/**
+ * Return mtime of file as reported by the server
+ */
+static time_t
+http_mtime(fa_handle_t *handle)
+{
+  http_file_t *hf = (http_file_t *)handle;
+  return hf->hf_mtime;
+}
+
+
 /**
  * Standard unix stat
  */
@@ -2407,6 +2421,7 @@ static fa_protocol_t fa_protocol_http = {
   .fap_read  = http_read,
   .fap_seek  = http_seek,
   .fap_fsize = http_fsize,
+  .fap_mtime = http_mtime,
   .fap_stat  = http_stat,
   .fap_load = http_load,
   .fap_get_last_component = http_get_last_component,
@@ -2428,6 +2443,7 @@ static fa_protocol_t fa_protocol_https = {
   .fap_read  = http_read,
   .fap_seek  = http_seek,
   .fap_fsize = http_fsize,
+  .fap_mtime = http_mtime,
   .fap_stat  = http_stat,
   .fap_load = http_load,
   .fap_get_last_component = http_get_last_component,
@@ -2755,6 +2771,7 @@ static fa_protocol_t fa_protocol_webdav = {
   .fap_read  = http_read,
   .fap_seek  = http_seek,
   .fap_fsize = http_fsize,
+  .fap_mtime = http_mtime,
   .fap_stat  = dav_stat,
   .fap_load = http_load,
   .fap_get_last_component = http_get_last_component,
@@ -2775,6 +2792,7 @@ static fa_protocol_t fa_protocol_webdavs = {
   .fap_read  = http_read,
   .fap_seek  = http_seek,
   .fap_fsize = http_fsize,
+  .fap_mtime = http_mtime,
   .fap_stat  = dav_stat,
   .fap_load = http_load,
   .fap_get_last_component = http_get_last_component,
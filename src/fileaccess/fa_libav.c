@@ -19,12 +19,16 @@
  */
 
 #include <unistd.h>
+#include <string.h>
 
 #include <libavformat/avio.h>
 #include <libavformat/avformat.h>
 
 #include "main.h"
 #include "fa_libav.h"
+#include "blobcache.h"
+#include "htsmsg/htsmsg.h"
+#include "htsmsg/htsmsg_binary.h"
 
 /**
  *
@@ -118,6 +122,234 @@ static const struct {
 };
 
 
+/**
+ * Probe result cache
+ *
+ * avformat_find_stream_info() reads (and decodes) quite a lot of data
+ * to figure out stream parameters that are not in the container
+ * header. Over high latency network filesystems that is slow, so we
+ * store the outcome keyed on URL (validated with size and mtime) and
+ * on reopen just fill in what the header parsing didn't give us.
+ *
+ * Size and mtime are taken from the open handle. Files whose protocol
+ * can't tell the mtime without another request are not cached.
+ */
+#define PROBE_CACHE_STASH          "probeinfo"
+#define PROBE_CACHE_MAXAGE         (86400 * 30)
+#define PROBE_CACHE_MAX_EXTRADATA  (1024 * 1024)
+#define PROBE_CACHE_VERSION        2
+
+
+/**
+ *
+ */
+static htsmsg_t *
+probe_cache_load(const char *url, int64_t size, time_t mtime)
+{
+  time_t stored_mtime = 0;
+  int64_t s64;
+  buf_t *b = blobcache_get(url, PROBE_CACHE_STASH, 0, NULL, NULL,
+                           &stored_mtime);
+  if(b == NULL)
+    return NULL;
+
+  htsmsg_t *m = htsmsg_binary_deserialize(b);
+  buf_release(b);
+
+  if(m == NULL)
+    return NULL;
+
+  if(stored_mtime != mtime ||
+     htsmsg_get_s32_or_default(m, "version", 0) != PROBE_CACHE_VERSION ||
+     htsmsg_get_s64(m, "size", &s64) || s64 != size ||
+     htsmsg_get_str(m, "format") == NULL ||
+     htsmsg_get_list(m, "streams") == NULL) {
+    htsmsg_release(m);
+    blobcache_evict(url, PROBE_CACHE_STASH);
+    return NULL;
+  }
+  return m;
+}
+
+
+/**
+ *
+ */
+static void
+probe_cache_store(AVFormatContext *fctx, const char *url,
+                  int64_t size, time_t mtime)
+{
+  htsmsg_t *m = htsmsg_create_map();
+  htsmsg_t *streams = htsmsg_create_list();
+  void *data;
+  size_t len;
+
+  htsmsg_add_s32(m, "version", PROBE_CACHE_VERSION);
+  htsmsg_add_s64(m, "size", size);
+  htsmsg_add_str(m, "format", fctx->iformat->name);
+  htsmsg_add_s64(m, "duration", fctx->duration);
+  htsmsg_add_s64(m, "starttime", fctx->start_time);
+  htsmsg_add_s64(m, "bitrate", fctx->bit_rate);
+
+  for(int i = 0; i < fctx->nb_streams; i++) {
+    const AVStream *st = fctx->streams[i];
+    const AVCodecContext *c = st->codec;
+    htsmsg_t *sm = htsmsg_create_map();
+
+    htsmsg_add_s32(sm, "type",         c->codec_type);
+    htsmsg_add_s32(sm, "codec",        c->codec_id);
+    htsmsg_add_s32(sm, "profile",      c->profile);
+    htsmsg_add_s32(sm, "level",        c->level);
+    htsmsg_add_s64(sm, "bitrate",      c->bit_rate);
+    htsmsg_add_s32(sm, "width",        c->width);
+    htsmsg_add_s32(sm, "height",       c->height);
+    htsmsg_add_s32(sm, "pixfmt",       c->pix_fmt);
+    htsmsg_add_s32(sm, "bframes",      c->has_b_frames);
+    htsmsg_add_s32(sm, "sar_num",      c->sample_aspect_ratio.num);
+    htsmsg_add_s32(sm, "sar_den",      c->sample_aspect_ratio.den);
+    htsmsg_add_s32(sm, "samplerate",   c->sample_rate);
+    htsmsg_add_s32(sm, "channels",     c->channels);
+    htsmsg_add_s64(sm, "layout",       c->channel_layout);
+    htsmsg_add_s32(sm, "samplefmt",    c->sample_fmt);
+    htsmsg_add_s32(sm, "framesize",    c->frame_size);
+    htsmsg_add_s32(sm, "blockalign",   c->block_align);
+    htsmsg_add_s32(sm, "tb_num",       c->time_base.num);
+    htsmsg_add_s32(sm, "tb_den",       c->time_base.den);
+    htsmsg_add_s32(sm, "tpf",          c->ticks_per_frame);
+    htsmsg_add_s32(sm, "st_sar_num",   st->sample_aspect_ratio.num);
+    htsmsg_add_s32(sm, "st_sar_den",   st->sample_aspect_ratio.den);
+    htsmsg_add_s32(sm, "avgfr_num",    st->avg_frame_rate.num);
+    htsmsg_add_s32(sm, "avgfr_den",    st->avg_frame_rate.den);
+    htsmsg_add_s32(sm, "rfr_num",      st->r_frame_rate.num);
+    htsmsg_add_s32(sm, "rfr_den",      st->r_frame_rate.den);
+    htsmsg_add_s64(sm, "duration",     st->duration);
+    htsmsg_add_s64(sm, "starttime",    st->start_time);
+
+    if(c->codec_type != AVMEDIA_TYPE_ATTACHMENT &&
+       c->extradata_size > 0 &&
+       c->extradata_size <= PROBE_CACHE_MAX_EXTRADATA)
+      htsmsg_add_bin(sm, "extradata", c->extradata, c->extradata_size);
+
+    htsmsg_add_msg(streams, NULL, sm);
+  }
+  htsmsg_add_msg(m, "streams", streams);
+
+  if(!htsmsg_binary_serialize(m, &data, &len, -1)) {
+    // Skip the length header, htsmsg_binary_deserialize() don't want it
+    buf_t *b = buf_create_and_copy(len - 4, data + 4);
+    blobcache_put(url, PROBE_CACHE_STASH, b, PROBE_CACHE_MAXAGE, NULL,
+                  mtime, 0);
+    buf_release(b);
+    free(data);
+  }
+  htsmsg_release(m);
+}
+
+
+/**
+ * Fill in stream parameters from cache. Only fields that header
+ * parsing left unset are touched, same as avformat_find_stream_info()
+ *
+ * Return 0 if ok, -1 if the cached data does not match the file
+ */
+static int
+probe_cache_apply(AVFormatContext *fctx, htsmsg_t *m)
+{
+  htsmsg_t *streams = htsmsg_get_list(m, "streams");
+  htsmsg_field_t *f;
+  int64_t s64;
+  int i = 0;
+
+  if(strcmp(fctx->iformat->name, htsmsg_get_str(m, "format")))
+    return -1;
+
+  HTSMSG_FOREACH(f, streams) {
+    htsmsg_t *sm = htsmsg_get_map_by_field(f);
+    if(sm == NULL || i >= fctx->nb_streams)
+      return -1;
+
+    const AVCodecContext *c = fctx->streams[i]->codec;
+    int type  = htsmsg_get_s32_or_default(sm, "type", AVMEDIA_TYPE_UNKNOWN);
+    int codec = htsmsg_get_s32_or_default(sm, "codec", AV_CODEC_ID_NONE);
+
+    if((c->codec_type != AVMEDIA_TYPE_UNKNOWN && c->codec_type != type) ||
+       (c->codec_id != AV_CODEC_ID_NONE && c->codec_id != codec))
+      return -1;
+    i++;
+  }
+
+  if(i != fctx->nb_streams)
+    return -1;
+
+#define PC_FILL(dst, key, unset) do {                                   \
+    if((dst) == (unset))                                                \
+      (dst) = htsmsg_get_s32_or_default(sm, key, unset);                \
+  } while(0)
+
+#define PC_FILL64(dst, key, unset) do {                                 \
+    if((dst) == (unset) && !htsmsg_get_s64(sm, key, &s64))              \
+      (dst) = s64;                                                      \
+  } while(0)
+
+  i = 0;
+  HTSMSG_FOREACH(f, streams) {
+    htsmsg_t *sm = htsmsg_get_map_by_field(f);
+    AVStream *st = fctx->streams[i++];
+    AVCodecContext *c = st->codec;
+    const void *bin;
+    size_t binlen;
+
+    PC_FILL(c->codec_type,               "type",       AVMEDIA_TYPE_UNKNOWN);
+    PC_FILL(c->codec_id,                 "codec",      AV_CODEC_ID_NONE);
+    PC_FILL(c->profile,                  "profile",    FF_PROFILE_UNKNOWN);
+    PC_FILL(c->level,                    "level",      FF_LEVEL_UNKNOWN);
+    PC_FILL64(c->bit_rate,               "bitrate",    0);
+    PC_FILL(c->width,                    "width",      0);
+    PC_FILL(c->height,                   "height",     0);
+    PC_FILL(c->pix_fmt,                  "pixfmt",     AV_PIX_FMT_NONE);
+    PC_FILL(c->has_b_frames,             "bframes",    0);
+    PC_FILL(c->sample_aspect_ratio.num,  "sar_num",    0);
+    PC_FILL(c->sample_aspect_ratio.den,  "sar_den",    1);
+    PC_FILL(c->sample_rate,              "samplerate", 0);
+    PC_FILL(c->channels,                 "channels",   0);
+    PC_FILL64(c->channel_layout,         "layout",     0);
+    PC_FILL(c->sample_fmt,               "samplefmt",  AV_SAMPLE_FMT_NONE);
+    PC_FILL(c->frame_size,               "framesize",  0);
+    PC_FILL(c->block_align,              "blockalign", 0);
+    PC_FILL(c->time_base.num,            "tb_num",     0);
+    PC_FILL(c->time_base.den,            "tb_den",     1);
+    PC_FILL(c->ticks_per_frame,          "tpf",        1);
+    PC_FILL(st->sample_aspect_ratio.num, "st_sar_num", 0);
+    PC_FILL(st->sample_aspect_ratio.den, "st_sar_den", 1);
+    PC_FILL(st->avg_frame_rate.num,      "avgfr_num",  0);
+    PC_FILL(st->avg_frame_rate.den,      "avgfr_den",  0);
+    PC_FILL(st->r_frame_rate.num,        "rfr_num",    0);
+    PC_FILL(st->r_frame_rate.den,        "rfr_den",    0);
+    PC_FILL64(st->duration,              "duration",   AV_NOPTS_VALUE);
+    PC_FILL64(st->start_time,            "starttime",  AV_NOPTS_VALUE);
+
+    if(c->extradata == NULL &&
+       !htsmsg_get_bin(sm, "extradata", &bin, &binlen)) {
+      c->extradata = av_mallocz(binlen + FF_INPUT_BUFFER_PADDING_SIZE);
+      memcpy(c->extradata, bin, binlen);
+      c->extradata_size = binlen;
+    }
+  }
+
+#undef PC_FILL
+#undef PC_FILL64
+
+  if(fctx->duration == AV_NOPTS_VALUE && !htsmsg_get_s64(m, "duration", &s64))
+    fctx->duration = s64;
+  if(fctx->start_time == AV_NOPTS_VALUE &&
+     !htsmsg_get_s64(m, "starttime", &s64))
+    fctx->start_time = s64;
+  if(fctx->bit_rate == 0 && !htsmsg_get_s64(m, "bitrate", &s64))
+    fctx->bit_rate = s64;
+  return 0;
+}
+
+
 /**
  *
  */
@@ -128,8 +360,20 @@ fa_libav_open_format(AVIOContext *avio, const char *url,
 {
   AVInputFormat *fmt = NULL;
   AVFormatContext *fctx;
+  htsmsg_t *pc = NULL;
+  time_t mtime = 0;
+  int64_t size = -1;
   int err;
 
+  // avio is always from fa_libav_reopen() so opaque is our handle
+  if(strategy != FA_LIBAV_OPEN_STRATEGY_VIDEO_NON_SEEKABLE &&
+     avio->seekable && (size = avio_size(avio)) > 0 &&
+     (mtime = fa_mtime(avio->opaque)) != 0) {
+    pc = probe_cache_load(url, size, mtime);
+  } else {
+    size = -1;
+  }
+
   avio_seek(avio, 0, SEEK_SET);
   if(mimetype != NULL) {
     int i;
@@ -155,6 +399,14 @@ fa_libav_open_format(AVIOContext *avio, const char *url,
     break;
   }
 
+  if(fmt == NULL && pc != NULL) {
+    fmt = av_find_input_format(htsmsg_get_str(pc, "format"));
+    if(fmt == NULL) {
+      htsmsg_release(pc);
+      pc = NULL;
+    }
+  }
+
   if(fmt == NULL) {
     if((err = av_probe_input_buffer(avio, &fmt, url, NULL, 0, probe_size)) != 0)
       return fa_libav_open_error(errbuf, errlen,
@@ -179,6 +431,10 @@ fa_libav_open_format(AVIOContext *avio, const char *url,
   fctx->pb = avio;
 
   if((err = avformat_open_input(&fctx, url, fmt, NULL)) != 0) {
+    if(pc != NULL) {
+      htsmsg_release(pc);
+      blobcache_evict(url, PROBE_CACHE_STASH);
+    }
     if(mimetype != NULL) {
       TRACE(TRACE_DEBUG, "libav",
             "Unable to open using mimetype %s, retrying with probe",
@@ -201,6 +457,17 @@ fa_libav_open_format(AVIOContext *avio, const char *url,
     break;
   }
 
+  if(pc != NULL) {
+    int r = probe_cache_apply(fctx, pc);
+    htsmsg_release(pc);
+    if(!r) {
+      TRACE(TRACE_DEBUG, "probe", "%s: Using cached stream info", url);
+      return fctx;
+    }
+    TRACE(TRACE_DEBUG, "probe", "%s: Cached stream info does not match", url);
+    blobcache_evict(url, PROBE_CACHE_STASH);
+  }
+
   if(avformat_find_stream_info(fctx, NULL) < 0) {
     avformat_close_input(&fctx);
     if(mimetype != NULL) {
@@ -214,6 +481,9 @@ fa_libav_open_format(AVIOContext *avio, const char *url,
 			       "Unable to handle file contents", err);
   }
 
+  if(size > 0 && !(fctx->ctx_flags & AVFMTCTX_NOHEADER))
+    probe_cache_store(fctx, url, size, mtime);
+
   return fctx;
 }
 
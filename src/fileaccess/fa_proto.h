@@ -76,6 +76,19 @@ typedef struct fa_protocol {
    */
   int (*fap_read)(fa_handle_t *fh, void *buf, size_t size);
 
+  /**
+   * Read into a refcounted buffer.
+   *
+   * Lets a protocol hand out memory it already holds (or decrypted in
+   * place, etc) and stacked protocols pass it along without copying.
+   * On success *bp is set and caller owns the reference. Returns number
+   * of bytes (never more than 'size'), 0 at EOF or -1 on error.
+   * FAP_NOT_SUPPORTED makes fa_read_buf() fall back to fap_read()
+   *
+   * Optional
+   */
+  int (*fap_read_buf)(fa_handle_t *fh, buf_t **bp, size_t size);
+
   /**
    * Read from file. Same semantics as POSIX write(2)
    */
@@ -91,6 +104,12 @@ typedef struct fa_protocol {
    */
   int64_t (*fap_fsize)(fa_handle_t *fh);
 
+  /**
+   * Return modification time of file, 0 if not known. Should not cause
+   * any I/O, protocols fill this in when the file is opened
+   */
+  time_t (*fap_mtime)(fa_handle_t *fh);
+
   /**
    * Truncate file
    */
@@ -117,6 +117,32 @@ slice_read(fa_handle_t *handle, void *buf, size_t size)
 }
 
 
+/**
+ *
+ */
+static int
+slice_read_buf(fa_handle_t *handle, buf_t **bp, size_t size)
+{
+  slice_t *s = (slice_t *)handle;
+
+  if(s->s_fpos + size > s->s_size)
+    size = s->s_size - s->s_fpos;
+
+  if(size <= 0)
+    return 0;
+
+  int64_t p = s->s_fpos + s->s_offset;
+  if(fa_seek(s->s_src, p, SEEK_SET) != p)
+    return -1;
+
+  int r = fa_read_buf(s->s_src, bp, size);
+
+  if(r > 0)
+    s->s_fpos += r;
+  return r;
+}
+
+
 /**
  *
  */
@@ -124,6 +150,7 @@ static fa_protocol_t fa_protocol_slice = {
   .fap_name  = "slice",
   .fap_close = slice_close,
   .fap_read  = slice_read,
+  .fap_read_buf = slice_read_buf,
   .fap_seek  = slice_seek,
   .fap_fsize = slice_fsize,
 };
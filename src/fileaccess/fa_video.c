@@ -40,6 +40,7 @@
 #include "i18n.h"
 #include "metadata/playinfo.h"
 #include "usage.h"
+#include "blobcache.h"
 
 #if ENABLE_METADATA
 #include "fa_probe.h"
@@ -100,12 +101,15 @@ rescale(AVFormatContext *fctx, int64_t ts, int si)
 
 #define MB_SPECIAL_EOF ((void *)-1)
 
+struct kfidx;
+static int kfidx_seek(struct kfidx *ki, AVFormatContext *fctx, int64_t pos);
+
 /**
  *
  */
 static void
 video_seek(AVFormatContext *fctx, media_pipe_t *mp, media_buf_t **mbp,
-	   int64_t pos, const char *txt)
+	   int64_t pos, const char *txt, struct kfidx *ki)
 {
   pos = FFMAX(0, FFMIN(fctx->duration, pos)) + fctx->start_time;
 
@@ -113,7 +117,9 @@ video_seek(AVFormatContext *fctx, media_pipe_t *mp, media_buf_t **mbp,
 	(pos - fctx->start_time) / 1000000.0,
 	pos, fctx->start_time);
 
-  if(av_seek_frame(fctx, -1, pos, AVSEEK_FLAG_BACKWARD)) {
+  if(kfidx_seek(ki, fctx, pos)) {
+    // Byte seek to a stored keyframe position
+  } else if(av_seek_frame(fctx, -1, pos, AVSEEK_FLAG_BACKWARD)) {
     TRACE(TRACE_ERROR, "Video", "Seek failed");
   }
 
@@ -154,6 +160,340 @@ update_seek_index(seek_index_t *si, int sec)
 
 
 
+/**
+ * Keyframe index (timestamp -> byte offset) for the video stream.
+ *
+ * It's collected while playing and stored in the blobcache keyed on
+ * the URL (and validated against file size and mtime). On next open
+ * the entries are fed into the demuxer's stream index so av_seek_frame()
+ * can go straight to the right position instead of scanning for it.
+ * This matters a lot for AVI/MKV files lacking an index over SMB/HTTP.
+ *
+ * Demuxers that come with an index of their own (MP4 sample tables,
+ * MKV cues, ...) must not be seeded. av_add_index_entry() replaces
+ * entries with the same timestamp, and for those formats the entries
+ * are not just seek hints. For them the stored positions are only used
+ * for a byte seek when the demuxer's own index doesn't get as close.
+ */
+#define KFIDX_STASH       "seekindex"
+#define KFIDX_MAGIC       0x4b464931    // 'KFI1'
+#define KFIDX_MIN_DELTA   1000000       // Max one entry per second
+#define KFIDX_MAX_ENTRIES 32768
+#define KFIDX_MAXAGE      (86400 * 90)
+
+typedef struct kfidx_entry {
+  int64_t ts;   // In stream time base
+  int64_t pos;
+} kfidx_entry_t;
+
+typedef struct kfidx_header {
+  uint32_t magic;
+  uint32_t entries;
+  int64_t filesize;
+  int32_t stream;
+  int32_t tb_num;
+  int32_t tb_den;
+  int32_t pad;
+} kfidx_header_t;
+
+typedef struct kfidx {
+  char *ki_url;
+  time_t ki_mtime;
+  int64_t ki_filesize;
+  int ki_stream;
+  AVRational ki_tb;
+  int64_t ki_min_delta;
+  int ki_num;
+  int ki_capacity;
+  int ki_added;
+  int ki_seeded;  // Entries were added to the demuxer's index
+  kfidx_entry_t *ki_entries;
+} kfidx_t;
+
+
+/**
+ * Return index of first entry with ts >= 'ts'
+ */
+static int
+kfidx_search(const kfidx_t *ki, int64_t ts)
+{
+  int lo = 0, hi = ki->ki_num;
+
+  while(lo < hi) {
+    int mid = (lo + hi) / 2;
+    if(ki->ki_entries[mid].ts < ts)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+
+/**
+ *
+ */
+static void
+kfidx_add(kfidx_t *ki, int64_t ts, int64_t pos)
+{
+  if(ki == NULL || ts == AV_NOPTS_VALUE || pos < 0)
+    return;
+
+  int i = kfidx_search(ki, ts);
+
+  if(i > 0 && ts - ki->ki_entries[i - 1].ts < ki->ki_min_delta)
+    return;
+  if(i < ki->ki_num && ki->ki_entries[i].ts - ts < ki->ki_min_delta)
+    return;
+
+  if(ki->ki_num == ki->ki_capacity) {
+    if(ki->ki_capacity == KFIDX_MAX_ENTRIES)
+      return;
+    ki->ki_capacity = FFMIN(KFIDX_MAX_ENTRIES, (ki->ki_capacity * 2) ?: 256);
+    ki->ki_entries = realloc(ki->ki_entries,
+                             ki->ki_capacity * sizeof(kfidx_entry_t));
+  }
+
+  memmove(ki->ki_entries + i + 1, ki->ki_entries + i,
+          (ki->ki_num - i) * sizeof(kfidx_entry_t));
+  ki->ki_entries[i].ts = ts;
+  ki->ki_entries[i].pos = pos;
+  ki->ki_num++;
+  ki->ki_added++;
+}
+
+
+/**
+ * Load stored index (if any) and seed the demuxer with it
+ */
+static kfidx_t *
+kfidx_create(AVFormatContext *fctx, const char *url, int64_t filesize,
+             time_t filemtime, int stream)
+{
+  time_t mtime = 0;
+
+  if(filesize <= 0 || stream < 0 || fctx->duration == AV_NOPTS_VALUE)
+    return NULL;
+
+  AVStream *st = fctx->streams[stream];
+  kfidx_t *ki = calloc(1, sizeof(kfidx_t));
+  ki->ki_url = strdup(url);
+  ki->ki_filesize = filesize;
+  ki->ki_stream = stream;
+  ki->ki_tb = st->time_base;
+  ki->ki_min_delta = av_rescale_q(KFIDX_MIN_DELTA, AV_TIME_BASE_Q,
+                                  st->time_base);
+
+  ki->ki_mtime = filemtime;
+
+  buf_t *b = blobcache_get(url, KFIDX_STASH, 0, NULL, NULL, &mtime);
+  if(b == NULL)
+    return ki;
+
+  const kfidx_header_t *h = buf_data(b);
+  const kfidx_entry_t *e = (const void *)(h + 1);
+
+  if(buf_size(b) < sizeof(kfidx_header_t) ||
+     h->magic != KFIDX_MAGIC ||
+     h->entries > KFIDX_MAX_ENTRIES ||
+     buf_size(b) != sizeof(kfidx_header_t) +
+     h->entries * sizeof(kfidx_entry_t) ||
+     h->filesize != filesize ||
+     h->stream != stream ||
+     h->tb_num != st->time_base.num ||
+     h->tb_den != st->time_base.den ||
+     mtime != ki->ki_mtime) {
+    TRACE(TRACE_DEBUG, "Video", "Stored seek index for %s is stale", url);
+    buf_release(b);
+    blobcache_evict(url, KFIDX_STASH);
+    return ki;
+  }
+
+  ki->ki_num = ki->ki_capacity = h->entries;
+  ki->ki_entries = malloc(ki->ki_num * sizeof(kfidx_entry_t));
+  memcpy(ki->ki_entries, e, ki->ki_num * sizeof(kfidx_entry_t));
+  buf_release(b);
+
+  ki->ki_seeded = fctx->iformat->flags & AVFMT_GENERIC_INDEX ||
+    st->nb_index_entries == 0;
+
+  if(ki->ki_seeded) {
+    for(int i = 0; i < ki->ki_num; i++) {
+      const int64_t ts = ki->ki_entries[i].ts;
+      int idx = av_index_search_timestamp(st, ts,
+                                          AVSEEK_FLAG_BACKWARD |
+                                          AVSEEK_FLAG_ANY);
+      if(idx >= 0 && st->index_entries[idx].timestamp == ts)
+        continue; // Never replace what the demuxer found itself
+
+      av_add_index_entry(st, ki->ki_entries[i].pos, ts,
+                         0, 0, AVINDEX_KEYFRAME);
+    }
+  }
+
+  TRACE(TRACE_DEBUG, "Video", "Loaded %d seek index entries for %s (%s)",
+        ki->ki_num, url, ki->ki_seeded ? "seeded" : "byte seek only");
+  return ki;
+}
+
+
+/**
+ * Byte seek to the closest stored keyframe at or before 'pos' (in
+ * AV_TIME_BASE) if the demuxer wasn't seeded and its own index can't
+ * get as close. Return 1 if we seeked
+ */
+static int
+kfidx_seek(kfidx_t *ki, AVFormatContext *fctx, int64_t pos)
+{
+  if(ki == NULL || ki->ki_seeded || ki->ki_num == 0 ||
+     fctx->iformat->flags & AVFMT_NO_BYTE_SEEK)
+    return 0;
+
+  AVStream *st = fctx->streams[ki->ki_stream];
+  const int64_t ts = av_rescale_q(pos, AV_TIME_BASE_Q, st->time_base);
+
+  int i = kfidx_search(ki, ts + 1) - 1;
+  if(i < 0)
+    return 0;
+
+  const kfidx_entry_t *e = &ki->ki_entries[i];
+  int idx = av_index_search_timestamp(st, ts, AVSEEK_FLAG_BACKWARD);
+  if(idx >= 0 && st->index_entries[idx].timestamp >= e->ts)
+    return 0;
+
+  if(av_seek_frame(fctx, -1, e->pos, AVSEEK_FLAG_BYTE) < 0)
+    return 0;
+
+  TRACE(TRACE_DEBUG, "Video", "Byte seek to stored keyframe at %"PRId64,
+        e->pos);
+  return 1;
+}
+
+
+/**
+ * Store index if we learned anything new
+ */
+static void
+kfidx_destroy(kfidx_t *ki)
+{
+  if(ki == NULL)
+    return;
+
+  if(ki->ki_added) {
+    size_t size = sizeof(kfidx_header_t) + ki->ki_num * sizeof(kfidx_entry_t);
+    buf_t *b = buf_create(size);
+    kfidx_header_t *h = (void *)b->b_ptr;
+
+    memset(h, 0, sizeof(kfidx_header_t));
+    h->magic    = KFIDX_MAGIC;
+    h->entries  = ki->ki_num;
+    h->filesize = ki->ki_filesize;
+    h->stream   = ki->ki_stream;
+    h->tb_num   = ki->ki_tb.num;
+    h->tb_den   = ki->ki_tb.den;
+    memcpy(h + 1, ki->ki_entries, ki->ki_num * sizeof(kfidx_entry_t));
+
+    blobcache_put(ki->ki_url, KFIDX_STASH, b, KFIDX_MAXAGE, NULL,
+                  ki->ki_mtime, 0);
+    buf_release(b);
+    TRACE(TRACE_DEBUG, "Video", "Stored %d seek index entries for %s",
+          ki->ki_num, ki->ki_url);
+  }
+
+  free(ki->ki_entries);
+  free(ki->ki_url);
+  free(ki);
+}
+
+
+/**
+ * Trickplay (fast forward / rewind)
+ *
+ * Instead of demuxing everything we seek (using the demuxer's index,
+ * which kfidx above helps populating) and only send the keyframe
+ * found at each position. Audio is not sent at all. Each keyframe is
+ * flushed through the decoder so it's displayed right away and the
+ * clock follows what's on screen.
+ *
+ * At low speeds the position often stays within the same GOP for a
+ * while. A backward seek would then keep landing on the keyframe that
+ * is already on screen, so going forward we step to the one after it
+ * instead and hold off further seeks until the position has passed it
+ */
+#define TRICKPLAY_INTERVAL    250000  // Time between output frames (µs)
+#define TRICKPLAY_MAX_PACKETS 1000    // Give up finding a keyframe after this
+
+/**
+ * Returns -1 on error. Otherwise *mbp is the keyframe to show, or NULL
+ * if there's nothing new to show yet. *shown is the position of the
+ * keyframe on screen (PTS_UNSET if none) and is updated accordingly
+ */
+static int
+video_trickplay_read(AVFormatContext *fctx, media_pipe_t *mp,
+                     media_codec_t **cwvec, int cwvec_size, int64_t pos,
+                     int64_t offset, int forward, int64_t *shown,
+                     media_buf_t **mbp)
+{
+  const int vs = mp->mp_video.mq_stream;
+  AVPacket pkt;
+  int i;
+
+  *mbp = NULL;
+
+  if(av_seek_frame(fctx, -1, pos + fctx->start_time, AVSEEK_FLAG_BACKWARD))
+    return -1;
+
+  for(i = 0; i < TRICKPLAY_MAX_PACKETS; i++) {
+    if(av_read_frame(fctx, &pkt))
+      return -1;
+
+    if(pkt.stream_index != vs || vs >= cwvec_size ||
+       !(pkt.flags & AV_PKT_FLAG_KEY)) {
+      av_free_packet(&pkt);
+      continue;
+    }
+
+    int64_t kpos = rescale(fctx, pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts,
+                           vs);
+    if(kpos != AV_NOPTS_VALUE)
+      kpos -= offset;
+
+    if(forward && *shown != PTS_UNSET && kpos != AV_NOPTS_VALUE &&
+       kpos <= *shown) {
+      // Already seen, continue to the next keyframe
+      av_free_packet(&pkt);
+      continue;
+    }
+
+    if(!forward && *shown != PTS_UNSET && kpos != AV_NOPTS_VALUE &&
+       kpos >= *shown) {
+      // Still within the GOP on screen
+      av_free_packet(&pkt);
+      return 0;
+    }
+
+    media_buf_t *mb = media_buf_from_avpkt_unlocked(mp, &pkt);
+    mb->mb_data_type = MB_VIDEO;
+    mb->mb_pts = rescale(fctx, pkt.pts, vs);
+    mb->mb_dts = rescale(fctx, pkt.dts, vs);
+    mb->mb_duration = TRICKPLAY_INTERVAL;
+    mb->mb_cw = cwvec[vs] ? media_codec_ref(cwvec[vs]) : NULL;
+    mb->mb_stream = vs;
+    mb->mb_keyframe = 1;
+    mb->mb_flush = 1;
+    mb->mb_drive_clock = 2;
+    mb->mb_user_time = offset;
+    av_free_packet(&pkt);
+    *shown = kpos != AV_NOPTS_VALUE ? kpos : PTS_UNSET;
+    *mbp = mb;
+    return 0;
+  }
+
+  // Very long GOP, try again once the position has moved further
+  return 0;
+}
+
+
 /**
  * Thread for reading from lavf and sending to lavc
  */
@@ -170,7 +510,8 @@ video_player_loop(AVFormatContext *fctx, media_codec_t **cwvec,
                   int resume_mode,
                   const char *title,
                   htsmsg_t *vpi,
-                  prop_t *origin)
+                  prop_t *origin,
+                  kfidx_t *kfi)
 {
   media_buf_t *mb = NULL;
   media_queue_t *mq = NULL;
@@ -184,6 +525,11 @@ video_player_loop(AVFormatContext *fctx, media_codec_t **cwvec,
   int restartpos_last = -1;
   int64_t last_timestamp_presented = AV_NOPTS_VALUE;
 
+  int trickplay = 0;
+  int64_t trick_pos = 0;
+  int64_t trick_last = 0;
+  int64_t trick_shown = PTS_UNSET; // Position of keyframe on screen
+
   mp->mp_seek_base = 0;
   mp->mp_video.mq_seektarget = AV_NOPTS_VALUE;
   mp->mp_audio.mq_seektarget = AV_NOPTS_VALUE;
@@ -194,7 +540,7 @@ video_player_loop(AVFormatContext *fctx, media_codec_t **cwvec,
       TRACE(TRACE_DEBUG, "VIDEO", "Attempting to resume from %.2f seconds",
             start / 1000000.0f);
       mp->mp_seek_base = start;
-      video_seek(fctx, mp, &mb, start, "restart position");
+      video_seek(fctx, mp, &mb, start, "restart position", kfi);
     }
   }
 
@@ -209,6 +555,42 @@ video_player_loop(AVFormatContext *fctx, media_codec_t **cwvec,
   const int64_t offset = fctx->start_time != PTS_UNSET ? fctx->start_time : 0;
 
   while(1) {
+
+    if(mb == NULL && trickplay) {
+      const int64_t now = arch_get_ts();
+      const int64_t next = trick_last + TRICKPLAY_INTERVAL;
+
+      if(now < next) {
+        if((e = mp_dequeue_event_deadline(mp, (next - now + 999) / 1000))
+           == NULL)
+          continue;
+        goto handle_event;
+      }
+
+      // Advance by wall clock so speed is kept even if reads are slow
+      trick_pos += trickplay * (now - trick_last);
+      trick_last = now;
+
+      if(trick_pos <= 0 || trick_pos >= fctx->duration) {
+        trick_pos = FFMAX(0, FFMIN(fctx->duration, trick_pos));
+        mp_set_trickplay(mp, 0);
+      }
+
+      // Don't bother seeking until we've moved past what's on screen
+      if(trick_shown != PTS_UNSET &&
+         (trickplay > 0 ? trick_pos <= trick_shown : trick_pos >= trick_shown))
+        continue;
+
+      if(video_trickplay_read(fctx, mp, cwvec, cwvec_size, trick_pos,
+                              offset, trickplay > 0, &trick_shown, &mb)) {
+        mp_set_trickplay(mp, 0);
+        continue;
+      }
+      if(mb == NULL)
+        continue;
+      mq = &mp->mp_video;
+    }
+
     /**
      * Need to fetch a new packet ?
      */
@@ -253,6 +635,10 @@ video_player_loop(AVFormatContext *fctx, media_codec_t **cwvec,
 
         mp->mp_framerate = fctx->streams[si]->avg_frame_rate;
 
+        if(pkt.flags & AV_PKT_FLAG_KEY)
+          kfidx_add(kfi, pkt.dts != AV_NOPTS_VALUE ? pkt.dts : pkt.pts,
+                    pkt.pos);
+
       } else if(fctx->streams[si]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
 
 	mb = media_buf_from_avpkt_unlocked(mp, &pkt);
@@ -331,6 +717,7 @@ video_player_loop(AVFormatContext *fctx, media_codec_t **cwvec,
       continue;
     }
 
+  handle_event:
     if(event_is_type(e, EVENT_CURRENT_TIME)) {
 
       ets = (event_ts_t *)e;
@@ -356,7 +743,34 @@ video_player_loop(AVFormatContext *fctx, media_codec_t **cwvec,
     } else if(event_is_type(e, EVENT_SEEK)) {
 
       ets = (event_ts_t *)e;
-      video_seek(fctx, mp, &mb, ets->ts, "direct");
+      if(trickplay) {
+        // Just continue trickplay from the new position
+        trick_pos = ets->ts;
+        trick_last = arch_get_ts() - TRICKPLAY_INTERVAL;
+        trick_shown = PTS_UNSET;
+      } else {
+        video_seek(fctx, mp, &mb, ets->ts, "direct", kfi);
+      }
+
+    } else if(event_is_type(e, EVENT_TRICKPLAY)) {
+
+      int speed = ((event_int_t *)e)->val;
+
+      if(speed && !trickplay) {
+        TRACE(TRACE_DEBUG, "Video", "Trickplay at %dx", speed);
+        trick_pos = mp->mp_seek_base;
+        trick_last = arch_get_ts() - TRICKPLAY_INTERVAL;
+        mp_flush(mp);
+        if(mb != NULL && mb != MB_SPECIAL_EOF)
+          media_buf_free_unlocked(mp, mb);
+        mb = NULL;
+      } else if(!speed && trickplay) {
+        TRACE(TRACE_DEBUG, "Video", "Trickplay ended");
+        video_seek(fctx, mp, &mb, mp->mp_seek_base, "trickplay end",
+                   kfi);
+      }
+      trickplay = speed;
+      trick_shown = PTS_UNSET;
 
     } else if(event_is_action(e, ACTION_SKIP_FORWARD) ||
               event_is_action(e, ACTION_SKIP_BACKWARD) ||
@@ -579,6 +993,8 @@ be_file_playvideo(const char *url, media_pipe_t *mp,
   if(fh == NULL)
     return NULL;
 
+  time_t mtime = fa_mtime(fh);
+
   if(va.flags & BACKEND_VIDEO_SET_TITLE) {
     char tmp[1024];
 
@@ -871,29 +1287,43 @@ be_file_playvideo_fh(const char *url, media_pipe_t *mp,
 
   int flags = MP_CAN_PAUSE;
 
-  if(fctx->duration != PTS_UNSET)
+  if(fctx->duration != PTS_UNSET) {
     flags |= MP_CAN_SEEK;
+    if(mp->mp_video.mq_stream != -1)
+      flags |= MP_CAN_TRICKPLAY;
+  }
 
   // Start it
   mp_configure(mp, flags, MP_BUFFER_DEEP, fctx->duration, "video");
 
   seek_index_t *si = build_index(mp, fctx, url);
   seek_index_t *ci = build_chapters(mp, fctx, url);
+  kfidx_t *kfi = flags & MP_CAN_SEEK ?
+    kfidx_create(fctx, url, va.filesize, mtime, mp->mp_video.mq_stream) :
+    NULL;
 
   playinfo_register_play(va.canonical_url, 0);
   prop_set(mp->mp_prop_root, "loading", PROP_SET_INT, 0);
 
+  // We are the only thread enqueueing data on these queues
+  mq_ring_enable(mp, &mp->mp_video, MQ_RING_DEFAULT_SIZE);
+  mq_ring_enable(mp, &mp->mp_audio, MQ_RING_DEFAULT_SIZE);
+
   event_t *e;
   e = video_player_loop(fctx, cwvec, mp, va.flags, errbuf, errlen,
 			va.canonical_url, freetype_context, si, ci,
 			cwvec_size, fh, va.resume_mode, va.title, vpi,
-                        va.origin);
+                        va.origin, kfi);
+
+  mq_ring_enable(mp, &mp->mp_video, 0);
+  mq_ring_enable(mp, &mp->mp_audio, 0);
 
   video_playback_info_invoke(VPI_STOP, vpi, mp->mp_prop_root, va.origin);
   htsmsg_release(vpi);
 
   seek_index_destroy(si);
   seek_index_destroy(ci);
+  kfidx_destroy(kfi);
 
   TRACE(TRACE_DEBUG, "Video", "Stopped playback of %s", url);
 
@@ -641,6 +641,43 @@ zip_file_read(fa_handle_t *handle, void *buf, size_t size)
 }
 
 
+/**
+ * Pass through buffers from the archive, inflate reads straight from them
+ */
+static int
+zip_file_read_buf(fa_handle_t *handle, buf_t **bp, size_t size)
+{
+  zip_fh_t *zfh = (zip_fh_t *)handle;
+  zip_file_t *zf = zfh->zfh_file;
+  int64_t wpos;
+  int r;
+
+  if(zfh->zfh_pos < 0 || zfh->zfh_pos > zf->zf_compressed_size)
+    return 0;
+
+  if(zfh->zfh_pos + size > zf->zf_compressed_size)
+    size = zf->zf_compressed_size - zfh->zfh_pos;
+
+  if(size == 0)
+    return 0;
+
+  wpos = zfh->zfh_pos + zfh->zfh_file_start; // Real position in archive
+
+  if(wpos != zfh->zfh_archive_pos) {
+    if(fa_seek(zfh->zfh_archive_handle, wpos, SEEK_SET) != wpos) {
+      zfh->zfh_archive_pos = -1;
+      return -1;
+    }
+  }
+
+  r = fa_read_buf(zfh->zfh_archive_handle, bp, size);
+
+  if(r > 0)
+    zfh->zfh_pos += r;
+  return r;
+}
+
+
 /**
  *
  */
@@ -706,6 +743,7 @@ zip_file_fsize(fa_handle_t *handle)
 static fa_protocol_t zip_file_protocol = {
   .fap_name = "zipfile",
   .fap_read  = zip_file_read,
+  .fap_read_buf = zip_file_read_buf,
   .fap_seek  = zip_file_seek,
   .fap_close = zip_file_close,
   .fap_fsize = zip_file_fsize,
@@ -44,6 +44,7 @@ typedef struct fa_inflator {
   uint8_t *fi_buf;
 
   uint8_t *fi_load_buf;
+  buf_t *fi_load_borrowed;  // Input lent to us by source (fap_read_buf)
 
   int fi_load_size;
 
@@ -87,6 +88,7 @@ inflate_close(fa_handle_t *handle)
   inflateEnd(&fi->fi_zstream);
   free(fi->fi_buf);
   free(fi->fi_load_buf);
+  buf_release(fi->fi_load_borrowed);
   free(fi);
 }
 
@@ -147,14 +149,27 @@ inflate_read(fa_handle_t *handle, void *buf, size_t size)
 	if(fi->fi_load_size < 128 * 1024)
 	  fi->fi_load_size *= 2;
 
-	fi->fi_load_buf = realloc(fi->fi_load_buf, fi->fi_load_size);
+	buf_release(fi->fi_load_borrowed);
+	fi->fi_load_borrowed = NULL;
 
-	r = fi->fi_src_fap->fap_read(fi->fi_src_handle, 
-				     fi->fi_load_buf, fi->fi_load_size);
+	r = FAP_NOT_SUPPORTED;
+	if(fi->fi_src_fap->fap_read_buf != NULL)
+	  r = fi->fi_src_fap->fap_read_buf(fi->fi_src_handle,
+					   &fi->fi_load_borrowed,
+					   fi->fi_load_size);
+
+	if(r == FAP_NOT_SUPPORTED) {
+	  fi->fi_load_buf = realloc(fi->fi_load_buf, fi->fi_load_size);
+
+	  r = fi->fi_src_fap->fap_read(fi->fi_src_handle,
+				       fi->fi_load_buf, fi->fi_load_size);
+	  fi->fi_zstream.next_in = fi->fi_load_buf;
+	} else if(r > 0) {
+	  fi->fi_zstream.next_in = (void *)buf_data(fi->fi_load_borrowed);
+	}
 	if(r < 0)
 	  r = 0;
 	fi->fi_zstream.avail_in = r;
-	fi->fi_zstream.next_in  = fi->fi_load_buf;
       }
 
       r = inflate(&fi->fi_zstream, 0);
@@ -42,6 +42,7 @@
 
 #include "fa_proto.h"
 #include "fa_probe.h"
+#include "fa_blockcache.h"
 #include "fa_imageloader.h"
 #include "blobcache.h"
 #include "htsmsg/htsbuf.h"
@@ -237,6 +238,8 @@ fa_open_ex(const char *url, char *errbuf, size_t errsize, int flags,
 
     if(flags & (FA_BUFFERED_SMALL | FA_BUFFERED_BIG))
       return fa_buffered_open(url, errbuf, errsize, flags, foe);
+  } else {
+    fa_blockcache_invalidate(url);
   }
 
   if((filename = fa_resolve_proto(url, &fap, errbuf, errsize)) == NULL)
@@ -332,6 +335,39 @@ fa_read(void *fh_, void *buf, size_t size)
   return r;
 }
 
+/**
+ * Always works, protocols without fap_read_buf are read into a new buffer
+ */
+int
+fa_read_buf(void *fh_, buf_t **bp, size_t size)
+{
+  fa_handle_t *fh = fh_;
+  int r;
+
+  if(size == 0)
+    return 0;
+
+  if(fh->fh_proto->fap_read_buf != NULL) {
+    r = fh->fh_proto->fap_read_buf(fh, bp, size);
+    if(r != FAP_NOT_SUPPORTED)
+      return r;
+  }
+
+  buf_t *b = buf_create(size);
+  if(b == NULL)
+    return -1;
+
+  r = fa_read(fh, b->b_ptr, size);
+  if(r <= 0) {
+    buf_release(b);
+    return r;
+  }
+  b->b_size = r;
+  *bp = b;
+  return r;
+}
+
+
 /**
  *
  */
@@ -384,6 +420,19 @@ fa_fsize(void *fh_)
 }
 
 
+/**
+ *
+ */
+time_t
+fa_mtime(void *fh_)
+{
+  fa_handle_t *fh = fh_;
+  if(fh->fh_proto->fap_mtime == NULL)
+    return 0;
+  return fh->fh_proto->fap_mtime(fh);
+}
+
+
 /**
  *
  */
@@ -1231,6 +1280,8 @@ fa_unlink(const char *url, char *errbuf, size_t errsize)
   if((filename = fa_resolve_proto(url, &fap, errbuf, errsize)) == NULL)
     return -1;
 
+  fa_blockcache_invalidate(url);
+
   if(fap->fap_unlink == NULL) {
     snprintf(errbuf, errsize, "No unlink support in filesystem");
     r = -1;
@@ -1294,6 +1345,9 @@ fa_rename(const char *old, const char *new, char *errbuf, size_t errsize)
 
   r = -1;
 
+  fa_blockcache_invalidate(old);
+  fa_blockcache_invalidate(new);
+
   if(old_fap != new_fap) {
     snprintf(errbuf, errsize, "Cross filesystem renames not supported");
   } else {
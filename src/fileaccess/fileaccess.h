@@ -201,6 +201,7 @@ void *fa_open_resolver(const char *url, char *errbuf, size_t errsize,
 void fa_close(void *fh);
 void fa_close_with_park(fa_handle_t *fh, int park);
 int fa_read(void *fh, void *buf, size_t size);
+int fa_read_buf(void *fh, buf_t **bp, size_t size);
 void fa_deadline(void *fh_, int deadline);
 int fa_write(void *fh, const void *buf, size_t size);
 
@@ -211,6 +212,8 @@ int64_t fa_seek4(void *fh, int64_t pos, int whence, int lazy);
 #define fa_seek_lazy(fh, pos, whence) fa_seek4(fh, pos, whence, 1)
 
 int64_t fa_fsize(void *fh);
+
+time_t fa_mtime(void *fh);
 int fa_ftruncate(void *fh, uint64_t newsize);
 
 int fa_stat_ex(const char *url, struct fa_stat *buf, char *errbuf,
@@ -385,5 +388,9 @@ fa_handle_t *fa_bwlimit_open(fa_handle_t *fa, int bps);
 
 fa_handle_t *fa_cmp_open(fa_handle_t *fa, const char *locafile);
 
+// SMB sequential read benchmark, with and without pipelining
+
+void smb_read_benchmark(const char *url);
+
 #endif /* FILEACCESS_H */
 
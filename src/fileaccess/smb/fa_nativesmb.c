@@ -83,6 +83,10 @@ typedef struct nbt_req {
   int nr_last;
   int nr_is_trans2;
   int nr_data_count;
+  int64_t nr_send_time;
+  int64_t nr_recv_time;
+  char nr_pipelined;  // Counted in cc_pl_inflight until the reply arrives
+  char nr_orphan;     // Owner is gone, dispatcher frees it on reply
 } nbt_req_t;
 
 
@@ -124,6 +128,8 @@ typedef struct cifs_connection {
   uint16_t cc_max_buffer_size;
   uint16_t cc_max_mpx_count;
 
+  int cc_pl_inflight;  // Pipelined reads on the wire, for all handles
+
   uint32_t cc_session_key;
 
   uint8_t cc_unicode;
@@ -895,6 +901,20 @@ smb_dispatch(void *aux)
                (int)letoh_32(h->errorcode), len,
                nr->nr_is_trans2 ? ", TRANS2" : "");
 
+      if(nr->nr_pipelined) {
+        nr->nr_pipelined = 0;
+        cc->cc_pl_inflight--;
+      }
+
+      if(nr->nr_orphan) {
+        LIST_REMOVE(nr, nr_link);
+        free(nr);
+        free(buf);
+        hts_cond_broadcast(&cc->cc_cond);
+        hts_mutex_unlock(&smb_global_mutex);
+        continue;
+      }
+
       if(nr->nr_is_trans2 && h->errorcode == 0 &&
          len >= sizeof(TRANS2_reply_t)) {
 
@@ -973,6 +993,7 @@ smb_dispatch(void *aux)
         nr->nr_response_len = len;
       }
 
+      nr->nr_recv_time = arch_get_ts();
       nr->nr_result = 0;
       hts_cond_broadcast(&cc->cc_cond);
 
@@ -988,9 +1009,21 @@ smb_dispatch(void *aux)
 
   hts_mutex_lock(&smb_global_mutex);
 
-  LIST_FOREACH(nr, &cc->cc_pending_nbt_requests, nr_link) {
+  nbt_req_t *next;
+  for(nr = LIST_FIRST(&cc->cc_pending_nbt_requests); nr != NULL; nr = next) {
+    next = LIST_NEXT(nr, nr_link);
+    if(nr->nr_pipelined) {
+      nr->nr_pipelined = 0;
+      cc->cc_pl_inflight--;
+    }
+    if(nr->nr_orphan) {
+      LIST_REMOVE(nr, nr_link);
+      free(nr);
+      continue;
+    }
     nr->nr_result = 1;
     free(nr->nr_response);
+    nr->nr_response = NULL;
   }
 
   hts_cond_broadcast(&cc->cc_cond);
@@ -1153,6 +1186,7 @@ nbt_async_req(cifs_connection_t *cc, void *request, int request_len,
   nr->nr_is_trans2 = is_trans2;
   h->pid = htole_16(2);
   h->mid = htole_16(nr->nr_mid);
+  nr->nr_send_time = arch_get_ts();
   nbt_write(cc, request, request_len);
 
   LIST_INSERT_HEAD(&cc->cc_pending_nbt_requests, nr, nr_link);
@@ -2227,6 +2261,12 @@ smb_scandir(fa_protocol_t *fap, fa_dir_t *fa, const char *url,
   }
 }
 
+#define SMB_READ_CHUNK  57344  // 14 * 4096 is max according to spec
+
+#define SMB_PL_MAX      32     // Max pipelined READ_ANDX per file
+#define SMB_PL_TRIGGER  (2 * SMB_READ_CHUNK)
+#define SMB_PL_RTT_AGE  10000000  // Relearn base RTT this often (µs)
+
 /**
  *
  */
@@ -2236,6 +2276,33 @@ typedef struct smb_file {
   uint16_t sf_fid;
   uint64_t sf_pos;
   uint64_t sf_file_size;
+  time_t sf_mtime;
+
+  uint64_t sf_seq_end;      // Position where last read ended
+  int64_t sf_seq_bytes;     // Bytes read back-to-back up to sf_seq_end
+
+  /**
+   * Read pipeline. Once reads turn sequential we keep READ_ANDX
+   * requests in flight ahead of sf_pos. sf_pl_req is a ring of
+   * requests for consecutive SMB_READ_CHUNK sized pieces of the file,
+   * the one at sf_pl_head starts at sf_pl_offset
+   */
+  nbt_req_t *sf_pl_req[SMB_PL_MAX];
+  int sf_pl_head;
+  int sf_pl_count;
+  uint64_t sf_pl_offset;
+
+  int sf_pl_disabled;       // Never pipeline reads on this handle
+  int sf_pl_window;         // Requests to keep in flight beyond sf_pos
+  int sf_pl_window_min;     // Raised when we catch up with the server
+  int64_t sf_pl_rtt;        // Base round trip time (µs)
+  int64_t sf_pl_rtt_ts;
+  int64_t sf_pl_read_ts;    // When previous read started
+  int sf_pl_read_size;      // .. and how much it returned
+  double sf_pl_rate;        // Consumption rate (bytes / µs)
+
+  int sf_pl_requests;
+  int sf_pl_stalls;
 } smb_file_t;
 
 
@@ -2305,12 +2372,37 @@ smb_open(fa_protocol_t *fap, const char *url, char *errbuf, size_t errlen,
   resp = rbuf;
   sf->sf_fid = resp->fid;
   sf->sf_file_size = letoh_64(resp->file_size);
+  sf->sf_mtime = parsetime(resp->change);
+  sf->sf_pl_window_min = 1;
   sf->h.fh_proto = fap;
   free(rbuf);
   return &sf->h;
 }
 
 
+/**
+ * Drop all pipelined requests. Requests still on the wire are left on
+ * the pending list so they keep their slot in cc_pl_inflight until the
+ * dispatcher sees the reply and frees them
+ */
+static void
+smb_pl_flush(smb_file_t *sf)
+{
+  for(int i = 0; i < sf->sf_pl_count; i++) {
+    nbt_req_t *nr = sf->sf_pl_req[(sf->sf_pl_head + i) % SMB_PL_MAX];
+    if(nr->nr_result == -1) {
+      nr->nr_orphan = 1;
+      continue;
+    }
+    LIST_REMOVE(nr, nr_link);
+    free(nr->nr_response);
+    free(nr);
+  }
+  sf->sf_pl_head = 0;
+  sf->sf_pl_count = 0;
+}
+
+
 /**
  * Close file
  */
@@ -2323,6 +2415,13 @@ smb_close(fa_handle_t *fh)
 
   hts_mutex_lock(&smb_global_mutex);
 
+  smb_pl_flush(sf);
+
+  if(sf->sf_pl_requests)
+    TRACE(TRACE_DEBUG, "SMB", "%s:%d %d pipelined reads, %d stalls",
+          ct->ct_cc->cc_hostname, ct->ct_cc->cc_port,
+          sf->sf_pl_requests, sf->sf_pl_stalls);
+
   req = alloca(sizeof(SMB_CLOSE_req_t));
   memset(req, 0, sizeof(SMB_CLOSE_req_t));
 
@@ -2338,12 +2437,39 @@ smb_close(fa_handle_t *fh)
 
 
 /**
+ * Must be called with smb_global_mutex held
+ */
+static nbt_req_t *
+smb_send_read(smb_file_t *sf, SMB_READ_ANDX_req_t *req, int64_t pos, int cnt)
+{
+  cifs_tree_t *ct = sf->sf_ct;
+
+  memset(req, 0, sizeof(SMB_READ_ANDX_req_t));
+  smbv1_init_header(ct->ct_cc, &req->hdr, SMB_READ_ANDX,
+                    SMB_FLAGS_CANONICAL_PATHNAMES, 0, ct->ct_tid, 1);
+
+  req->fid = sf->sf_fid;
+  req->offset_low = htole_32((uint32_t)pos);
+  req->offset_high = htole_32((uint32_t)(pos >> 32));
+  req->max_count_low = htole_16(cnt & 0xffff);
+  req->max_count_high = htole_32(cnt >> 16);
+  req->wordcount = 12;
+  req->andx_command = 0xff;
+
+  return nbt_async_req(ct->ct_cc, req, sizeof(SMB_READ_ANDX_req_t), 0,
+                       "read");
+}
+
+
+/**
+ * Read without pipelining. All requests needed for 'size' are sent at
+ * once and then we wait for them to complete
  *
+ * Must be called with smb_global_mutex held
  */
 static int
-smb_read(fa_handle_t *fh, void *buf, size_t size)
+smb_read_direct(smb_file_t *sf, void *buf, size_t size)
 {
-  smb_file_t *sf = (smb_file_t *)fh;
   SMB_READ_ANDX_req_t *req;
   const SMB_READ_ANDX_resp_t *resp;
   size_t cnt, rcnt;
@@ -2352,38 +2478,13 @@ smb_read(fa_handle_t *fh, void *buf, size_t size)
   nbt_req_t *nr = NULL;
   struct nbt_req_list reqs;
 
-  if(sf->sf_pos >= sf->sf_file_size)
-    return 0;
-
-  if(sf->sf_pos + size > sf->sf_file_size)
-    size = sf->sf_file_size - sf->sf_pos;
-
-  if(size == 0)
-    return 0;
-
   LIST_INIT(&reqs);
 
   req = alloca(sizeof(SMB_READ_ANDX_req_t));
-  memset(req, 0, sizeof(SMB_READ_ANDX_req_t));
-
-  hts_mutex_lock(&smb_global_mutex);
 
   while(size > 0) {
-    cnt = MIN(size, 57344); // 14 * 4096 is max according to spec
-    smbv1_init_header(ct->ct_cc, &req->hdr, SMB_READ_ANDX,
-                      SMB_FLAGS_CANONICAL_PATHNAMES, 0, ct->ct_tid, 1);
-
-    req->fid = sf->sf_fid;
-    int64_t pos = sf->sf_pos + total;
-    req->offset_low = htole_32((uint32_t)pos);
-    req->offset_high = htole_32((uint32_t)(pos >> 32));
-    req->max_count_low = htole_16(cnt & 0xffff);
-    req->max_count_high = htole_32(cnt >> 16);
-    req->wordcount = 12;
-    req->andx_command = 0xff;
-
-    nr = nbt_async_req(ct->ct_cc, req, sizeof(SMB_READ_ANDX_req_t), 0,
-                       "read");
+    cnt = MIN(size, SMB_READ_CHUNK);
+    nr = smb_send_read(sf, req, sf->sf_pos + total, cnt);
     LIST_INSERT_HEAD(&reqs, nr, nr_multi_link);
 
     nr->nr_offset = total;
@@ -2437,7 +2538,6 @@ smb_read(fa_handle_t *fh, void *buf, size_t size)
     }
     free(nr);
   }
-  hts_mutex_unlock(&smb_global_mutex);
   return total;
 
  fail:
@@ -2448,9 +2548,229 @@ smb_read(fa_handle_t *fh, void *buf, size_t size)
     free(nr->nr_response);
     free(nr);
   }
-  hts_mutex_unlock(&smb_global_mutex);
   return -1;
+}
+
 
+/**
+ * Pipelined reads we allow on the wire at once, shared by all handles on
+ * the connection. Half of what the server negotiated, the rest is left
+ * for direct reads and other requests
+ */
+static int
+smb_pl_limit(const cifs_connection_t *cc)
+{
+  return cc->cc_max_mpx_count / 2;
+}
+
+
+/**
+ * Number of requests needed to cover the data consumed during one base
+ * RTT, with some headroom. Queueing on the server inflates the RTT of
+ * pipelined requests so we track the smallest one seen recently rather
+ * than an average, otherwise the window would feed on itself
+ */
+static void
+smb_pl_update_window(smb_file_t *sf)
+{
+  const cifs_connection_t *cc = sf->sf_ct->ct_cc;
+  int w = 1;
+
+  if(sf->sf_pl_rtt > 0)
+    w = sf->sf_pl_rate * sf->sf_pl_rtt * 2 / SMB_READ_CHUNK + 1;
+
+  w = MAX(w, sf->sf_pl_window_min);
+  w = MIN(w, SMB_PL_MAX);
+  w = MIN(w, smb_pl_limit(cc));
+
+  sf->sf_pl_window = w;
+}
+
+
+/**
+ * Send requests so everything up to 'size' bytes beyond sf_pos plus the
+ * window is in flight, as far as the connection has pipeline slots left
+ */
+static void
+smb_pl_fill(smb_file_t *sf, size_t size)
+{
+  cifs_connection_t *cc = sf->sf_ct->ct_cc;
+  SMB_READ_ANDX_req_t *req = alloca(sizeof(SMB_READ_ANDX_req_t));
+
+  if(sf->sf_pl_count == 0)
+    sf->sf_pl_offset = sf->sf_pos;
+
+  const uint64_t end =
+    MIN(sf->sf_pos + size + (uint64_t)sf->sf_pl_window * SMB_READ_CHUNK,
+        sf->sf_file_size);
+
+  while(sf->sf_pl_count < SMB_PL_MAX &&
+        cc->cc_pl_inflight < smb_pl_limit(cc)) {
+    const uint64_t pos =
+      sf->sf_pl_offset + (uint64_t)sf->sf_pl_count * SMB_READ_CHUNK;
+    if(pos >= end)
+      break;
+
+    const int cnt = MIN(SMB_READ_CHUNK, sf->sf_file_size - pos);
+    nbt_req_t *nr = smb_send_read(sf, req, pos, cnt);
+    nr->nr_cnt = cnt;
+    nr->nr_pipelined = 1;
+    cc->cc_pl_inflight++;
+    sf->sf_pl_req[(sf->sf_pl_head + sf->sf_pl_count) % SMB_PL_MAX] = nr;
+    sf->sf_pl_count++;
+    sf->sf_pl_requests++;
+  }
+}
+
+
+/**
+ * Copy as much as possible from the pipeline. Replies are consumed
+ * strictly in file order, whatever order the server answered in.
+ * On any error the pipeline is dropped and the caller falls back to
+ * smb_read_direct() which will report it properly
+ */
+static size_t
+smb_pl_consume(smb_file_t *sf, void *buf, size_t size, int64_t now)
+{
+  cifs_connection_t *cc = sf->sf_ct->ct_cc;
+  const SMB_READ_ANDX_resp_t *resp;
+  size_t total = 0;
+
+  while(size > 0 && sf->sf_pl_count > 0) {
+    nbt_req_t *nr = sf->sf_pl_req[sf->sf_pl_head];
+    const int64_t skip = sf->sf_pos - sf->sf_pl_offset;
+
+    if(skip < 0 || skip >= nr->nr_cnt)
+      goto flush;
+
+    if(nr->nr_result == -1) {
+      if(nr->nr_send_time < now) {
+        // Request was sent ahead of time but still not back
+        sf->sf_pl_stalls++;
+        sf->sf_pl_window_min = MIN(sf->sf_pl_window_min * 2, SMB_PL_MAX);
+      }
+
+      while(nr->nr_result == -1)
+        if(hts_cond_wait_timeout(&cc->cc_cond, &smb_global_mutex,
+                                 NBT_TIMEOUT))
+          goto flush;
+    }
+
+    if(nr->nr_result)
+      goto flush;
+
+    resp = nr->nr_response;
+    if(nr->nr_response_len < sizeof(SMB_READ_ANDX_resp_t) ||
+       letoh_32(resp->hdr.errorcode))
+      goto flush;
+
+    const int off = letoh_16(resp->data_offset);
+    const int rcnt = letoh_16(resp->data_length_low) +
+      (letoh_32(resp->data_length_high) << 16);
+
+    if(rcnt > nr->nr_cnt || off + rcnt > nr->nr_response_len || skip >= rcnt)
+      goto flush;
+
+    if(skip == 0) {
+      const int64_t rtt = nr->nr_recv_time - nr->nr_send_time;
+      if(sf->sf_pl_rtt == 0 || rtt < sf->sf_pl_rtt ||
+         now - sf->sf_pl_rtt_ts > SMB_PL_RTT_AGE) {
+        sf->sf_pl_rtt = MAX(rtt, 1);
+        sf->sf_pl_rtt_ts = now;
+      }
+    }
+
+    const size_t n = MIN(size, rcnt - skip);
+    memcpy(buf + total, nr->nr_response + off + skip, n);
+    total += n;
+    size -= n;
+    sf->sf_pos += n;
+
+    if(skip + n == rcnt) {
+      LIST_REMOVE(nr, nr_link);
+      free(nr->nr_response);
+      free(nr);
+      sf->sf_pl_head = (sf->sf_pl_head + 1) % SMB_PL_MAX;
+      sf->sf_pl_count--;
+      sf->sf_pl_offset += SMB_READ_CHUNK;
+    }
+  }
+  return total;
+
+ flush:
+  smb_pl_flush(sf);
+  return total;
+}
+
+
+/**
+ *
+ */
+static int
+smb_read(fa_handle_t *fh, void *buf, size_t size)
+{
+  smb_file_t *sf = (smb_file_t *)fh;
+  size_t total = 0;
+  int r;
+
+  if(sf->sf_pos >= sf->sf_file_size)
+    return 0;
+
+  if(sf->sf_pos + size > sf->sf_file_size)
+    size = sf->sf_file_size - sf->sf_pos;
+
+  if(size == 0)
+    return 0;
+
+  const int64_t now = arch_get_ts();
+
+  hts_mutex_lock(&smb_global_mutex);
+
+  if(sf->sf_pos != sf->sf_seq_end) {
+    // Seek, start over
+    smb_pl_flush(sf);
+    sf->sf_seq_bytes = 0;
+    sf->sf_pl_read_ts = 0;
+    sf->sf_pl_rate = 0;
+    sf->sf_pl_window_min = 1;
+  }
+
+  const int pipelined =
+    sf->sf_seq_bytes >= SMB_PL_TRIGGER && !sf->sf_pl_disabled;
+
+  if(pipelined) {
+    if(sf->sf_pl_read_ts && now > sf->sf_pl_read_ts) {
+      const double rate =
+        (double)sf->sf_pl_read_size / (now - sf->sf_pl_read_ts);
+      sf->sf_pl_rate = sf->sf_pl_rate ? (sf->sf_pl_rate * 7 + rate) / 8 : rate;
+    }
+    sf->sf_pl_read_ts = now;
+
+    smb_pl_update_window(sf);
+    smb_pl_fill(sf, size);
+    total = smb_pl_consume(sf, buf, size, now);
+  }
+
+  if(total < size) {
+    r = smb_read_direct(sf, buf + total, size - total);
+    if(r < 0 && total == 0) {
+      hts_mutex_unlock(&smb_global_mutex);
+      return -1;
+    }
+    if(r > 0)
+      total += r;
+  }
+
+  if(pipelined) {
+    // Top up so the next read finds its data already on the way
+    smb_pl_fill(sf, 0);
+    sf->sf_pl_read_size = total;
+  }
+
+  sf->sf_seq_end = sf->sf_pos;
+  sf->sf_seq_bytes += total;
+  hts_mutex_unlock(&smb_global_mutex);
+  return total;
 }
 
 
@@ -2494,6 +2814,13 @@ smb_fsize(fa_handle_t *fh)
   return sf->sf_file_size;
 }
 
+static time_t
+smb_mtime(fa_handle_t *fh)
+{
+  smb_file_t *sf = (smb_file_t *)fh;
+  return sf->sf_mtime;
+}
+
 /**
  *
  */
@@ -2918,6 +3245,55 @@ smb_no_parking(fa_handle_t *fh)
 }
 
 
+/**
+ * Sequential read throughput with and without the read pipeline.
+ * Point it at a big file on a local Samba share, for example
+ * smb://localhost/share/movie.mkv
+ *
+ * The pipeline is only switched off on the benchmark's own handle
+ */
+void
+smb_read_benchmark(const char *url)
+{
+  char errbuf[256];
+  const int bs = 64 * 1024;
+  void *buf = malloc(bs);
+  int pass, r;
+
+  printf("%10s %10s %10s %10s\n", "Pipeline", "MB/s", "Requests", "Stalls");
+
+  for(pass = 0; pass < 2; pass++) {
+    fa_handle_t *fh = fa_open(url, errbuf, sizeof(errbuf));
+    if(fh == NULL) {
+      printf("%s: %s\n", url, errbuf);
+      break;
+    }
+
+    if(fh->fh_proto->fap_read != smb_read) {
+      printf("%s: Not opened via SMB\n", url);
+      fa_close(fh);
+      break;
+    }
+
+    smb_file_t *sf = (smb_file_t *)fh;
+    sf->sf_pl_disabled = !pass;
+
+    int64_t bytes = 0;
+    int64_t ts = arch_get_ts();
+    while((r = fa_read(fh, buf, bs)) > 0)
+      bytes += r;
+    ts = arch_get_ts() - ts;
+
+    printf("%10s %10.1f %10d %10d\n", pass ? "on" : "off",
+           ts ? bytes / (double)ts : 0.0,
+           sf->sf_pl_requests, sf->sf_pl_stalls);
+    fa_close(fh);
+  }
+
+  free(buf);
+}
+
+
 /**
  * Main SMB protocol dispatch
  */
@@ -2931,6 +3307,7 @@ static fa_protocol_t fa_protocol_smb = {
   .fap_read  = smb_read,
   .fap_seek  = smb_seek,
   .fap_fsize = smb_fsize,
+  .fap_mtime = smb_mtime,
   .fap_stat  = smb_stat,
   .fap_unlink= smb_unlink,
   .fap_rmdir = smb_rmdir,
@@ -228,7 +228,7 @@ nmb_udp_input(void *opaque, const void *data, int size,
   if(pkt->h.transaction_id == nmb_txid) {
     void *a = malloc(4);
     memcpy(a, pkt->addr, 4);
-    task_run(query_master_browser, a);
+    task_run_ex(query_master_browser, a, TASK_PRIO_BULK, 0);
     asyncio_timer_arm_delta_sec(&nmb_flush_timer, 60);
     return;
   }
@@ -0,0 +1,461 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+
+/**
+ * Standalone test of the SMB read pipeline against a simulated server.
+ *
+ * The SMB client is included as is. TCP is replaced by a server thread
+ * that answers READ_ANDX with a known byte pattern after a configurable
+ * round trip time, over a link with limited bandwidth and optional
+ * jitter (which makes replies come back out of order).
+ *
+ * It checks that
+ *  - every byte read is correct, with random read sizes and seeks
+ *  - pipelined reads in flight never exceed the per connection limit,
+ *    also with several handles reading at once
+ *
+ * and prints throughput with and without the pipeline. The numbers
+ * come from the simulated link, use smb_read_benchmark() for a real
+ * server. Not part of the regular build, compile with something like
+ *
+ *   cc -std=gnu99 -D_GNU_SOURCE -DENABLE_OPENSSL=1 -Ibuild.linux -Isrc \
+ *     -Iext -Isrc/arch/linux src/fileaccess/smb/smb_pipeline_test.c \
+ *     -o smb_pipeline_test -lcrypto -lpthread
+ */
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fa_nativesmb.c"
+
+#define TEST_FILE_SIZE (24 * 1024 * 1024 + 777)
+#define TEST_MAX_MPX   16
+#define TEST_READERS   3
+
+static uint8_t
+test_pattern(int64_t pos)
+{
+  return (pos * 2654435761u) >> 13;
+}
+
+static int test_rtt = 2000;      // µs
+static double test_bw = 100.0;   // bytes / µs
+static int test_jitter;          // µs
+static int test_pipe[2];
+
+static int server_inflight;
+static int server_max_inflight;
+static int pl_max_inflight;
+
+static cifs_connection_t *test_cc;
+static cifs_tree_t *test_ct;
+
+
+/**
+ * Replacements for what fa_nativesmb.c needs from the rest of the tree
+ */
+int64_t
+arch_get_ts(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void
+tracelog(int flags, int level, const char *subsys, const char *fmt, ...)
+{
+}
+
+void
+hts_cond_init(hts_cond_t *c, hts_mutex_t *m)
+{
+  pthread_cond_init(c, NULL);
+}
+
+int
+hts_cond_wait_timeout(hts_cond_t *c, hts_mutex_t *m, int delta)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += delta / 1000;
+  ts.tv_nsec += (delta % 1000) * 1000000;
+  if(ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  return pthread_cond_timedwait(c, m, &ts) == ETIMEDOUT;
+}
+
+void
+hts_thread_create_joinable(const char *name, hts_thread_t *t,
+                           void *(*fn)(void *), void *aux, int prio)
+{
+  pthread_create(t, NULL, fn, aux);
+}
+
+/**
+ * Never reached, the test sets up its connection and handles directly
+ */
+void callout_arm_x(callout_t *c, callout_callback_t *cb, void *opaque,
+                   int delta, const char *file, int line) { abort(); }
+void callout_disarm(callout_t *c) { abort(); }
+void fa_close(void *fh) { abort(); }
+fa_dir_entry_t *fa_dir_add(fa_dir_t *fd, const char *path, const char *name,
+                           int type) { abort(); }
+void *fa_open_ex(const char *url, char *errbuf, size_t errsize, int flags,
+                 struct fa_open_extra *foe) { abort(); }
+int fa_read(void *fh, void *buf, size_t size) { abort(); }
+int keyring_lookup(const char *id, char **username, char **password,
+                   char **domain, int *remember_me, const char *source,
+                   const char *reason, int flags) { abort(); }
+rstr_t *nls_get_rstring(const char *string) { abort(); }
+tcpcon_t *tcp_connect(const char *hostname, int port, char *errbuf,
+                      size_t errbufsize, int timeout, int flags,
+                      struct cancellable *c) { abort(); }
+void tcp_close(tcpcon_t *tc) { abort(); }
+void tcp_shutdown(tcpcon_t *tc) { abort(); }
+void ucs2_to_utf8(uint8_t *dst, size_t dstlen, const uint8_t *src,
+                  size_t srclen, int little_endian) { abort(); }
+size_t utf8_to_ucs2(uint8_t *dst, const char *src,
+                    int little_endian) { abort(); }
+size_t utf8_to_ascii(uint8_t *dst, const char *src) { abort(); }
+int utf8_put(char *out, int c) { abort(); }
+void url_split(char *proto, int proto_size, char *authorization,
+               int authorization_size, char *hostname, int hostname_size,
+               int *port_ptr, char *path, int path_size,
+               const char *url) { abort(); }
+void fileaccess_register_entry(fa_protocol_t *fap) {}
+
+gconf_t gconf;
+
+
+/**
+ * Simulated server
+ */
+typedef struct test_reply {
+  struct test_reply *tr_next;
+  int64_t tr_when;
+  int tr_len;
+  uint8_t *tr_data;
+} test_reply_t;
+
+static test_reply_t *test_replies;
+static int64_t test_link_free;
+static pthread_mutex_t test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t test_cond = PTHREAD_COND_INITIALIZER;
+
+
+/**
+ * Called with smb_global_mutex held for every request sent
+ */
+int
+tcp_write_data(tcpcon_t *tc, const void *buf, const size_t len)
+{
+  const SMB_READ_ANDX_req_t *req = buf;
+
+  if(req->hdr.cmd != SMB_READ_ANDX)
+    return 0;
+
+  pl_max_inflight = MAX(pl_max_inflight, test_cc->cc_pl_inflight);
+
+  const int64_t off = letoh_32(req->offset_low) |
+    (int64_t)letoh_32(req->offset_high) << 32;
+  int cnt = letoh_16(req->max_count_low) | letoh_32(req->max_count_high) << 16;
+
+  if(off + cnt > TEST_FILE_SIZE)
+    cnt = off >= TEST_FILE_SIZE ? 0 : TEST_FILE_SIZE - off;
+
+  const int hl = sizeof(SMB_READ_ANDX_resp_t);
+  const int total = 4 + hl + cnt;
+  uint8_t *d = calloc(1, total);
+  SMB_READ_ANDX_resp_t *resp = (void *)(d + 4);
+
+  d[1] = (total - 4) >> 16;
+  d[2] = (total - 4) >> 8;
+  d[3] = (total - 4);
+  resp->hdr = req->hdr;
+  resp->data_length_low = htole_16(cnt & 0xffff);
+  resp->data_length_high = htole_32(cnt >> 16);
+  resp->data_offset = htole_16(hl);
+  for(int i = 0; i < cnt; i++)
+    d[4 + hl + i] = test_pattern(off + i);
+
+  const int64_t now = arch_get_ts();
+  test_reply_t *tr = calloc(1, sizeof(test_reply_t));
+  tr->tr_len = total;
+  tr->tr_data = d;
+
+  pthread_mutex_lock(&test_mutex);
+  server_inflight++;
+  server_max_inflight = MAX(server_max_inflight, server_inflight);
+
+  test_link_free = MAX(now + test_rtt,
+                       test_link_free + (int64_t)(total / test_bw));
+  tr->tr_when = test_link_free + (test_jitter ? rand() % test_jitter : 0);
+
+  test_reply_t **p = &test_replies;
+  while(*p != NULL && (*p)->tr_when <= tr->tr_when)
+    p = &(*p)->tr_next;
+  tr->tr_next = *p;
+  *p = tr;
+
+  pthread_cond_signal(&test_cond);
+  pthread_mutex_unlock(&test_mutex);
+  return 0;
+}
+
+
+/**
+ *
+ */
+int
+tcp_read_data(tcpcon_t *tc, void *buf, const size_t size,
+              net_read_cb_t *cb, void *opaque)
+{
+  size_t off = 0;
+  while(off < size) {
+    int r = read(test_pipe[0], buf + off, size - off);
+    if(r <= 0)
+      return -1;
+    off += r;
+  }
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void *
+test_server(void *aux)
+{
+  pthread_mutex_lock(&test_mutex);
+  while(1) {
+    while(test_replies == NULL)
+      pthread_cond_wait(&test_cond, &test_mutex);
+
+    test_reply_t *tr = test_replies;
+    const int64_t now = arch_get_ts();
+    if(tr->tr_when > now) {
+      pthread_mutex_unlock(&test_mutex);
+      usleep(MIN(tr->tr_when - now, 200));
+      pthread_mutex_lock(&test_mutex);
+      continue;
+    }
+    test_replies = tr->tr_next;
+    server_inflight--;
+    pthread_mutex_unlock(&test_mutex);
+
+    int off = 0;
+    while(off < tr->tr_len)
+      off += write(test_pipe[1], tr->tr_data + off, tr->tr_len - off);
+    free(tr->tr_data);
+    free(tr);
+
+    pthread_mutex_lock(&test_mutex);
+  }
+  return NULL;
+}
+
+
+/**
+ * Read 'limit' bytes through one handle and verify all of it.
+ * bs == 0 means random read sizes
+ */
+typedef struct test_reader {
+  int pipeline;
+  int bs;
+  int seekprob;   // Per mille
+  int64_t limit;
+  int64_t time;
+  int requests;
+  int stalls;
+} test_reader_t;
+
+static void *
+test_read(void *aux)
+{
+  test_reader_t *r = aux;
+  smb_file_t *sf = calloc(1, sizeof(smb_file_t));
+  uint8_t *buf = malloc(1 << 21);
+  int64_t pos = 0, total = 0;
+  unsigned int seed = (intptr_t)r;
+
+  sf->sf_ct = test_ct;
+  sf->sf_file_size = TEST_FILE_SIZE;
+  sf->sf_pl_window_min = 1;
+  sf->sf_pl_disabled = !r->pipeline;
+  sf->h.fh_proto = &fa_protocol_smb;
+
+  const int64_t ts = arch_get_ts();
+
+  while(total < r->limit) {
+    if(r->seekprob && rand_r(&seed) % 1000 < r->seekprob) {
+      pos = rand_r(&seed) % TEST_FILE_SIZE;
+      smb_seek(&sf->h, pos, SEEK_SET, 0);
+    }
+
+    const int size = r->bs ?: 1 + rand_r(&seed) %
+      (rand_r(&seed) & 1 ? 65536 : 1000000);
+    const int got = smb_read(&sf->h, buf, size);
+    const int expected = MIN((int64_t)size, TEST_FILE_SIZE - pos);
+
+    if(got != expected) {
+      printf("Read %d bytes at %"PRId64", expected %d\n", got, pos, expected);
+      abort();
+    }
+
+    for(int i = 0; i < got; i++) {
+      if(buf[i] != test_pattern(pos + i)) {
+        printf("Mismatch at %"PRId64"\n", pos + i);
+        abort();
+      }
+    }
+
+    pos += got;
+    total += got;
+    if(got == 0) {
+      pos = 0;
+      smb_seek(&sf->h, 0, SEEK_SET, 0);
+    }
+  }
+
+  r->time = arch_get_ts() - ts;
+
+  hts_mutex_lock(&smb_global_mutex);
+  smb_pl_flush(sf);
+  hts_mutex_unlock(&smb_global_mutex);
+
+  r->requests = sf->sf_pl_requests;
+  r->stalls = sf->sf_pl_stalls;
+  free(sf);
+  free(buf);
+  return NULL;
+}
+
+
+/**
+ * Run readers concurrently on the shared connection and check limits
+ */
+static void
+test_run(const char *name, test_reader_t *readers, int num)
+{
+  pthread_t tids[num];
+
+  server_max_inflight = 0;
+  pl_max_inflight = 0;
+
+  for(int i = 0; i < num; i++)
+    pthread_create(&tids[i], NULL, test_read, &readers[i]);
+  for(int i = 0; i < num; i++)
+    pthread_join(tids[i], NULL);
+
+  // Let orphaned replies drain
+  usleep(test_rtt * 3 + test_jitter + 100000);
+
+  printf("%-28s", name);
+  for(int i = 0; i < num; i++)
+    printf(" %7.1f MB/s (%d req, %d stalls)",
+           readers[i].limit / (double)readers[i].time,
+           readers[i].requests, readers[i].stalls);
+  printf("  in flight %d pipelined, %d total\n",
+         pl_max_inflight, server_max_inflight);
+
+  if(pl_max_inflight > smb_pl_limit(test_cc)) {
+    printf("In flight limit exceeded\n");
+    abort();
+  }
+
+  if(test_cc->cc_pl_inflight != 0) {
+    printf("%d pipelined requests not accounted for\n",
+           test_cc->cc_pl_inflight);
+    abort();
+  }
+}
+
+
+/**
+ *
+ */
+int
+main(int argc, char **argv)
+{
+  pthread_t tid;
+  char name[64];
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+
+  if(pipe(test_pipe))
+    return 1;
+
+  smb_init();
+
+  test_cc = calloc(1, sizeof(cifs_connection_t));
+  test_cc->cc_tc = (tcpcon_t *)1;
+  test_cc->cc_max_mpx_count = TEST_MAX_MPX;
+  hts_cond_init(&test_cc->cc_cond, &smb_global_mutex);
+  LIST_INIT(&test_cc->cc_pending_nbt_requests);
+
+  test_ct = calloc(1, sizeof(cifs_tree_t));
+  test_ct->ct_cc = test_cc;
+
+  pthread_create(&tid, NULL, test_server, NULL);
+  hts_thread_create_joinable("smbdispatch", &test_cc->cc_thread,
+                             smb_dispatch, test_cc, 0);
+
+  // Sequential throughput on one handle
+  const int rtts[] = {500, 2000, 10000};
+  for(int i = 0; i < 3; i++) {
+    for(int pipeline = 0; pipeline < 2; pipeline++) {
+      test_reader_t r = {
+        .pipeline = pipeline, .bs = 65536, .limit = 16 << 20
+      };
+      test_rtt = rtts[i];
+      snprintf(name, sizeof(name), "rtt %5dus pipeline %s",
+               test_rtt, pipeline ? "on" : "off");
+      test_run(name, &r, 1);
+    }
+  }
+
+  // Random sizes and seeks, jitter makes replies arrive out of order
+  test_rtt = 1000;
+  test_jitter = 3000;
+  const int seekprob[] = {0, 20, 200};
+  for(int i = 0; i < 3; i++) {
+    test_reader_t r = {
+      .pipeline = 1, .seekprob = seekprob[i], .limit = 60 << 20
+    };
+    snprintf(name, sizeof(name), "random seek %d/1000", seekprob[i]);
+    test_run(name, &r, 1);
+  }
+
+  // Several handles share the connection's pipeline slots
+  test_reader_t readers[TEST_READERS];
+  for(int i = 0; i < TEST_READERS; i++)
+    readers[i] = (test_reader_t) {
+      .pipeline = 1, .seekprob = i * 10, .limit = 24 << 20
+    };
+  test_run("concurrent", readers, TEST_READERS);
+
+  printf("OK\n");
+  return 0;
+}
@@ -162,6 +162,7 @@ libav_deliver_frame(video_decoder_t *vd,
   fi.fi_pts = pts;
   fi.fi_epoch = mbm->mbm_epoch;
   fi.fi_user_time = mbm->mbm_user_time;
+  fi.fi_enq_time = mbm->mbm_enq_time;
   fi.fi_duration = duration;
   fi.fi_drive_clock = mbm->mbm_drive_clock;
 
@@ -301,12 +302,14 @@ libav_video_eof(media_codec_t *mc, video_decoder_t *vd,
 
   while(1) {
 
+    const int64_t ts = arch_get_ts();
     avgtime_start(&vd->vd_decode_time);
 
     avcodec_decode_video2(ctx, vd->vd_frame, &got_pic, &avpkt);
 
     t = avgtime_stop(&vd->vd_decode_time, mq->mq_prop_decode_avg,
                      mq->mq_prop_decode_peak);
+    media_latency_add(&mq->mq_latency_decode, arch_get_ts() - ts);
 
     if(!got_pic)
       break;
@@ -320,6 +323,89 @@ libav_video_eof(media_codec_t *mc, video_decoder_t *vd,
 
 #include "misc/minmax.h"
 
+/**
+ * Pick thread type and count for a video decoder
+ *
+ * Frame threading gives the best throughput but delays output by one
+ * frame per extra thread, which hurts live TV and channel zapping.
+ * Slice threading adds no latency but scales poorly with core count
+ * (and not at all for codecs without slice support)
+ *
+ * Must be called before the codec is opened
+ */
+static void
+libav_set_threading(media_codec_t *mc, AVCodecContext *ctx,
+                    const AVCodec *codec, int width, int height, int mode)
+{
+  const int slices = codec->capabilities & CODEC_CAP_SLICE_THREADS;
+  const int frames = codec->capabilities & CODEC_CAP_FRAME_THREADS;
+  const int pixels = width * height;
+  int count = gconf.concurrency;
+  int type;
+  const char *why;
+  char buf[64];
+
+  if(mode & MP_TRICKPLAY) {
+    // Each frame is displayed as soon as it's decoded
+    type = FF_THREAD_SLICE;
+    why = "trickplay";
+  } else if(mode & MP_LIVE) {
+    type = FF_THREAD_SLICE;
+    if(!slices && frames)
+      count = MIN(count, 2); // Bound the latency added by frame threading
+    why = "live";
+  } else {
+    type = FF_THREAD_FRAME;
+    // Small pictures don't have enough work to keep many threads busy
+    if(pixels && pixels < 1280 * 720)
+      count = MIN(count, 4);
+    why = "vod";
+  }
+
+  if(type == FF_THREAD_SLICE && !slices && frames)
+    type = FF_THREAD_FRAME;
+  else if(type == FF_THREAD_FRAME && !frames && slices)
+    type = FF_THREAD_SLICE;
+
+  ctx->thread_type = type;
+  ctx->thread_count = count;
+  mc->threading_mode = mode;
+
+  if(count > 1 && (slices || frames))
+    snprintf(buf, sizeof(buf), "%s x%d (%s, %dx%d)",
+             type == FF_THREAD_FRAME ? "frame" : "slice", count, why,
+             width, height);
+  else
+    snprintf(buf, sizeof(buf), "none (%s)", why);
+
+  if(mc->mp != NULL)
+    prop_set_string(mc->mp->mp_video.mq_prop_threading, buf);
+}
+
+
+/**
+ * Reopen the decoder with a threading setup suitable for the current
+ * playback mode. Any frames still in the decoder are delivered first
+ */
+static void
+libav_video_rethread(media_codec_t *mc, video_decoder_t *vd,
+                     media_queue_t *mq, int mode)
+{
+  AVCodecContext *ctx = mc->ctx;
+  const AVCodec *codec = ctx->codec;
+
+  libav_video_eof(mc, vd, mq);
+  avcodec_close(ctx);
+
+  libav_set_threading(mc, ctx, codec, ctx->width, ctx->height, mode);
+
+  if(avcodec_open2(ctx, codec, NULL) < 0) {
+    TRACE(TRACE_ERROR, "libav", "Unable to reopen codec %s", codec->name);
+    mc->threading_locked = 1;
+  }
+}
+
+
 /**
  *
  */
@@ -333,8 +419,16 @@ libav_decode_video(struct media_codec *mc, struct video_decoder *vd,
   AVFrame *frame = vd->vd_frame;
   int t;
 
-  if(mb->mb_flush)
+  // Switch threading policy at the next keyframe if playback mode changed
+  const int mode = mp->mp_flags & (MP_LIVE | MP_TRICKPLAY);
+  if(mode != mc->threading_mode && !mc->threading_locked &&
+     mc->close == NULL && (mb->mb_keyframe || mb->mb_flush)) {
+    libav_video_rethread(mc, vd, mq, mode);
+    if(ctx->codec == NULL)
+      return;
+  } else if(mb->mb_flush) {
     libav_video_eof(mc, vd, mq);
+  }
 
   copy_mbm_from_mb(&vd->vd_reorder[vd->vd_reorder_ptr], mb);
   ctx->reordered_opaque = vd->vd_reorder_ptr;
@@ -342,14 +436,21 @@ libav_decode_video(struct media_codec *mc, struct video_decoder *vd,
 
   /*
    * If we are seeking, drop any non-reference frames
+   * In trickplay we're only fed keyframes, make sure nothing else
+   * gets decoded
    */
-  ctx->skip_frame = mb->mb_skip == 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+  if(mp->mp_flags & MP_TRICKPLAY)
+    ctx->skip_frame = AVDISCARD_NONKEY;
+  else
+    ctx->skip_frame = mb->mb_skip == 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+  const int64_t ts = arch_get_ts();
   avgtime_start(&vd->vd_decode_time);
 
   avcodec_decode_video2(ctx, frame, &got_pic, &mb->mb_pkt);
 
   t = avgtime_stop(&vd->vd_decode_time, mq->mq_prop_decode_avg,
 		   mq->mq_prop_decode_peak);
+  media_latency_add(&mq->mq_latency_decode, arch_get_ts() - ts);
 
   mp_set_mq_meta(mq, ctx->codec, ctx);
 
@@ -363,6 +464,94 @@ libav_decode_video(struct media_codec *mc, struct video_decoder *vd,
 }
 
 
+/**
+ * Formats that video_deliver_lavc() passes on to the YUVP engine
+ */
+static int
+libav_is_surface_format(int pix_fmt)
+{
+  switch(pix_fmt) {
+  case AV_PIX_FMT_YUV420P:
+  case AV_PIX_FMT_YUV422P:
+  case AV_PIX_FMT_YUV444P:
+  case AV_PIX_FMT_YUV410P:
+  case AV_PIX_FMT_YUV411P:
+  case AV_PIX_FMT_YUV440P:
+  case AV_PIX_FMT_YUVJ420P:
+  case AV_PIX_FMT_YUVJ422P:
+  case AV_PIX_FMT_YUVJ444P:
+  case AV_PIX_FMT_YUVJ440P:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ * Allocate decoder frames in a layout the video surfaces can upload
+ * from directly: All planes in one pooled buffer and chroma linesize
+ * exactly luma linesize >> hshift (the texture coordinates are shared
+ * between planes).
+ *
+ * The renderer keeps a reference to the frame (av_frame_clone()) until
+ * it has been uploaded, at which point the buffer returns to the pool,
+ * so no copy of the picture is ever made on its way to the GPU.
+ */
+static int
+libav_get_buffer_surface(struct AVCodecContext *ctx, AVFrame *frame,
+                         int flags)
+{
+  media_codec_t *mc = ctx->opaque;
+  int linesize_align[AV_NUM_DATA_POINTERS];
+  int hshift, vshift;
+  int w = frame->width;
+  int h = frame->height;
+
+  if(!(ctx->codec->capabilities & CODEC_CAP_DR1) ||
+     !libav_is_surface_format(frame->format))
+    return avcodec_default_get_buffer2(ctx, frame, flags);
+
+  av_pix_fmt_get_chroma_sub_sample(frame->format, &hshift, &vshift);
+  avcodec_align_dimensions2(ctx, &w, &h, linesize_align);
+
+  int align = 64;
+  align = MAX(align, linesize_align[0]);
+  align = MAX(align, linesize_align[1] << hshift);
+  align = MAX(align, linesize_align[2] << hshift);
+
+  const int luma_linesize = FFALIGN(w, align);
+  const int chroma_linesize = luma_linesize >> hshift;
+  const int chroma_height = -((-h) >> vshift);
+  const int luma_size = luma_linesize * h;
+  const int chroma_size = chroma_linesize * chroma_height;
+
+  // Some decoders (and the renderer's SIMD) read a bit past the end
+  const int size = luma_size + chroma_size * 2 + align;
+
+  if(mc->frame_pool == NULL || mc->frame_pool_size != size) {
+    av_buffer_pool_uninit(&mc->frame_pool);
+    mc->frame_pool = av_buffer_pool_init(size, NULL);
+    mc->frame_pool_size = size;
+    if(mc->frame_pool == NULL)
+      return AVERROR(ENOMEM);
+  }
+
+  frame->buf[0] = av_buffer_pool_get(mc->frame_pool);
+  if(frame->buf[0] == NULL)
+    return AVERROR(ENOMEM);
+
+  frame->data[0] = frame->buf[0]->data;
+  frame->data[1] = frame->data[0] + luma_size;
+  frame->data[2] = frame->data[1] + chroma_size;
+  frame->linesize[0] = luma_linesize;
+  frame->linesize[1] = chroma_linesize;
+  frame->linesize[2] = chroma_linesize;
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+
 /**
  *
  */
@@ -380,7 +569,7 @@ libav_get_format(struct AVCodecContext *ctx, const enum AVPixelFormat *fmt)
     return AV_PIX_FMT_VDPAU;
   }
 #endif
-  mc->get_buffer2 = &avcodec_default_get_buffer2;
+  mc->get_buffer2 = &libav_get_buffer_surface;
   return avcodec_default_get_format(ctx, fmt);
 }
 
@@ -425,12 +614,17 @@ media_codec_create_lavc(media_codec_t *cw, const media_codec_params_t *mcp,
 
   if(codec->type == AVMEDIA_TYPE_VIDEO) {
 
-    cw->get_buffer2 = &avcodec_default_get_buffer2;
+    cw->get_buffer2 = &libav_get_buffer_surface;
 
     // If we run with vdpau and h264 libav will crash when going
     // back and forth between accelerated and non-accelerated mode
     if(!(video_settings.vdpau && cw->codec_id == AV_CODEC_ID_H264))
-      cw->ctx->thread_count = gconf.concurrency;
+      libav_set_threading(cw, cw->ctx, codec,
+                          cw->ctx->width  ?: (mcp ? mcp->width  : 0),
+                          cw->ctx->height ?: (mcp ? mcp->height : 0),
+                          mp ? mp->mp_flags & (MP_LIVE | MP_TRICKPLAY) : 0);
+    else
+      cw->threading_locked = 1;
 
     cw->ctx->opaque = cw;
     cw->ctx->refcounted_frames = 1;
@@ -532,6 +532,7 @@ parse_opts(int argc, char **argv)
 	     "                       Intended for plugin development\n"
 	     "   -j <path>           Load javascript file\n"
 	     "   --skin <skin>     Select skin (for GLW ui)\n"
+	     "   --asyncio-reactors <n> Number of network event loop threads\n"
 	     "\n"
 	     "  URL is any URL-type supported, "
 	     "e.g., \"file:///...\"\n"
@@ -653,6 +654,9 @@ parse_opts(int argc, char **argv)
     } else if (!strcmp(argv[0], "--upgrade-path") && argc > 1) {
       mystrset(&gconf.upgrade_path, argv[1]);
       argc -= 2; argv += 2;
+    } else if (!strcmp(argv[0], "--asyncio-reactors") && argc > 1) {
+      gconf.asyncio_reactors = atoi(argv[1]);
+      argc -= 2; argv += 2;
     } else if (!strcmp(argv[0], "--showtime-shell-fd") && argc > 1) {
       gconf.shell_fd = atoi(argv[1]);
       argc -= 2; argv += 2;
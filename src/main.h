@@ -208,6 +208,7 @@ typedef struct gconf {
 
   int max_video_buffer_size;
   int concurrency;
+  int asyncio_reactors;
   int trace_level;
   int trace_to_syslog;
   int listen_on_stdin;
@@ -295,6 +296,7 @@ typedef struct gconf {
   struct prop_concat *settings_look_and_feel;
   struct setting *setting_av_volume; // Maybe move to audio.h
   struct setting *setting_av_sync;   // Maybe move to audio.h
+  int audio_preload_lead; // Seconds before end of track to preload next
 
   hts_mutex_t state_mutex;
   hts_cond_t state_cond;
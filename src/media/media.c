@@ -42,6 +42,8 @@
 #include "media_track.h"
 #include "media_settings.h"
 #include "misc/lockmgr.h"
+#include "htsmsg/htsmsg_json.h"
+#include "networking/http_server.h"
 
 #include "video/video_settings.h"
 
@@ -216,6 +218,9 @@ mp_create(const char *name, int flags)
 
   mp->mp_prop_buffer_delay = prop_create(p, "delay");
 
+  mp->mp_prop_buffer_pool = prop_create(p, "pool");
+  prop_set_int(mp->mp_prop_buffer_pool, 0);
+
 
 
   //
@@ -240,6 +245,7 @@ mp_create(const char *name, int flags)
 
   mp->mp_prop_avdiff      = prop_create(mp->mp_prop_root, "avdiff");
   mp->mp_prop_avdiff_error= prop_create(mp->mp_prop_root, "avdiffError");
+  mp->mp_prop_avdrift     = prop_create(mp->mp_prop_root, "avdrift");
 
   mp->mp_prop_canSkipBackward =
     prop_create(mp->mp_prop_root, "canSkipBackward");
@@ -409,6 +415,7 @@ mp_release(media_pipe_t *mp)
   hts_mutex_destroy(&mp->mp_overlay_mutex);
 
   pool_destroy(mp->mp_mb_pool);
+  media_buf_payload_allocator_release(mp);
 
   if(mp->mp_satisfied == 0)
     atomic_dec(&media_buffer_hungry);
@@ -430,6 +437,7 @@ void
 mp_bump_epoch(media_pipe_t *mp)
 {
   hts_mutex_lock(&mp->mp_mutex);
+  mp_drain_rings_locked(mp);
   mp->mp_epoch++;
   hts_mutex_unlock(&mp->mp_mutex);
 }
@@ -744,7 +752,17 @@ mp_configure(media_pipe_t *mp, int flags, int buffer_size, int64_t duration,
                           MP_ALWAYS_SATISFIED |
                           MP_CAN_SEEK |
                           MP_CAN_PAUSE |
-                          MP_CAN_EJECT);
+                          MP_CAN_EJECT |
+                          MP_LIVE |
+                          MP_TRICKPLAY |
+                          MP_CAN_TRICKPLAY);
+
+  mp->mp_trickplay_speed = 0;
+  prop_set(mp->mp_prop_root, "trickplay", PROP_SET_INT, 0);
+
+  mq_latency_reset(&mp->mp_video);
+  mq_latency_reset(&mp->mp_audio);
+  media_latency_reset(&mp->mp_latency_avdrift);
 
   prop_set(mp->mp_prop_root, "type", PROP_SET_STRING, type);
 
@@ -972,3 +990,68 @@ media_discontinuity_debug(media_discontinuity_aux_t *aux,
 
 
 
+
+
+#if ENABLE_HTTPSERVER
+
+/**
+ *
+ */
+static htsmsg_t *
+mq_latency_to_htsmsg(const media_queue_t *mq)
+{
+  htsmsg_t *m = htsmsg_create_map();
+  htsmsg_add_msg(m, "queue",  media_latency_to_htsmsg(&mq->mq_latency_queue));
+  htsmsg_add_msg(m, "decode", media_latency_to_htsmsg(&mq->mq_latency_decode));
+  htsmsg_add_msg(m, "output", media_latency_to_htsmsg(&mq->mq_latency_output));
+  htsmsg_add_msg(m, "total",  media_latency_to_htsmsg(&mq->mq_latency_total));
+  return m;
+}
+
+
+/**
+ * Dump per-stage latency histograms of all media pipes as JSON.
+ * All times are in µs
+ */
+static int
+media_latency_dump(http_connection_t *hc, const char *remain, void *opaque,
+                   http_cmd_t method)
+{
+  media_pipe_t *mp;
+  htsbuf_queue_t out;
+  htsmsg_t *list = htsmsg_create_list();
+
+  // Pipes are unlinked under media_mutex before being torn down
+  hts_mutex_lock(&media_mutex);
+  LIST_FOREACH(mp, &media_pipelines, mp_global_link) {
+    htsmsg_t *m = htsmsg_create_map();
+    htsmsg_add_str(m, "name", mp->mp_name);
+    htsmsg_add_msg(m, "video", mq_latency_to_htsmsg(&mp->mp_video));
+    htsmsg_add_msg(m, "audio", mq_latency_to_htsmsg(&mp->mp_audio));
+    htsmsg_add_msg(m, "avdrift",
+                   media_latency_to_htsmsg(&mp->mp_latency_avdrift));
+    htsmsg_add_msg(list, NULL, m);
+  }
+  hts_mutex_unlock(&media_mutex);
+
+  htsbuf_queue_init(&out, 0);
+  htsmsg_json_serialize(list, &out, 1);
+  htsmsg_release(list);
+
+  return http_send_reply(hc, 0, "application/json; charset=utf-8",
+                         NULL, NULL, 0, &out);
+}
+
+
+/**
+ *
+ */
+static void
+media_latency_init(void)
+{
+  http_path_add("/api/media/latency", NULL, media_latency_dump, 1);
+}
+
+INITME(INIT_GROUP_API, media_latency_init, NULL, 0);
+
+#endif
@@ -70,6 +70,7 @@ enum codec_id {
 #include "event.h"
 #include "misc/pool.h"
 #include "media_buf.h"
+#include "media_latency.h"
 #include "media_queue.h"
 #include "media_codec.h"
 #include "media_track.h"
@@ -118,6 +119,7 @@ typedef struct frame_info {
   int fi_height;
   int64_t fi_pts;
   int64_t fi_user_time;
+  int64_t fi_enq_time;    // When the source packet was enqueued, 0 if unknown
   int fi_epoch;
   int fi_duration;
 
@@ -177,6 +179,9 @@ typedef struct media_pipe {
 #define MP_CAN_SEEK         0x20
 #define MP_CAN_PAUSE        0x40
 #define MP_CAN_EJECT        0x80
+#define MP_LIVE             0x100 // Live source, favour low decoder latency
+#define MP_TRICKPLAY        0x200 // Fast forward/rewind, keyframes only
+#define MP_CAN_TRICKPLAY    0x400 // Player handles EVENT_TRICKPLAY
 
   AVRational mp_framerate;
 
@@ -208,6 +213,7 @@ typedef struct media_pipe {
 
 
   pool_t *mp_mb_pool;
+  struct media_payload_allocator *mp_payload_allocator;
 
 
   unsigned int mp_buffer_current; // Bytes current queued (total for all queues)
@@ -241,6 +247,8 @@ typedef struct media_pipe {
   int mp_auto_standby;
   int mp_stats_update_limiter;
 
+  media_latency_t mp_latency_avdrift;  // Audio clock - video pts at display
+
   struct audio_decoder *mp_audio_decoder;
 
   /**
@@ -284,6 +292,7 @@ typedef struct media_pipe {
   prop_t *mp_prop_url;
   prop_t *mp_prop_avdiff;
   prop_t *mp_prop_avdiff_error;
+  prop_t *mp_prop_avdrift;
   prop_t *mp_prop_shuffle;
   prop_t *mp_prop_repeat;
 
@@ -309,14 +318,24 @@ typedef struct media_pipe {
   prop_t *mp_prop_buffer_current;
   prop_t *mp_prop_buffer_limit;
   prop_t *mp_prop_buffer_delay;
+  prop_t *mp_prop_buffer_pool;
 
   prop_sub_t *mp_sub_currenttime;
   prop_sub_t *mp_sub_eventsink;
 
   int64_t mp_seek_base;
   int64_t mp_duration;  // Duration of currently played (0 if unknown)
+  int mp_trickplay_speed; // 0 = Normal playback, negative for rewind
   int mp_epoch;
 
+  /**
+   * Bumped (after the seek event is on mp_eq) each time a seek is
+   * handed to the demuxer. Packets pushed to the data rings by a
+   * producer that had not yet seen the seek are dropped, see
+   * mq_ring_push()
+   */
+  atomic_t mp_ring_seekgen;
+
   struct vdpau_dev *mp_vdpau_dev;
 
   media_track_mgr_t mp_audio_track_mgr;
@@ -541,8 +560,8 @@ static inline void
 mp_check_underrun(media_pipe_t *mp)
 {
   if(mp->mp_flags & MP_PRE_BUFFERING &&
-     unlikely(TAILQ_FIRST(&mp->mp_video.mq_q_data) == NULL) &&
-     unlikely(TAILQ_FIRST(&mp->mp_audio.mq_q_data) == NULL))
+     unlikely(mq_data_empty(&mp->mp_video)) &&
+     unlikely(mq_data_empty(&mp->mp_audio)))
     mp_underrun(mp);
 }
 
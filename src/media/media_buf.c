@@ -17,10 +17,238 @@
  *  This program is also available under a commercial proprietary license.
  *  For more information, contact andreas@lonelycoder.com
  */
+#include <assert.h>
+#include <string.h>
+
 #include "media.h"
 
 #if ENABLE_LIBAV
 
+/**
+ * Recycling allocator for packet payloads
+ *
+ * Payloads are handed out as AVBufferRefs from a number of power-of-two
+ * size classes. When the last reference to a buffer is dropped the
+ * memory is put back on the freelist of its class instead of being
+ * freed. Freelists are emptied when the pipe is flushed and when a
+ * class runs dry while the allocator is at the pipe's buffer limit.
+ *
+ * Anything that doesn't fit (or is too large) gets a buffer of its own,
+ * still accounted in mpa_footprint so the total stays near the limit.
+ *
+ * Buffers may outlive the pipe (decoders can hold on to packets) so the
+ * allocator is refcounted by the pipe and by each outstanding buffer.
+ */
+#define PAYLOAD_MIN_SHIFT 10 // 1 kB
+#define PAYLOAD_CLASSES   11 // .. 1 MB
+
+typedef struct payload_chunk {
+  struct payload_chunk *next;
+} payload_chunk_t;
+
+typedef struct payload_class {
+  struct media_payload_allocator *pc_mpa;
+  payload_chunk_t *pc_free;
+  int pc_size;
+} payload_class_t;
+
+typedef struct media_payload_allocator {
+  hts_mutex_t mpa_mutex;
+  int mpa_refcount;
+  int mpa_closed;
+  unsigned int mpa_footprint; // Bytes allocated (in use + on freelists)
+  payload_class_t mpa_classes[PAYLOAD_CLASSES];
+} media_payload_allocator_t;
+
+
+/**
+ *
+ */
+static media_payload_allocator_t *
+mpa_create(void)
+{
+  media_payload_allocator_t *mpa = calloc(1, sizeof(media_payload_allocator_t));
+  hts_mutex_init(&mpa->mpa_mutex);
+  mpa->mpa_refcount = 1;
+  for(int i = 0; i < PAYLOAD_CLASSES; i++) {
+    mpa->mpa_classes[i].pc_mpa = mpa;
+    mpa->mpa_classes[i].pc_size = 1 << (PAYLOAD_MIN_SHIFT + i);
+  }
+  return mpa;
+}
+
+
+/**
+ * Must be called with mpa_mutex locked, returns with it unlocked
+ */
+static void
+mpa_release_locked(media_payload_allocator_t *mpa)
+{
+  mpa->mpa_refcount--;
+  const int destroy = mpa->mpa_refcount == 0;
+  hts_mutex_unlock(&mpa->mpa_mutex);
+
+  if(!destroy)
+    return;
+
+  assert(mpa->mpa_footprint == 0);
+  hts_mutex_destroy(&mpa->mpa_mutex);
+  free(mpa);
+}
+
+
+/**
+ *
+ */
+static void
+mpa_buffer_free(void *opaque, uint8_t *data)
+{
+  payload_class_t *pc = opaque;
+  media_payload_allocator_t *mpa = pc->pc_mpa;
+
+  hts_mutex_lock(&mpa->mpa_mutex);
+  if(mpa->mpa_closed) {
+    mpa->mpa_footprint -= pc->pc_size;
+    av_free(data);
+  } else {
+    payload_chunk_t *c = (payload_chunk_t *)data;
+    c->next = pc->pc_free;
+    pc->pc_free = c;
+  }
+  mpa_release_locked(mpa);
+}
+
+
+/**
+ * Free buffers from the freelists until 'want' bytes can be allocated
+ * without exceeding 'limit'. A limit of 0 empties all freelists
+ *
+ * Must be called with mpa_mutex locked
+ */
+static void
+mpa_trim_locked(media_payload_allocator_t *mpa, unsigned int want,
+                unsigned int limit)
+{
+  payload_chunk_t *c;
+
+  // Largest classes first, they give back the most memory
+  for(int i = PAYLOAD_CLASSES - 1; i >= 0; i--) {
+    payload_class_t *pc = &mpa->mpa_classes[i];
+    while((c = pc->pc_free) != NULL) {
+      if(mpa->mpa_footprint + want <= limit)
+        return;
+      pc->pc_free = c->next;
+      mpa->mpa_footprint -= pc->pc_size;
+      av_free(c);
+    }
+  }
+}
+
+
+/**
+ * Buffers that don't come from a size class are sized exactly and
+ * freed directly, but still count towards mpa_footprint
+ */
+typedef struct payload_oversize {
+  media_payload_allocator_t *po_mpa;
+  unsigned int po_size;
+} payload_oversize_t;
+
+
+/**
+ *
+ */
+static void
+mpa_oversize_free(void *opaque, uint8_t *data)
+{
+  payload_oversize_t *po = opaque;
+  media_payload_allocator_t *mpa = po->po_mpa;
+
+  hts_mutex_lock(&mpa->mpa_mutex);
+  mpa->mpa_footprint -= po->po_size;
+  av_free(data);
+  free(po);
+  mpa_release_locked(mpa);
+}
+
+
+/**
+ * Returns NULL if memory is exhausted
+ */
+static AVBufferRef *
+mpa_alloc(media_payload_allocator_t *mpa, size_t size, unsigned int limit)
+{
+  payload_class_t *pc = NULL;
+  payload_oversize_t *po = NULL;
+  uint8_t *data = NULL;
+  AVBufferRef *ref;
+
+  for(int i = 0; i < PAYLOAD_CLASSES; i++) {
+    if(mpa->mpa_classes[i].pc_size >= size) {
+      pc = &mpa->mpa_classes[i];
+      break;
+    }
+  }
+
+  hts_mutex_lock(&mpa->mpa_mutex);
+
+  if(pc != NULL && pc->pc_free != NULL) {
+    data = (uint8_t *)pc->pc_free;
+    pc->pc_free = pc->pc_free->next;
+  } else {
+    // Make room by giving back what's idling in other classes
+    if(mpa->mpa_footprint + (pc ? pc->pc_size : size) > limit)
+      mpa_trim_locked(mpa, pc ? pc->pc_size : size, limit);
+
+    if(pc != NULL && mpa->mpa_footprint + pc->pc_size <= limit) {
+      if((data = av_malloc(pc->pc_size)) != NULL)
+        mpa->mpa_footprint += pc->pc_size;
+    } else {
+      pc = NULL;
+      po = malloc(sizeof(payload_oversize_t));
+      if(po != NULL && (data = av_malloc(size)) != NULL) {
+        po->po_mpa = mpa;
+        po->po_size = size;
+        mpa->mpa_footprint += size;
+      }
+    }
+
+    if(data == NULL) {
+      hts_mutex_unlock(&mpa->mpa_mutex);
+      free(po);
+      return NULL;
+    }
+  }
+
+  mpa->mpa_refcount++;
+  hts_mutex_unlock(&mpa->mpa_mutex);
+
+  if(pc != NULL) {
+    ref = av_buffer_create(data, pc->pc_size, mpa_buffer_free, pc, 0);
+    if(ref == NULL)
+      mpa_buffer_free(pc, data);
+  } else {
+    ref = av_buffer_create(data, size, mpa_oversize_free, po, 0);
+    if(ref == NULL)
+      mpa_oversize_free(po, data);
+  }
+  return ref;
+}
+
+
+/**
+ *
+ */
+static void
+mpa_close(media_payload_allocator_t *mpa)
+{
+  hts_mutex_lock(&mpa->mpa_mutex);
+  mpa->mpa_closed = 1;
+  mpa_trim_locked(mpa, 0, 0);
+  mpa_release_locked(mpa);
+}
+
+
 
 /**
  *
@@ -47,7 +275,23 @@ media_buf_alloc_locked(media_pipe_t *mp, size_t size)
 {
   hts_mutex_assert(&mp->mp_mutex);
   media_buf_t *mb = pool_get(mp->mp_mb_pool);
-  av_new_packet(&mb->mb_pkt, size);
+  AVBufferRef *ref;
+
+  if(mp->mp_payload_allocator == NULL)
+    mp->mp_payload_allocator = mpa_create();
+
+  ref = mpa_alloc(mp->mp_payload_allocator,
+                  size + FF_INPUT_BUFFER_PADDING_SIZE, mp->mp_buffer_limit);
+
+  if(ref != NULL) {
+    av_init_packet(&mb->mb_pkt);
+    mb->mb_pkt.buf  = ref;
+    mb->mb_pkt.data = ref->data;
+    mb->mb_pkt.size = size;
+    memset(ref->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+  } else {
+    av_new_packet(&mb->mb_pkt, size);
+  }
   mb->mb_dtor = media_buf_dtor_avpacket;
   return mb;
 }
@@ -90,6 +334,7 @@ void
 copy_mbm_from_mb(media_buf_meta_t *mbm, const media_buf_t *mb)
 {
   mbm->mbm_user_time = mb->mb_user_time;
+  mbm->mbm_enq_time  = mb->mb_enq_time;
   mbm->mbm_pts       = mb->mb_pts;
   mbm->mbm_dts       = mb->mb_dts;
   mbm->mbm_epoch     = mb->mb_epoch;
@@ -100,6 +345,61 @@ copy_mbm_from_mb(media_buf_meta_t *mbm, const media_buf_t *mb)
 
 #endif
 
+
+/**
+ * Bytes currently held by the payload allocator
+ *
+ * Must be called with mp locked
+ */
+unsigned int
+media_buf_payload_footprint(media_pipe_t *mp)
+{
+  unsigned int r = 0;
+#if ENABLE_LIBAV
+  media_payload_allocator_t *mpa = mp->mp_payload_allocator;
+  if(mpa != NULL) {
+    hts_mutex_lock(&mpa->mpa_mutex);
+    r = mpa->mpa_footprint;
+    hts_mutex_unlock(&mpa->mpa_mutex);
+  }
+#endif
+  return r;
+}
+
+
+/**
+ * Give the payload allocator's idle buffers back to the system
+ *
+ * Must be called with mp locked
+ */
+void
+media_buf_payload_trim(media_pipe_t *mp)
+{
+#if ENABLE_LIBAV
+  media_payload_allocator_t *mpa = mp->mp_payload_allocator;
+  if(mpa != NULL) {
+    hts_mutex_lock(&mpa->mpa_mutex);
+    mpa_trim_locked(mpa, 0, 0);
+    hts_mutex_unlock(&mpa->mpa_mutex);
+  }
+#endif
+}
+
+
+/**
+ *
+ */
+void
+media_buf_payload_allocator_release(media_pipe_t *mp)
+{
+#if ENABLE_LIBAV
+  if(mp->mp_payload_allocator != NULL)
+    mpa_close(mp->mp_payload_allocator);
+  mp->mp_payload_allocator = NULL;
+#endif
+}
+
+
 /**
  *
  */
@@ -52,6 +52,7 @@ typedef union media_buf_flags {
  */
 typedef struct media_buf_meta {
   int64_t mbm_user_time;
+  int64_t mbm_enq_time;
   int64_t mbm_pts;
   int64_t mbm_dts;
   int mbm_epoch;
@@ -87,6 +88,8 @@ typedef struct media_buf {
 
   int64_t mb_user_time;
 
+  int64_t mb_enq_time;     // arch_get_ts() when put on a queue
+
   media_buf_flags_t mb_flags;
 
   int mb_epoch;
@@ -170,3 +173,9 @@ media_buf_t *media_buf_from_avpkt_unlocked(struct media_pipe *mp,
                                            struct AVPacket *pkt);
 
 void media_buf_dtor_frame_info(media_buf_t *mb);
+
+unsigned int media_buf_payload_footprint(struct media_pipe *mp);
+
+void media_buf_payload_trim(struct media_pipe *mp);
+
+void media_buf_payload_allocator_release(struct media_pipe *mp);
@@ -61,6 +61,9 @@ media_codec_deref(media_codec_t *cw)
 
   if(cw->fw != NULL)
     media_format_deref(cw->fw);
+
+  // Frames still held by video surfaces keep the pool alive
+  av_buffer_pool_uninit(&cw->frame_pool);
 #endif
 
   free(cw);
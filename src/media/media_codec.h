@@ -55,6 +55,12 @@ typedef struct media_codec {
 
   int (*get_buffer2)(struct AVCodecContext *s, AVFrame *frame, int flags);
 
+  struct AVBufferPool *frame_pool;  // Used by libav_get_buffer_surface()
+  int frame_pool_size;
+
+  int threading_mode;   // MP_LIVE / MP_TRICKPLAY the threads were set up for
+  int threading_locked; // Thread setup must not be changed (VDPAU, etc)
+
 } media_codec_t;
 
 struct AVFormatContext;
@@ -133,6 +133,7 @@ mp_direct_seek(media_pipe_t *mp, int64_t ts)
   prop_set_float_ex(mp->mp_prop_currenttime, mp->mp_sub_currenttime,
 		    ts / 1000000.0);
 
+  mp_drain_rings_locked(mp);
   mp->mp_epoch++;
   mp->mp_seek_base = ts;
 
@@ -151,14 +152,70 @@ mp_direct_seek(media_pipe_t *mp, int64_t ts)
 
     ets = (event_ts_t *)e;
     ets->ts = ts;
+    break;
+  }
+
+  if(e == NULL) {
+    ets = event_create(EVENT_SEEK, sizeof(event_ts_t));
+    ets->ts = ts;
+    mp_event_dispatch(mp, &ets->h);
+  }
+
+  /*
+   * Anything the demuxer has pushed to the data rings since they were
+   * drained above is from before the seek. Must come after the event is
+   * on mp_eq, see mq_ring_push()
+   */
+  __sync_synchronize();
+  atomic_inc(&mp->mp_ring_seekgen);
+}
+
+
+/**
+ * Enter/leave trickplay (fast forward / rewind)
+ */
+#define TRICKPLAY_MAX_SPEED 64
+
+static void
+mp_set_trickplay_locked(media_pipe_t *mp, int speed)
+{
+  event_t *e;
+
+  if(!(mp->mp_flags & MP_CAN_TRICKPLAY))
+    speed = 0;
+
+  speed = MAX(MIN(speed, TRICKPLAY_MAX_SPEED), -TRICKPLAY_MAX_SPEED);
+
+  if(speed == mp->mp_trickplay_speed)
     return;
+
+  mp->mp_trickplay_speed = speed;
+  if(speed)
+    mp->mp_flags |= MP_TRICKPLAY;
+  else
+    mp->mp_flags &= ~MP_TRICKPLAY;
+  prop_set(mp->mp_prop_root, "trickplay", PROP_SET_INT, speed);
+
+  /* If there already is a trickplay event enqueued, update it */
+  TAILQ_FOREACH(e, &mp->mp_eq, e_link) {
+    if(event_is_type(e, EVENT_TRICKPLAY)) {
+      ((event_int_t *)e)->val = speed;
+      return;
+    }
   }
+  mp_event_dispatch(mp, event_create_int(EVENT_TRICKPLAY, speed));
+}
 
-  ets = event_create(EVENT_SEEK, sizeof(event_ts_t));
-  ets->ts = ts;
 
-  e = &ets->h;
-  mp_event_dispatch(mp, e);
+/**
+ *
+ */
+void
+mp_set_trickplay(media_pipe_t *mp, int speed)
+{
+  hts_mutex_lock(&mp->mp_mutex);
+  mp_set_trickplay_locked(mp, speed);
+  hts_mutex_unlock(&mp->mp_mutex);
 }
 
 
@@ -263,7 +320,14 @@ mp_enqueue_event_locked(media_pipe_t *mp, event_t *e)
     }
   }
 
-  if(event_is_action(e, ACTION_PLAYPAUSE ) ||
+  if(mp->mp_trickplay_speed &&
+     (event_is_action(e, ACTION_PLAYPAUSE) ||
+      event_is_action(e, ACTION_PLAY))) {
+
+    // Resume normal playback from where trickplay got us
+    mp_set_trickplay_locked(mp, 0);
+
+  } else if(event_is_action(e, ACTION_PLAYPAUSE ) ||
      event_is_action(e, ACTION_PLAY ) ||
      event_is_action(e, ACTION_PAUSE)) {
 
@@ -289,6 +353,12 @@ mp_enqueue_event_locked(media_pipe_t *mp, event_t *e)
   } else if(event_is_action(e, ACTION_SEEK_FORWARD)) {
     mp_direct_seek(mp, mp->mp_seek_base + 1000000 *
                    video_settings.seek_fwd_step);
+  } else if(event_is_action(e, ACTION_FAST_FORWARD)) {
+    int speed = mp->mp_trickplay_speed;
+    mp_set_trickplay_locked(mp, speed > 0 ? speed * 2 : 2);
+  } else if(event_is_action(e, ACTION_REWIND)) {
+    int speed = mp->mp_trickplay_speed;
+    mp_set_trickplay_locked(mp, speed < 0 ? speed * 2 : -2);
   } else if(event_is_action(e, ACTION_SHUFFLE)) {
     prop_toggle_int(mp->mp_prop_shuffle);
   } else if(event_is_action(e, ACTION_REPEAT)) {
@@ -0,0 +1,145 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+
+#include "prop/prop.h"
+#include "htsmsg/htsmsg.h"
+#include "misc/minmax.h"
+#include "media_latency.h"
+
+
+/**
+ *
+ */
+void
+media_latency_add(media_latency_t *ml, int64_t us)
+{
+  const int64_t a = us < 0 ? -us : us;
+  int b = a < 2 ? 0 : 63 - __builtin_clzll(a);
+
+  ml->ml_buckets[MIN(b, ML_BUCKETS - 1)]++;
+  ml->ml_sum += us;
+  if(a > ml->ml_peak)
+    ml->ml_peak = a;
+}
+
+
+/**
+ *
+ */
+void
+media_latency_reset(media_latency_t *ml)
+{
+  memset(ml, 0, sizeof(media_latency_t));
+}
+
+
+/**
+ * Count is derived from the buckets so a reader racing with the writer
+ * never sees a count that doesn't match the buckets it walks
+ */
+unsigned int
+media_latency_count(const media_latency_t *ml)
+{
+  unsigned int count = 0;
+  for(int i = 0; i < ML_BUCKETS; i++)
+    count += ml->ml_buckets[i];
+  return count;
+}
+
+
+/**
+ * Return upper bound (in µs) of the bucket holding the given percentile
+ * of the absolute values
+ */
+int64_t
+media_latency_percentile(const media_latency_t *ml, int pct)
+{
+  const unsigned int count = media_latency_count(ml);
+  if(count == 0)
+    return 0;
+
+  const uint64_t target = ((uint64_t)count * pct + 99) / 100;
+  uint64_t acc = 0;
+
+  for(int i = 0; i < ML_BUCKETS - 1; i++) {
+    acc += ml->ml_buckets[i];
+    if(acc >= target)
+      return MIN(2LL << i, ml->ml_peak);
+  }
+  return ml->ml_peak;
+}
+
+
+/**
+ * Times are exposed in milliseconds
+ */
+void
+media_latency_update_props(const media_latency_t *ml, prop_t *p)
+{
+  const unsigned int count = media_latency_count(ml);
+
+  prop_set(p, "count", PROP_SET_INT, count);
+
+  if(count == 0) {
+    prop_set(p, "avg",  PROP_SET_VOID);
+    prop_set(p, "p50",  PROP_SET_VOID);
+    prop_set(p, "p95",  PROP_SET_VOID);
+    prop_set(p, "peak", PROP_SET_VOID);
+    return;
+  }
+
+  prop_set(p, "avg",  PROP_SET_FLOAT, ml->ml_sum / 1000.0 / count);
+  prop_set(p, "p50",  PROP_SET_FLOAT,
+           media_latency_percentile(ml, 50) / 1000.0);
+  prop_set(p, "p95",  PROP_SET_FLOAT,
+           media_latency_percentile(ml, 95) / 1000.0);
+  prop_set(p, "peak", PROP_SET_FLOAT, ml->ml_peak / 1000.0);
+}
+
+
+/**
+ * Times are in µs. 'buckets' is trimmed after the last non-empty one
+ */
+htsmsg_t *
+media_latency_to_htsmsg(const media_latency_t *ml)
+{
+  htsmsg_t *m = htsmsg_create_map();
+  const unsigned int count = media_latency_count(ml);
+
+  htsmsg_add_u32(m, "count", count);
+  if(count > 0) {
+    htsmsg_add_s64(m, "avg", ml->ml_sum / count);
+    htsmsg_add_s64(m, "p50", media_latency_percentile(ml, 50));
+    htsmsg_add_s64(m, "p95", media_latency_percentile(ml, 95));
+    htsmsg_add_s64(m, "p99", media_latency_percentile(ml, 99));
+    htsmsg_add_s64(m, "peak", ml->ml_peak);
+  }
+
+  int last = ML_BUCKETS;
+  while(last > 0 && ml->ml_buckets[last - 1] == 0)
+    last--;
+
+  htsmsg_t *b = htsmsg_create_list();
+  for(int i = 0; i < last; i++)
+    htsmsg_add_u32(b, NULL, ml->ml_buckets[i]);
+  htsmsg_add_msg(m, "buckets", b);
+  return m;
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+#include <stdint.h>
+
+struct prop;
+struct htsmsg;
+
+/**
+ * Bucket 0 holds samples below 2µs, bucket n holds [2^n, 2^(n+1)) µs.
+ * The last bucket collects everything above ~16s
+ */
+#define ML_BUCKETS 24
+
+/**
+ * Log2 histogram of a latency (in µs)
+ *
+ * Each histogram has a single writer (the thread running that stage of
+ * the pipeline). Readers (prop updates, the HTTP API) don't lock so they
+ * may see a sample half-way in. That's fine for statistics
+ */
+typedef struct media_latency {
+  uint32_t ml_buckets[ML_BUCKETS];
+  int64_t ml_sum;          // Signed, A/V drift can be negative
+  int64_t ml_peak;         // Largest absolute value seen
+} media_latency_t;
+
+
+void media_latency_add(media_latency_t *ml, int64_t us);
+
+void media_latency_reset(media_latency_t *ml);
+
+unsigned int media_latency_count(const media_latency_t *ml);
+
+int64_t media_latency_percentile(const media_latency_t *ml, int pct);
+
+void media_latency_update_props(const media_latency_t *ml, struct prop *p);
+
+struct htsmsg *media_latency_to_htsmsg(const media_latency_t *ml);
@@ -18,7 +18,10 @@
  *  For more information, contact andreas@lonelycoder.com
  */
 #include <math.h>
+#include <assert.h>
+#include <stdlib.h>
 
+#include "main.h"
 #include "media.h"
 
 #include "misc/minmax.h"
@@ -52,6 +55,7 @@ mq_flush_q(media_pipe_t *mp, media_queue_t *mq, struct media_buf_queue *q,
 static void
 mq_flush_locked(media_pipe_t *mp, media_queue_t *mq, int full)
 {
+  mq_ring_drain_locked(mp, mq);
   mq->mq_last_deq_dts = PTS_UNSET;
   mq_flush_q(mp, mq, &mq->mq_q_data, full);
   mq_flush_q(mp, mq, &mq->mq_q_ctrl, full);
@@ -86,6 +90,7 @@ mp_flush_locked(media_pipe_t *mp, int final)
 
   mq_flush_locked(mp, a, 0);
   mq_flush_locked(mp, v, 0);
+  media_buf_payload_trim(mp);
 
   mp->mp_epoch++;
 
@@ -170,6 +175,8 @@ mq_get_buffer_delay(media_queue_t *mq)
 void
 mp_update_buffer_delay(media_pipe_t *mp)
 {
+  mp_drain_rings_locked(mp);
+
   int vd = mq_get_buffer_delay(&mp->mp_video);
   int ad = mq_get_buffer_delay(&mp->mp_audio);
 
@@ -192,6 +199,148 @@ mp_enqueue_check_pre_buffering(media_pipe_t *mp)
 }
 
 
+/**
+ * Push a data packet to the ring without locking. Fails if anything
+ * needs the attention of the locked path (full buffers, pending events,
+ * pre-buffering, etc)
+ *
+ * The packet is tagged with the seek generation read before looking at
+ * mp_eq. mp_direct_seek() queues the seek event before bumping the
+ * generation, so either we see the event and take the locked path or
+ * the packet carries a stale generation and mq_ring_drain_locked()
+ * throws it away. mb_epoch is overwritten with the real epoch when the
+ * packet is drained
+ *
+ * Must only be called by the producer of the queue
+ */
+static int
+mq_ring_push(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
+{
+  const int seekgen = atomic_get(&mp->mp_ring_seekgen);
+  __sync_synchronize();
+
+  const unsigned int head = atomic_get(&mq->mq_ring_head);
+  const unsigned int size = mb_buffered_size(mb);
+  const unsigned int inflight =
+    atomic_get(&mq->mq_ring_bytes_in) - atomic_get(&mq->mq_ring_bytes_out);
+
+  if(head - (unsigned int)atomic_get(&mq->mq_ring_tail) >= mq->mq_ring_size)
+    return -1;
+
+  if(TAILQ_FIRST(&mp->mp_eq) != NULL ||
+     mp->mp_hold_flags & MP_HOLD_PRE_BUFFERING)
+    return -1;
+
+  if(mp->mp_buffer_delay >= mp->mp_max_realtime_delay ||
+     mp->mp_buffer_current + inflight + size >= mp->mp_buffer_limit)
+    return -1;
+
+  mb->mb_epoch = seekgen;
+  mb->mb_enq_time = arch_get_ts();
+  mq->mq_ring[head & (mq->mq_ring_size - 1)] = mb;
+  atomic_set(&mq->mq_ring_bytes_in, atomic_get(&mq->mq_ring_bytes_in) + size);
+  __sync_synchronize();
+  atomic_set(&mq->mq_ring_head, head + 1);
+  __sync_synchronize();
+
+  /*
+   * If the consumer had drained everything before this packet it might
+   * be sleeping. It always drains the ring (with mp_mutex held) before
+   * waiting so signalling with the lock held can't be lost
+   */
+  if(atomic_get(&mq->mq_ring_tail) == head && !mq->mq_no_data_interest) {
+    hts_mutex_lock(&mp->mp_mutex);
+    hts_cond_signal(&mq->mq_avail);
+    hts_mutex_unlock(&mp->mp_mutex);
+  }
+  return 0;
+}
+
+
+/**
+ * Move packets from the ring over to mq_q_data
+ *
+ * Must be called with mp locked
+ */
+void
+mq_ring_drain_locked(media_pipe_t *mp, media_queue_t *mq)
+{
+  if(mq->mq_ring == NULL)
+    return;
+
+  unsigned int tail = atomic_get(&mq->mq_ring_tail);
+  const unsigned int head = atomic_get(&mq->mq_ring_head);
+
+  if(head == tail)
+    return;
+
+  __sync_synchronize();
+
+  unsigned int bytes = 0;
+  const int seekgen = atomic_get(&mp->mp_ring_seekgen);
+
+  for(; tail != head; tail++) {
+    media_buf_t *mb = mq->mq_ring[tail & (mq->mq_ring_size - 1)];
+    const unsigned int size = mb_buffered_size(mb);
+
+    bytes += size;
+
+    if(mb->mb_epoch != seekgen) {
+      // Demuxed before the producer saw a pending seek
+      media_buf_free_locked(mp, mb);
+      continue;
+    }
+
+    // Any other epoch change drains the rings first, so this is current
+    mb->mb_epoch = mp->mp_epoch;
+    TAILQ_INSERT_TAIL(&mq->mq_q_data, mb, mb_link);
+    mq->mq_packets_current++;
+    mp->mp_buffer_current += size;
+  }
+
+  atomic_set(&mq->mq_ring_bytes_out, atomic_get(&mq->mq_ring_bytes_out) + bytes);
+  __sync_synchronize();
+  atomic_set(&mq->mq_ring_tail, tail);
+  __sync_synchronize();
+}
+
+
+/**
+ * Must be called with mp locked
+ */
+void
+mp_drain_rings_locked(media_pipe_t *mp)
+{
+  mq_ring_drain_locked(mp, &mp->mp_video);
+  mq_ring_drain_locked(mp, &mp->mp_audio);
+}
+
+
+/**
+ * Enable (size > 0, must be a power of two) or disable (size == 0) the
+ * lockless data ring of a queue. Must be called from the thread that
+ * enqueues data on the queue
+ */
+void
+mq_ring_enable(media_pipe_t *mp, media_queue_t *mq, int size)
+{
+  media_buf_t **ring = NULL, **old;
+
+  assert((size & (size - 1)) == 0);
+
+  if(size)
+    ring = malloc(size * sizeof(media_buf_t *));
+
+  hts_mutex_lock(&mp->mp_mutex);
+  mq_ring_drain_locked(mp, mq);
+  old = mq->mq_ring;
+  mq->mq_ring = ring;
+  mq->mq_ring_size = size;
+  hts_mutex_unlock(&mp->mp_mutex);
+  free(old);
+}
+
+
 /**
  *
  */
@@ -200,6 +349,11 @@ mb_enqueue_with_events(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
 {
   event_t *e = NULL;
 
+  if(mq->mq_ring != NULL &&
+     mb->mb_data_type < MB_CTRL && mb->mb_data_type != MB_SUBTITLE &&
+     !mq_ring_push(mp, mq, mb))
+    return NULL;
+
   hts_mutex_lock(&mp->mp_mutex);
 #if 0
   printf("ENQ %s %d %d/%d %d/%d\n",
@@ -292,6 +446,7 @@ mb_enqueue_no_block(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb,
   mq->mq_packets_current++;
   mp->mp_buffer_current += mb_buffered_size(mb);
   mb->mb_epoch = mp->mp_epoch;
+  mb->mb_enq_time = arch_get_ts();
   mq_update_stats(mp, mq, 0);
   hts_cond_signal(&mq->mq_avail);
 
@@ -312,6 +467,49 @@ mb_enqueue_always(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
 }
 
 
+/**
+ *
+ */
+static void
+mq_update_latency_props(media_pipe_t *mp, media_queue_t *mq)
+{
+  prop_t *p = mq->mq_prop_latency;
+
+  media_latency_update_props(&mq->mq_latency_queue,  prop_create(p, "queue"));
+  media_latency_update_props(&mq->mq_latency_decode, prop_create(p, "decode"));
+  media_latency_update_props(&mq->mq_latency_output, prop_create(p, "output"));
+  media_latency_update_props(&mq->mq_latency_total,  prop_create(p, "total"));
+
+  if(mq == &mp->mp_video)
+    media_latency_update_props(&mp->mp_latency_avdrift, mp->mp_prop_avdrift);
+}
+
+
+/**
+ * Called by the decoder thread when a data packet is taken off the queue
+ */
+void
+mq_latency_dequeued(media_queue_t *mq, const media_buf_t *mb)
+{
+  if(mb->mb_data_type < MB_CTRL && mb->mb_enq_time)
+    media_latency_add(&mq->mq_latency_queue, arch_get_ts() - mb->mb_enq_time);
+}
+
+
+/**
+ *
+ */
+void
+mq_latency_reset(media_queue_t *mq)
+{
+  media_latency_reset(&mq->mq_latency_queue);
+  media_latency_reset(&mq->mq_latency_decode);
+  media_latency_reset(&mq->mq_latency_output);
+  media_latency_reset(&mq->mq_latency_total);
+  mq->mq_latency_next_update = 0;
+}
+
+
 /**
  *
  */
@@ -343,10 +541,17 @@ mq_update_stats(media_pipe_t *mp, media_queue_t *mq, int force)
 
   prop_set_int(mq->mq_prop_qlen_cur, mq->mq_packets_current);
   prop_set_int(mp->mp_prop_buffer_current, mp->mp_buffer_current);
+  prop_set_int(mp->mp_prop_buffer_pool, media_buf_payload_footprint(mp));
   if(mp->mp_buffer_delay == INT32_MAX)
     prop_set_void(mp->mp_prop_buffer_delay);
   else
     prop_set_float(mp->mp_prop_buffer_delay, mp->mp_buffer_delay / 1000000.0);
+
+  const int64_t now = arch_get_ts();
+  if(now >= mq->mq_latency_next_update) {
+    mq->mq_latency_next_update = now + 1000000;
+    mq_update_latency_props(mp, mq);
+  }
 }
 
 
@@ -378,6 +583,8 @@ mq_init(media_queue_t *mq, prop_t *p, hts_mutex_t *mutex, media_pipe_t *mp)
 
   mq->mq_prop_codec       = prop_create(p, "codec");
   mq->mq_prop_too_slow    = prop_create(p, "too_slow");
+  mq->mq_prop_threading   = prop_create(p, "threading");
+  mq->mq_prop_latency     = prop_create(p, "latency");
 }
 
 
@@ -387,6 +594,7 @@ mq_init(media_queue_t *mq, prop_t *p, hts_mutex_t *mutex, media_pipe_t *mp)
 void
 mq_destroy(media_queue_t *mq)
 {
+  free(mq->mq_ring);
   hts_cond_destroy(&mq->mq_avail);
 }
 
@@ -402,8 +610,8 @@ mp_wait_for_empty_queues(media_pipe_t *mp)
 
   // Only wait for data queues to drain, aux (subtitles) might be stalled
   while((e = TAILQ_FIRST(&mp->mp_eq)) == NULL &&
-	(TAILQ_FIRST(&mp->mp_audio.mq_q_data) != NULL ||
-         TAILQ_FIRST(&mp->mp_video.mq_q_data) != NULL))
+	(!mq_data_empty(&mp->mp_audio) ||
+         !mq_data_empty(&mp->mp_video)))
     hts_cond_wait(&mp->mp_backpressure, &mp->mp_mutex);
 
   if(e != NULL)
@@ -536,11 +744,14 @@ mb_enq(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
   } else if(mb->mb_data_type > MB_CTRL) {
     TAILQ_INSERT_TAIL(&mq->mq_q_ctrl, mb, mb_link);
   } else {
+    // Keep packets in order with what the producer left in the ring
+    mq_ring_drain_locked(mp, mq);
     TAILQ_INSERT_TAIL(&mq->mq_q_data, mb, mb_link);
     do_signal = !mq->mq_no_data_interest;
   }
   mq->mq_packets_current++;
   mb->mb_epoch = mp->mp_epoch;
+  mb->mb_enq_time = arch_get_ts();
   mp->mp_buffer_current += mb_buffered_size(mb);
 
   mq_update_stats(mp, mq, 0);
@@ -41,6 +41,21 @@ typedef struct media_queue {
   struct media_buf_queue mq_q_ctrl;
   struct media_buf_queue mq_q_aux;
 
+  /**
+   * Optional single-producer/single-consumer ring for data packets,
+   * see mq_ring_enable(). The demuxer pushes into the ring without
+   * taking mp_mutex. Packets are moved over to mq_q_data (and accounted
+   * for) by mq_ring_drain_locked() which anyone holding mp_mutex may
+   * call. head and bytes_in are only written by the producer, tail and
+   * bytes_out only by the consumer
+   */
+  struct media_buf **mq_ring;
+  unsigned int mq_ring_size;          /* Power of two */
+  atomic_t mq_ring_head;
+  atomic_t mq_ring_tail;
+  atomic_t mq_ring_bytes_in;
+  atomic_t mq_ring_bytes_out;
+
   unsigned int mq_packets_current;    /* Packets currently in queue */
 
   int mq_stream;             /* Stream id, or -1 if queue is inactive */
@@ -70,6 +85,23 @@ typedef struct media_queue {
 
   prop_t *mq_prop_too_slow;
 
+  prop_t *mq_prop_threading;
+
+  /**
+   * Per-stage latency, see media_latency.h
+   *
+   *  queue:  Enqueued by demuxer -> dequeued by decoder
+   *  decode: Time spent in the decoder
+   *  output: Time spent handing a frame / samples over to the output
+   *  total:  Enqueued by demuxer -> delivered to output (video only)
+   */
+  media_latency_t mq_latency_queue;
+  media_latency_t mq_latency_decode;
+  media_latency_t mq_latency_output;
+  media_latency_t mq_latency_total;
+  int64_t mq_latency_next_update;
+  prop_t *mq_prop_latency;
+
   struct media_pipe *mq_mp;
 
   // Copies to avoid updating codec user facing info too often
@@ -130,4 +162,27 @@ void mq_destroy(media_queue_t *mq);
 
 void mq_update_stats(struct media_pipe *mp, media_queue_t *mq, int force);
 
+void mq_latency_dequeued(media_queue_t *mq, const media_buf_t *mb);
+
+void mq_latency_reset(media_queue_t *mq);
+
+#define MQ_RING_DEFAULT_SIZE 256
+
+void mq_ring_enable(struct media_pipe *mp, media_queue_t *mq, int size);
+
+void mq_ring_drain_locked(struct media_pipe *mp, media_queue_t *mq);
+
+void mp_drain_rings_locked(struct media_pipe *mp);
+
+/**
+ * Return true if there are no data packets queued, including packets
+ * still in the ring
+ */
+static __inline int
+mq_data_empty(const media_queue_t *mq)
+{
+  return TAILQ_FIRST(&mq->mq_q_data) == NULL &&
+    atomic_get(&mq->mq_ring_head) == atomic_get(&mq->mq_ring_tail);
+}
+
 void mp_update_buffer_delay(struct media_pipe *mp);
@@ -253,22 +253,23 @@ metadata_to_proptree(const metadata_t *md, prop_t *proproot,
 {
   metadata_stream_t *ms;
   int ac = 0, vc = 0, sc = 0, *pc;
+  prop_batch_t *pb = prop_batch_create();
 
   if(md->md_title != NULL)
-    prop_set(proproot, "title", PROP_SET_RSTRING, md->md_title);
+    prop_batch_set(pb, proproot, "title", PROP_SET_RSTRING, md->md_title);
 
   if(md->md_artist) {
-    prop_set(proproot, "artist", PROP_SET_RSTRING, md->md_artist);
+    prop_batch_set(pb, proproot, "artist", PROP_SET_RSTRING, md->md_artist);
 
     metadata_bind_artistpics(prop_create(proproot, "artist_images"),
 			     md->md_artist);
   }
 
   if(md->md_icons != NULL)
-    prop_set(proproot, "icon", PROP_SET_RSTRING, md->md_icons->v[0]);
+    prop_batch_set(pb, proproot, "icon", PROP_SET_RSTRING, md->md_icons->v[0]);
 
   if(md->md_album) {
-    prop_set(proproot, "album", PROP_SET_RSTRING, md->md_album);
+    prop_batch_set(pb, proproot, "album", PROP_SET_RSTRING, md->md_album);
 
     if(md->md_artist != NULL)
       metadata_bind_albumart(prop_create(proproot, "album_art"),
@@ -308,31 +309,36 @@ metadata_to_proptree(const metadata_t *md, prop_t *proproot,
   }
 
   if(md->md_format != NULL)
-    prop_set(proproot, "format", PROP_SET_RSTRING, md->md_format);
+    prop_batch_set(pb, proproot, "format", PROP_SET_RSTRING, md->md_format);
 
   if(md->md_duration)
-    prop_set(proproot, "duration", PROP_SET_FLOAT, md->md_duration);
+    prop_batch_set(pb, proproot, "duration", PROP_SET_FLOAT, md->md_duration);
 
   if(md->md_tracks)
-    prop_set(proproot, "tracks", PROP_SET_INT, md->md_tracks);
+    prop_batch_set(pb, proproot, "tracks", PROP_SET_INT, md->md_tracks);
 
   if(md->md_track)
-    prop_set(proproot, "track", PROP_SET_INT, md->md_track);
+    prop_batch_set(pb, proproot, "track", PROP_SET_INT, md->md_track);
 
   if(md->md_time)
-    prop_set(proproot, "timestamp", PROP_SET_INT, md->md_time);
+    prop_batch_set(pb, proproot, "timestamp", PROP_SET_INT, md->md_time);
 
   if(md->md_manufacturer != NULL)
-    prop_set(proproot, "manufacturer", PROP_SET_RSTRING, md->md_manufacturer);
+    prop_batch_set(pb, proproot, "manufacturer", PROP_SET_RSTRING,
+                   md->md_manufacturer);
 
   if(md->md_equipment != NULL)
-    prop_set(proproot, "equipment", PROP_SET_RSTRING, md->md_equipment);
+    prop_batch_set(pb, proproot, "equipment", PROP_SET_RSTRING,
+                   md->md_equipment);
 
   if(md->md_tagline != NULL)
-    prop_set(proproot, "tagline", PROP_SET_RSTRING, md->md_tagline);
+    prop_batch_set(pb, proproot, "tagline", PROP_SET_RSTRING, md->md_tagline);
 
   if(md->md_description != NULL)
-    prop_set(proproot, "description", PROP_SET_RSTRING, md->md_description);
+    prop_batch_set(pb, proproot, "description", PROP_SET_RSTRING,
+                   md->md_description);
+
+  prop_batch_commit(pb);
 }
 
 
@@ -24,22 +24,129 @@
 #include "callout.h"
 #include "arch/arch.h"
 
-static LIST_HEAD(, callout) callouts;
+/**
+ * Armed callouts are kept in a binary min-heap ordered by deadline.
+ * Each callout knows its own index so disarm and rearm are O(log n)
+ */
+static callout_t **callout_heap;
+static unsigned int callout_heap_size;
+static unsigned int callout_heap_capacity;
 
 static hts_mutex_t callout_mutex;
 static hts_cond_t callout_cond;
 
+
+/**
+ *
+ */
+static void
+callout_heap_set(unsigned int i, callout_t *c)
+{
+  callout_heap[i] = c;
+  c->c_heap_index = i;
+}
+
+
+/**
+ *
+ */
+static void
+callout_heap_up(unsigned int i)
+{
+  callout_t *c = callout_heap[i];
+
+  while(i > 0) {
+    unsigned int parent = (i - 1) / 2;
+    if(callout_heap[parent]->c_deadline <= c->c_deadline)
+      break;
+    callout_heap_set(i, callout_heap[parent]);
+    i = parent;
+  }
+  callout_heap_set(i, c);
+}
+
+
+/**
+ *
+ */
+static void
+callout_heap_down(unsigned int i)
+{
+  callout_t *c = callout_heap[i];
+
+  while(1) {
+    unsigned int child = i * 2 + 1;
+    if(child >= callout_heap_size)
+      break;
+    if(child + 1 < callout_heap_size &&
+       callout_heap[child + 1]->c_deadline < callout_heap[child]->c_deadline)
+      child++;
+    if(c->c_deadline <= callout_heap[child]->c_deadline)
+      break;
+    callout_heap_set(i, callout_heap[child]);
+    i = child;
+  }
+  callout_heap_set(i, c);
+}
+
+
+/**
+ *
+ */
+static void
+callout_heap_insert(callout_t *c)
+{
+  if(callout_heap_size == callout_heap_capacity) {
+    callout_heap_capacity = callout_heap_capacity * 2 ?: 64;
+    callout_heap = realloc(callout_heap,
+                           callout_heap_capacity * sizeof(callout_t *));
+  }
+  callout_heap_set(callout_heap_size++, c);
+  callout_heap_up(c->c_heap_index);
+}
+
+
+/**
+ *
+ */
+static void
+callout_heap_remove(callout_t *c)
+{
+  unsigned int i = c->c_heap_index;
+  callout_t *last = callout_heap[--callout_heap_size];
+
+  if(last == c)
+    return;
+
+  callout_heap_set(i, last);
+  if(i > 0 && callout_heap[(i - 1) / 2]->c_deadline > last->c_deadline)
+    callout_heap_up(i);
+  else
+    callout_heap_down(i);
+}
+
+
 /**
- *htsmsg_t *props
+ * Called after c_deadline has been changed
  */
-static int
-calloutcmp(callout_t *a, callout_t *b)
+static void
+callout_heap_update(callout_t *c)
 {
-  if(a->c_deadline < b->c_deadline)
-    return -1;
-  else if(a->c_deadline > b->c_deadline)
-    return 1;
- return 0;
+  unsigned int i = c->c_heap_index;
+  if(i > 0 && callout_heap[(i - 1) / 2]->c_deadline > c->c_deadline)
+    callout_heap_up(i);
+  else
+    callout_heap_down(i);
+}
+
+
+/**
+ *
+ */
+static callout_t *
+callout_heap_first(void)
+{
+  return callout_heap_size ? callout_heap[0] : NULL;
 }
 
 
@@ -59,7 +166,7 @@ callout_arm0(callout_t *d, callout_callback_t *callback, void *opaque,
   } else {
 
     if(d->c_callback != NULL) {
-      LIST_REMOVE(d, c_link);
+      callout_heap_remove(d);
     } else {
       retain = lockmgr;
     }
@@ -72,8 +179,11 @@ callout_arm0(callout_t *d, callout_callback_t *callback, void *opaque,
   d->c_armed_by_file = file;
   d->c_armed_by_line = line;
   d->c_lockmgr = lockmgr;
-  LIST_INSERT_SORTED(&callouts, d, c_link, calloutcmp, callout_t);
-  hts_cond_signal(&callout_cond);
+  callout_heap_insert(d);
+
+  // Only need to wake up callout thread if we are the new head
+  if(d->c_heap_index == 0)
+    hts_cond_signal(&callout_cond);
   hts_mutex_unlock(&callout_mutex);
   if(retain)
     retain(opaque, LOCKMGR_RETAIN);
@@ -126,8 +236,9 @@ callout_rearm(callout_t *d, int64_t delta)
   if(d->c_callback != NULL) {
     d->c_deadline += delta - d->c_delta;
     d->c_delta = delta;
-    LIST_REMOVE(d, c_link);
-    LIST_INSERT_SORTED(&callouts, d, c_link, calloutcmp, callout_t);
+    callout_heap_update(d);
+    if(d->c_heap_index == 0)
+      hts_cond_signal(&callout_cond);
   }
 
   hts_mutex_unlock(&callout_mutex);
@@ -144,7 +255,7 @@ callout_disarm(callout_t *c)
   lockmgr_fn_t *lm;
   if(c->c_callback) {
     lm = c->c_lockmgr;
-    LIST_REMOVE(c, c_link);
+    callout_heap_remove(c);
     c->c_callback = NULL;
   } else {
     lm = NULL;
@@ -171,9 +282,9 @@ callout_loop(void *aux)
 
     now = arch_get_ts();
 
-    while((c = LIST_FIRST(&callouts)) != NULL && c->c_deadline <= now) {
+    while((c = callout_heap_first()) != NULL && c->c_deadline <= now) {
       cc = c->c_callback;
-      LIST_REMOVE(c, c_link);
+      callout_heap_remove(c);
       c->c_callback = NULL;
       lockmgr_fn_t *lm = c->c_lockmgr;
       const char *file = c->c_armed_by_file;
@@ -199,7 +310,7 @@ callout_loop(void *aux)
       now = ts;
     }
 
-    if((c = LIST_FIRST(&callouts)) != NULL) {
+    if((c = callout_heap_first()) != NULL) {
 
       int timeout = (c->c_deadline - now + 999) / 1000;
       hts_cond_wait_timeout(&callout_cond, &callout_mutex, timeout);
@@ -27,7 +27,7 @@ struct callout;
 typedef void (callout_callback_t)(struct callout *c, void *opaque);
 
 typedef struct callout {
-  LIST_ENTRY(callout) c_link;
+  unsigned int c_heap_index;  // Position in callout heap, valid when armed
   callout_callback_t *c_callback;
   lockmgr_fn_t *c_lockmgr;
   void *c_opaque;
@@ -67,3 +67,5 @@ void callout_init(void);
 void callout_update_clock_props(void);
 
 #define callout_isarmed(c) ((c)->c_callback != NULL)
+
+void callout_benchmark(void);
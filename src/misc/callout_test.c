@@ -0,0 +1,149 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "callout.h"
+#include "queue.h"
+
+/**
+ * Microbenchmark of arm/rearm/disarm. The callout heap is measured via
+ * the public API and compared with a sorted list, which is what the
+ * callout subsystem used to be built on.
+ *
+ * All deadlines are far into the future so nothing fires while running
+ */
+
+#define BENCH_MIN_DELTA 10000000LL  // µs
+
+typedef struct bench_item {
+  LIST_ENTRY(bench_item) bi_link;
+  int64_t bi_deadline;
+} bench_item_t;
+
+static int
+bench_item_cmp(bench_item_t *a, bench_item_t *b)
+{
+  if(a->bi_deadline < b->bi_deadline)
+    return -1;
+  return a->bi_deadline > b->bi_deadline;
+}
+
+
+static void
+bench_nop(struct callout *c, void *opaque)
+{
+}
+
+
+/**
+ *
+ */
+static int64_t
+bench_heap(int num, const int64_t *deltas)
+{
+  callout_t *c = calloc(num, sizeof(callout_t));
+  int64_t ts = arch_get_ts();
+  int i;
+
+  for(i = 0; i < num; i++)
+    callout_arm_hires(&c[i], bench_nop, NULL, deltas[i]);
+
+  for(i = 0; i < num; i++)
+    callout_arm_hires(&c[i], bench_nop, NULL, deltas[num - i - 1]);
+
+  for(i = 0; i < num; i++)
+    callout_disarm(&c[i]);
+
+  ts = arch_get_ts() - ts;
+  free(c);
+  return ts;
+}
+
+
+/**
+ *
+ */
+static int64_t
+bench_list(int num, const int64_t *deltas)
+{
+  LIST_HEAD(, bench_item) list;
+  bench_item_t *bi = calloc(num, sizeof(bench_item_t));
+  hts_mutex_t mutex;
+  int64_t ts;
+  int i;
+
+  hts_mutex_init(&mutex);
+  LIST_INIT(&list);
+  ts = arch_get_ts();
+
+  for(i = 0; i < num; i++) {
+    hts_mutex_lock(&mutex);
+    bi[i].bi_deadline = arch_get_ts() + deltas[i];
+    LIST_INSERT_SORTED(&list, &bi[i], bi_link, bench_item_cmp, bench_item_t);
+    hts_mutex_unlock(&mutex);
+  }
+
+  for(i = 0; i < num; i++) {
+    hts_mutex_lock(&mutex);
+    LIST_REMOVE(&bi[i], bi_link);
+    bi[i].bi_deadline = arch_get_ts() + deltas[num - i - 1];
+    LIST_INSERT_SORTED(&list, &bi[i], bi_link, bench_item_cmp, bench_item_t);
+    hts_mutex_unlock(&mutex);
+  }
+
+  for(i = 0; i < num; i++) {
+    hts_mutex_lock(&mutex);
+    LIST_REMOVE(&bi[i], bi_link);
+    hts_mutex_unlock(&mutex);
+  }
+
+  ts = arch_get_ts() - ts;
+  hts_mutex_destroy(&mutex);
+  free(bi);
+  return ts;
+}
+
+
+/**
+ *
+ */
+void
+callout_benchmark(void)
+{
+  int num, i;
+
+  printf("%8s %14s %14s\n", "Callouts", "Heap ns/op", "List ns/op");
+
+  for(num = 16; num <= 16384; num *= 4) {
+    int64_t *deltas = malloc(num * sizeof(int64_t));
+
+    for(i = 0; i < num; i++)
+      deltas[i] = BENCH_MIN_DELTA + (rand() % 60000) * 1000LL;
+
+    int64_t heap = bench_heap(num, deltas);
+    int64_t list = bench_list(num, deltas);
+
+    printf("%8d %14.1f %14.1f\n", num,
+           heap * 1000.0 / (num * 3), list * 1000.0 / (num * 3));
+    free(deltas);
+  }
+}
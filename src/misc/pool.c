@@ -27,6 +27,7 @@
 #include "queue.h"
 #include "main.h"
 #include "pool.h"
+#include "htsmsg/htsbuf.h"
 
 #if ENABLE_BUGHUNT
 #define POOL_BY_MALLOC
@@ -57,6 +58,40 @@ typedef struct pool_item {
 } pool_item_t;
 
 
+/**
+ * Per-thread cache of free items. pm_items/pm_count are only touched by
+ * the owning thread (and by pool_destroy() when no one else may use the
+ * pool). The counters are read racily for statistics
+ */
+typedef struct pool_magazine {
+  LIST_ENTRY(pool_magazine) pm_link;
+  pool_t *pm_pool;
+  pool_item_t *pm_items;
+  int pm_count;
+  int pm_hits;
+  int pm_misses;
+} pool_magazine_t;
+
+
+/**
+ * Number of items moved between a magazine and the shared free list in
+ * one go. A magazine holds at most twice this many items
+ */
+#define POOL_MAGAZINE_BATCH 32
+
+#if ENABLE_EMU_THREAD_SPECIFICS
+// Emulated thread specifics take a global lock on every access
+#define POOL_USE_MAGAZINES 0
+#else
+#define POOL_USE_MAGAZINES 1
+#endif
+
+LIST_HEAD(pool_list, pool);
+
+static struct pool_list pools;
+static HTS_MUTEX_DECL(pools_mutex);
+
+
 /**
  *
  */
@@ -99,11 +134,191 @@ pool_segment_create(pool_t *p)
     prev = pi;
   }
   LIST_INSERT_HEAD(&p->p_segments, ps, ps_link);
+  p->p_num_segments++;
   assert(pi != NULL);
   p->p_item = pi;
 }
 
 
+/**
+ *
+ */
+static void
+pool_account(pool_t *p, int delta)
+{
+  p->p_num_out += delta;
+  if(p->p_num_out > p->p_peak_out)
+    p->p_peak_out = p->p_num_out;
+}
+
+
+/**
+ * Take an item from the shared free list
+ */
+static pool_item_t * attribute_unused
+pool_item_get(pool_t *p)
+{
+  pool_item_t *pi = p->p_item;
+  if(pi == NULL) {
+    pool_segment_create(p);
+    pi = p->p_item;
+  }
+  p->p_item = pi->link;
+  return pi;
+}
+
+
+/**
+ * Return an item to the shared free list
+ */
+static void attribute_unused
+pool_item_put(pool_t *p, pool_item_t *pi)
+{
+  pi->link = p->p_item;
+  p->p_item = pi;
+}
+
+
+#if POOL_USE_MAGAZINES
+
+/**
+ * Spill all items back to the shared free list. Called with p_mutex held
+ */
+static void
+pool_magazine_drain(pool_t *p, pool_magazine_t *pm)
+{
+  pool_item_t *pi;
+
+  while((pi = pm->pm_items) != NULL) {
+    pm->pm_items = pi->link;
+    pool_item_put(p, pi);
+  }
+  p->p_num_out -= pm->pm_count;
+  pm->pm_count = 0;
+
+  p->p_mag_hits   += pm->pm_hits;
+  p->p_mag_misses += pm->pm_misses;
+  pm->pm_hits = 0;
+  pm->pm_misses = 0;
+}
+
+
+/**
+ * Thread specific destructor, invoked when a thread exits
+ */
+static void
+pool_magazine_destroy(void *aux)
+{
+  pool_magazine_t *pm = aux;
+  pool_t *p = pm->pm_pool;
+
+  hts_mutex_lock(&p->p_mutex);
+  pool_magazine_drain(p, pm);
+  LIST_REMOVE(pm, pm_link);
+  hts_mutex_unlock(&p->p_mutex);
+  free(pm);
+}
+
+
+/**
+ *
+ */
+static pool_magazine_t *
+pool_magazine_get(pool_t *p)
+{
+  pool_magazine_t *pm = hts_thread_get_specific(p->p_magazine_key);
+
+  if(pm == NULL) {
+    pm = calloc(1, sizeof(pool_magazine_t));
+    pm->pm_pool = p;
+    hts_mutex_lock(&p->p_mutex);
+    LIST_INSERT_HEAD(&p->p_magazines, pm, pm_link);
+    hts_mutex_unlock(&p->p_mutex);
+    hts_thread_set_specific(p->p_magazine_key, pm);
+  }
+  return pm;
+}
+
+
+/**
+ *
+ */
+static pool_item_t *
+pool_magazine_alloc(pool_t *p)
+{
+  pool_magazine_t *pm = pool_magazine_get(p);
+  pool_item_t *pi;
+  int i;
+
+  if(pm->pm_items != NULL) {
+    pm->pm_hits++;
+  } else {
+    pm->pm_misses++;
+    hts_mutex_lock(&p->p_mutex);
+    for(i = 0; i < POOL_MAGAZINE_BATCH; i++) {
+      pi = pool_item_get(p);
+      pi->link = pm->pm_items;
+      pm->pm_items = pi;
+    }
+    pm->pm_count += POOL_MAGAZINE_BATCH;
+    pool_account(p, POOL_MAGAZINE_BATCH);
+    hts_mutex_unlock(&p->p_mutex);
+  }
+
+  pi = pm->pm_items;
+  pm->pm_items = pi->link;
+  pm->pm_count--;
+  return pi;
+}
+
+
+/**
+ *
+ */
+static void
+pool_magazine_free(pool_t *p, pool_item_t *pi)
+{
+  pool_magazine_t *pm = pool_magazine_get(p);
+  int i;
+
+  pi->link = pm->pm_items;
+  pm->pm_items = pi;
+  pm->pm_count++;
+
+  if(pm->pm_count < 2 * POOL_MAGAZINE_BATCH) {
+    pm->pm_hits++;
+    return;
+  }
+
+  pm->pm_misses++;
+  hts_mutex_lock(&p->p_mutex);
+  for(i = 0; i < POOL_MAGAZINE_BATCH; i++) {
+    pi = pm->pm_items;
+    pm->pm_items = pi->link;
+    pool_item_put(p, pi);
+  }
+  pm->pm_count -= POOL_MAGAZINE_BATCH;
+  p->p_num_out -= POOL_MAGAZINE_BATCH;
+  hts_mutex_unlock(&p->p_mutex);
+}
+
+#endif
+
+
+/**
+ * Account for an item that does not pass through a magazine
+ */
+static void attribute_unused
+pool_account_shared(pool_t *p, int delta)
+{
+  if(p->p_flags & POOL_MAGAZINES)
+    hts_mutex_lock(&p->p_mutex);
+  pool_account(p, delta);
+  if(p->p_flags & POOL_MAGAZINES)
+    hts_mutex_unlock(&p->p_mutex);
+}
+
+
 /**
  *
  */
@@ -121,6 +336,17 @@ pool_init(pool_t *p, const char *name, size_t item_size, int flags)
 
   p->p_item_size = item_size;
   p->p_flags = flags;
+
+  if(flags & POOL_MAGAZINES) {
+    hts_mutex_init(&p->p_mutex);
+#if POOL_USE_MAGAZINES
+    hts_thread_key_create(&p->p_magazine_key, pool_magazine_destroy);
+#endif
+  }
+
+  hts_mutex_lock(&pools_mutex);
+  LIST_INSERT_HEAD(&pools, p, p_link);
+  hts_mutex_unlock(&pools_mutex);
 }
 
 
@@ -138,6 +364,28 @@ pool_create(const char *name, size_t item_size, int flags)
 
 
 #ifdef POOL_DEBUG
+/**
+ *
+ */
+static void
+mark_item(pool_t *p, pool_item_t *pi)
+{
+  pool_segment_t *ps;
+
+  LIST_FOREACH(ps, &p->p_segments, ps_link) {
+    size_t off = (void *)pi - ps->ps_addr;
+
+    if(off < ps->ps_avail_size) {
+      off /= p->p_item_size;
+      ps->ps_mark[off] = 0;
+      return;
+    }
+  }
+  TRACE(TRACE_ERROR, "POOL", "%s: Item %p is not part of pool segment",
+        p->p_name, pi);
+}
+
+
 /**
  *
  */
@@ -152,21 +400,15 @@ mark_segments(pool_t *p)
     memset(ps->ps_mark, 0xff, ps->ps_avail_size / p->p_item_size);
   }
 
-  for(pi = p->p_item; pi != NULL; pi = pi->link) {
-    LIST_FOREACH(ps, &p->p_segments, ps_link) {
-      size_t off = (void *)pi - ps->ps_addr;
+  for(pi = p->p_item; pi != NULL; pi = pi->link)
+    mark_item(p, pi);
 
-      if(off < ps->ps_avail_size) {
-        off /= p->p_item_size;
-        ps->ps_mark[off] = 0;
-        break;
-      }
-    }
-    if(ps == NULL) {
-      TRACE(TRACE_ERROR, "POOL", "%s: Item %p is not part of pool segment",
-            p->p_name, pi);
-    }
-  }
+#if POOL_USE_MAGAZINES
+  pool_magazine_t *pm;
+  LIST_FOREACH(pm, &p->p_magazines, pm_link)
+    for(pi = pm->pm_items; pi != NULL; pi = pi->link)
+      mark_item(p, pi);
+#endif
 }
 
 static void
@@ -189,6 +431,24 @@ pool_destroy(pool_t *p)
 {
   pool_segment_t *ps;
 
+  hts_mutex_lock(&pools_mutex);
+  LIST_REMOVE(p, p_link);
+  hts_mutex_unlock(&pools_mutex);
+
+#if POOL_USE_MAGAZINES
+  if(p->p_flags & POOL_MAGAZINES) {
+    pool_magazine_t *pm;
+
+    // No one may use the pool now, so we can safely steal all magazines
+    while((pm = LIST_FIRST(&p->p_magazines)) != NULL) {
+      pool_magazine_drain(p, pm);
+      LIST_REMOVE(pm, pm_link);
+      free(pm);
+    }
+    hts_thread_key_delete(p->p_magazine_key);
+  }
+#endif
+
 #ifdef POOL_DEBUG
   if(1) {
 
@@ -225,6 +485,9 @@ pool_destroy(pool_t *p)
     TRACE(TRACE_INFO, "pool", "Destroying pool '%s', %d items out",
 	  p->p_name, p->p_num_out);
 
+  if(p->p_flags & POOL_MAGAZINES)
+    hts_mutex_destroy(&p->p_mutex);
+
   free(p);
 }
 
@@ -242,24 +505,33 @@ pool_get_ex(pool_t *p, const char *file, int line)
 pool_get(pool_t *p)
 #endif
 {
-  p->p_num_out++;
 #if defined(POOL_BY_MMAP)
+  pool_account_shared(p, 1);
   return mmap(NULL, p->p_item_size_req, PROT_WRITE | PROT_READ,
               MAP_ANON | MAP_PRIVATE, -1, 0);
 
 #elif defined(POOL_BY_MALLOC)
+  pool_account_shared(p, 1);
   if(p->p_flags & POOL_ZERO_MEM)
     return calloc(1, p->p_item_size_req);
   else
     return malloc(p->p_item_size_req);
 #else
-  pool_item_t *pi = p->p_item;
-  if(pi == NULL) {
-    pool_segment_create(p);
-    pi = p->p_item;
-  }
-  p->p_item = pi->link;
+  pool_item_t *pi;
 
+  if(p->p_flags & POOL_MAGAZINES) {
+#if POOL_USE_MAGAZINES
+    pi = pool_magazine_alloc(p);
+#else
+    hts_mutex_lock(&p->p_mutex);
+    pi = pool_item_get(p);
+    pool_account(p, 1);
+    hts_mutex_unlock(&p->p_mutex);
+#endif
+  } else {
+    pi = pool_item_get(p);
+    pool_account(p, 1);
+  }
 
   if(p->p_flags & POOL_ZERO_MEM)
     memset(pi, 0, p->p_item_size);
@@ -291,8 +563,10 @@ pool_put(pool_t *p, void *ptr)
   madvise(ptr, p->p_item_size_req, MADV_DONTNEED);
 #endif
   mprotect(ptr, p->p_item_size_req, PROT_NONE);
+  pool_account_shared(p, -1);
 #elif defined(POOL_BY_MALLOC)
   free(ptr);
+  pool_account_shared(p, -1);
 #else
 
 #ifdef POOL_DEBUG
@@ -303,6 +577,10 @@ pool_put(pool_t *p, void *ptr)
 
 #ifdef POOL_DEBUG
   pool_segment_t *ps;
+
+  if(p->p_flags & POOL_MAGAZINES)
+    hts_mutex_lock(&p->p_mutex);
+
   LIST_FOREACH(ps, &p->p_segments, ps_link)
     if((uintptr_t)pi >= (uintptr_t)ps->ps_addr &&
        (uintptr_t)pi < (uintptr_t)ps->ps_addr + ps->ps_avail_size)
@@ -319,15 +597,117 @@ pool_put(pool_t *p, void *ptr)
     abort();
   }
 
+  if(p->p_flags & POOL_MAGAZINES)
+    hts_mutex_unlock(&p->p_mutex);
+
   assert(ps != NULL);
 
   memset(pi, 0xff, p->p_item_size);
 #endif
 
-  pi->link = p->p_item;
-  p->p_item = pi;
+  if(p->p_flags & POOL_MAGAZINES) {
+#if POOL_USE_MAGAZINES
+    pool_magazine_free(p, pi);
+#else
+    hts_mutex_lock(&p->p_mutex);
+    pool_item_put(p, pi);
+    pool_account(p, -1);
+    hts_mutex_unlock(&p->p_mutex);
+#endif
+  } else {
+    pool_item_put(p, pi);
+    pool_account(p, -1);
+  }
+#endif
+}
+
+
+/**
+ * For pools without POOL_MAGAZINES the numbers are read without the
+ * owner's lock held, so they might be slightly off
+ */
+void
+pool_get_stats(pool_t *p, pool_stats_t *ps)
+{
+  ps->ps_name      = p->p_name;
+  ps->ps_item_size = p->p_item_size_req;
+
+  if(!(p->p_flags & POOL_MAGAZINES)) {
+    ps->ps_live      = p->p_num_out;
+    ps->ps_peak      = p->p_peak_out;
+    ps->ps_segments  = p->p_num_segments;
+    ps->ps_mag_hits   = 0;
+    ps->ps_mag_misses = 0;
+    return;
+  }
+
+  hts_mutex_lock(&p->p_mutex);
+  ps->ps_live       = p->p_num_out;
+  ps->ps_peak       = p->p_peak_out;
+  ps->ps_segments   = p->p_num_segments;
+  ps->ps_mag_hits   = p->p_mag_hits;
+  ps->ps_mag_misses = p->p_mag_misses;
+
+#if POOL_USE_MAGAZINES
+  // Items cached in magazines are not live
+  pool_magazine_t *pm;
+  LIST_FOREACH(pm, &p->p_magazines, pm_link) {
+    ps->ps_live       -= pm->pm_count;
+    ps->ps_mag_hits   += pm->pm_hits;
+    ps->ps_mag_misses += pm->pm_misses;
+  }
 #endif
-  p->p_num_out--;
+  hts_mutex_unlock(&p->p_mutex);
+}
+
+
+/**
+ *
+ */
+void
+pool_stats_foreach(void (*fn)(const pool_stats_t *ps, void *opaque),
+                   void *opaque)
+{
+  pool_stats_t ps;
+  pool_t *p;
+
+  hts_mutex_lock(&pools_mutex);
+  LIST_FOREACH(p, &pools, p_link) {
+    pool_get_stats(p, &ps);
+    fn(&ps, opaque);
+  }
+  hts_mutex_unlock(&pools_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+pool_stats_print_one(const pool_stats_t *ps, void *opaque)
+{
+  htsbuf_queue_t *hq = opaque;
+  int64_t total = ps->ps_mag_hits + ps->ps_mag_misses;
+
+  htsbuf_qprintf(hq, "%-20s %6zu %8d %8d %4d",
+                 ps->ps_name, ps->ps_item_size, ps->ps_live, ps->ps_peak,
+                 ps->ps_segments);
+  if(total)
+    htsbuf_qprintf(hq, " %5.1f%%\n", 100.0 * ps->ps_mag_hits / total);
+  else
+    htsbuf_qprintf(hq, "      -\n");
+}
+
+
+/**
+ *
+ */
+void
+pool_stats_print(htsbuf_queue_t *hq)
+{
+  htsbuf_qprintf(hq, "%-20s %6s %8s %8s %4s %6s\n",
+                 "Pool", "Size", "Live", "Peak", "Segs", "MagHit");
+  pool_stats_foreach(pool_stats_print_one, hq);
 }
 
 
@@ -337,7 +717,9 @@ pool_put(pool_t *p, void *ptr)
 int
 pool_num(pool_t *p)
 {
-  return p->p_num_out;
+  pool_stats_t ps;
+  pool_get_stats(p, &ps);
+  return ps.ps_live;
 }
 
 
@@ -350,6 +732,9 @@ pool_foreach(pool_t *p, void (*fn)(void *ptr, void *opaque), void *opaque)
 {
   pool_segment_t *ps;
 
+  if(p->p_flags & POOL_MAGAZINES)
+    hts_mutex_lock(&p->p_mutex);
+
   mark_segments(p);
 
   LIST_FOREACH(ps, &p->p_segments, ps_link) {
@@ -363,5 +748,8 @@ pool_foreach(pool_t *p, void (*fn)(void *ptr, void *opaque), void *opaque)
   }
 
   unmark_segments(p);
+
+  if(p->p_flags & POOL_MAGAZINES)
+    hts_mutex_unlock(&p->p_mutex);
 }
 #endif
@@ -27,6 +27,7 @@
 #endif
 
 LIST_HEAD(pool_segment_list, pool_segment);
+LIST_HEAD(pool_magazine_list, pool_magazine);
 
 
 /**
@@ -44,11 +45,43 @@ typedef struct pool {
 
   int p_num_out;
   const char *p_name;
+
+  int p_num_segments;
+  int p_peak_out;
+
+  LIST_ENTRY(pool) p_link;
+
+  // POOL_MAGAZINES only
+  struct pool_magazine_list p_magazines;
+  hts_key_t p_magazine_key;
+  int64_t p_mag_hits;      // Accumulated from destroyed magazines
+  int64_t p_mag_misses;
 } pool_t;
 
 
 #define POOL_ZERO_MEM  0x2
 
+/**
+ * Pool is thread safe and keeps a small per-thread cache (magazine) of
+ * free items. Only a magazine refill or spill touches p_mutex
+ *
+ * Each such pool owns a thread specific key, so only use this for pools
+ * that live as long as the process (prop, notify, ...). Short lived pools
+ * would churn keys and leave per-thread magazines pointing to a dead pool
+ */
+#define POOL_MAGAZINES 0x4
+
+
+typedef struct pool_stats {
+  const char *ps_name;
+  size_t ps_item_size;
+  int ps_live;
+  int ps_peak;
+  int ps_segments;
+  int64_t ps_mag_hits;
+  int64_t ps_mag_misses;
+} pool_stats_t;
+
 pool_t *pool_create(const char *name, size_t item_size, int flags);
 
 void pool_init(pool_t *pool, const char *name, size_t item_size, int flags);
@@ -72,6 +105,14 @@ void pool_destroy(pool_t *p);
 
 int pool_num(pool_t *p);
 
+void pool_get_stats(pool_t *p, pool_stats_t *ps);
+
+void pool_stats_foreach(void (*fn)(const pool_stats_t *ps, void *opaque),
+                        void *opaque);
+
+struct htsbuf_queue;
+void pool_stats_print(struct htsbuf_queue *hq);
+
 #ifdef POOL_DEBUG
 void pool_foreach(pool_t *p, void (*fn)(void *ptr, void *opaque), void *opaque);
 #endif
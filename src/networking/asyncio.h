@@ -24,6 +24,7 @@
 
 typedef struct asyncio_timer {
   LIST_ENTRY(asyncio_timer) at_link;
+  struct asyncio_reactor *at_reactor;
   int64_t at_expire;
   void (*at_fn)(void *opaque);
   void *at_opaque;
@@ -51,6 +52,28 @@ void asyncio_suspend(void);
 
 void asyncio_resume(void);
 
+/*************************************************************************
+ * Reactors
+ *
+ * Each reactor is an event loop thread (see --asyncio-reactors).
+ * fds, timers and DNS requests are bound to the reactor of the thread
+ * that created them and must only be touched from that thread.
+ *
+ * Reactor 0 is the main asyncio thread. It runs asyncio_courier,
+ * workers, asyncio_run_task() and network change callbacks, so code
+ * that is not written to run elsewhere stays there
+ *************************************************************************/
+
+int asyncio_num_reactors(void);
+
+// Reactor of calling thread, -1 if not called from a reactor
+int asyncio_current_reactor(void);
+
+// Suggest a reactor for new self contained work
+int asyncio_pick_reactor(void);
+
+void asyncio_run_task_on(int reactor, void (*fn)(void *aux), void *aux);
+
 
 /*************************************************************************
  * Non portable API for direct manipulation of fds
@@ -71,6 +94,15 @@ asyncio_fd_t *asyncio_add_fd(int fd, int events,
 
 void asyncio_del_fd(asyncio_fd_t *af);
 
+/**
+ * Select epoll (when available) or poll() for waiting on fds. epoll is
+ * the default. Returns 1 if epoll is in use after the call.
+ * Must be called on the asyncio thread
+ */
+int asyncio_use_epoll(int on);
+
+void asyncio_benchmark(void);
+
 void asyncio_run_task(void (*fn)(void *aux), void *aux);
 
 // Return current time, must be same time domain as arch_get_ts();
@@ -141,6 +141,46 @@ asyncio_run_task(void (*fn)(void *aux), void *aux)
 }
 
 
+/**
+ * There is only one message loop on this platform
+ */
+void
+asyncio_run_task_on(int reactor, void (*fn)(void *aux), void *aux)
+{
+  asyncio_run_task(fn, aux);
+}
+
+
+/**
+ *
+ */
+int
+asyncio_num_reactors(void)
+{
+  return 1;
+}
+
+
+/**
+ *
+ */
+int
+asyncio_current_reactor(void)
+{
+  return 0;
+}
+
+
+/**
+ *
+ */
+int
+asyncio_pick_reactor(void)
+{
+  return 0;
+}
+
+
 /**
  *
  */
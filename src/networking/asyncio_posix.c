@@ -24,8 +24,16 @@
 #include <unistd.h>
 #include <poll.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define ASYNCIO_EPOLL 1
+#else
+#define ASYNCIO_EPOLL 0
+#endif
+
 #include "main.h"
 #include "arch/arch.h"
 #include "arch/threads.h"
@@ -60,33 +68,59 @@ LIST_HEAD(asyncio_timer_list, asyncio_timer);
 TAILQ_HEAD(asyncio_dns_req_queue, asyncio_dns_req);
 TAILQ_HEAD(asyncio_task_queue, asyncio_task);
 
-static hts_thread_t asyncio_thread_id;
+#if ASYNCIO_EPOLL
+#define ASYNCIO_EPOLL_MAX_EVENTS 64
+#endif
+
+#define ASYNCIO_MAX_REACTORS 16
+
+/**
+ * An event loop thread. fds, timers and DNS requests are bound to the
+ * reactor they were created on.
+ *
+ * Reactor 0 is the classic asyncio thread. It is the only one running
+ * the prop courier, workers and network change callbacks
+ */
+typedef struct asyncio_reactor {
+  int ar_id;
+  hts_thread_t ar_thread;
+  char ar_name[16];
+
+  int ar_pipe[2];
+  struct asyncio_fd_list ar_fds;
+  int ar_num_fds;
 
-static struct asyncio_timer_list asyncio_timers;
+  struct asyncio_timer_list ar_timers;
+  int64_t ar_now;
+
+  hts_mutex_t ar_task_mutex;
+  struct asyncio_task_queue ar_tasks;
+
+#if ASYNCIO_EPOLL
+  int ar_epfd;
+  int ar_force_poll;
+  struct asyncio_fd_list ar_attention_fds;
+#endif
+} asyncio_reactor_t;
+
+static asyncio_reactor_t asyncio_reactors[ASYNCIO_MAX_REACTORS];
+static int asyncio_reactor_count = 1;
+static atomic_t asyncio_reactor_rr;
 
 static hts_mutex_t asyncio_worker_mutex;
 static struct asyncio_worker_list asyncio_workers;
 
-static int asyncio_pipe[2];
-static struct asyncio_fd_list asyncio_fds;
-static int asyncio_num_fds;
-
 struct prop_courier *asyncio_courier;
 
 static hts_mutex_t asyncio_dns_mutex;
-static int asyncio_dns_worker;
 static struct asyncio_dns_req_queue asyncio_dns_pending;
-static struct asyncio_dns_req_queue asyncio_dns_completed;
 
-static hts_mutex_t asyncio_task_mutex;
-static struct asyncio_task_queue asyncio_tasks;
-
-static void adr_deliver_cb(void);
-
-static int64_t async_now;
+static __inline void asyncio_verify_reactor(const asyncio_reactor_t *ar) {
+  assert(hts_thread_current() == ar->ar_thread);
+}
 
 static __inline void asyncio_verify_thread(void) {
-  assert(hts_thread_current() == asyncio_thread_id);
+  asyncio_verify_reactor(&asyncio_reactors[0]);
 }
 
 /**
@@ -105,6 +139,7 @@ typedef struct asyncio_worker {
  */
 struct asyncio_fd {
   LIST_ENTRY(asyncio_fd) af_link;
+  asyncio_reactor_t *af_reactor;
   asyncio_fd_callback_t *af_callback;
   void *af_opaque;
   char *af_name;
@@ -140,6 +175,18 @@ struct asyncio_fd {
   int af_bind_any : 1;
   int af_broadcast : 1;
 
+#if ASYNCIO_EPOLL
+  /**
+   * fds with a timeout, a pending error or SSL (whose events must be
+   * recomputed every round) are linked here. Everything else only
+   * touches the epoll set when its events change
+   */
+  LIST_ENTRY(asyncio_fd) af_attention_link;
+  int af_attention;
+  int af_epoll_fd;       // fd as registered with epoll, -1 if not registered
+  int af_epoll_events;
+#endif
+
 #if ENABLE_OPENSSL
   int af_ssl_read_status;
   int af_ssl_write_status;
@@ -162,13 +209,32 @@ typedef struct asyncio_task {
 
 
 
+/**
+ *
+ */
+/**
+ * Return the reactor of the calling thread, NULL if it's not a reactor
+ */
+static asyncio_reactor_t *
+asyncio_reactor_self(void)
+{
+  hts_thread_t self = hts_thread_current();
+
+  for(int i = 0; i < asyncio_reactor_count; i++)
+    if(asyncio_reactors[i].ar_thread == self)
+      return &asyncio_reactors[i];
+  return NULL;
+}
+
+
 /**
  *
  */
 int64_t
 async_current_time(void)
 {
-  return async_now;
+  asyncio_reactor_t *ar = asyncio_reactor_self();
+  return (ar ?: &asyncio_reactors[0])->ar_now;
 }
 
 
@@ -235,10 +301,10 @@ net_remote_addr_from_fd(net_addr_t *na, int fd)
  *
  */
 static void
-asyncio_wakeup(int id)
+asyncio_wakeup(asyncio_reactor_t *ar, int id)
 {
   char x = id;
-  int r = write(asyncio_pipe[1], &x, 1);
+  int r = write(ar->ar_pipe[1], &x, 1);
 
   if(r != 1)
     TRACE(TRACE_ERROR, "TCP", "Pipe problems r=%d errno=%d", r, errno);
@@ -250,7 +316,7 @@ asyncio_wakeup(int id)
 static void
 asyncio_courier_notify(void *opaque)
 {
-  asyncio_wakeup(0);
+  asyncio_wakeup(&asyncio_reactors[0], 0);
 }
 
 
@@ -260,7 +326,7 @@ asyncio_courier_notify(void *opaque)
 void
 asyncio_wakeup_worker(int id)
 {
-  return asyncio_wakeup(id);
+  return asyncio_wakeup(&asyncio_reactors[0], id);
 }
 
 
@@ -295,12 +361,17 @@ at_compar(const asyncio_timer_t *a, const asyncio_timer_t *b)
 void
 asyncio_timer_arm(asyncio_timer_t *at, int64_t expire)
 {
-  asyncio_verify_thread();
-  if(at->at_expire)
+  asyncio_reactor_t *ar = asyncio_reactor_self();
+  assert(ar != NULL);
+
+  if(at->at_expire) {
+    assert(at->at_reactor == ar);
     LIST_REMOVE(at, at_link);
+  }
 
+  at->at_reactor = ar;
   at->at_expire = expire;
-  LIST_INSERT_SORTED(&asyncio_timers, at, at_link, at_compar, asyncio_timer_t);
+  LIST_INSERT_SORTED(&ar->ar_timers, at, at_link, at_compar, asyncio_timer_t);
 }
 
 
@@ -310,7 +381,7 @@ asyncio_timer_arm(asyncio_timer_t *at, int64_t expire)
 void
 asyncio_timer_arm_delta_sec(asyncio_timer_t *at, int delta)
 {
-  asyncio_timer_arm(at, async_now + delta * 1000000LL);
+  asyncio_timer_arm(at, async_current_time() + delta * 1000000LL);
 }
 
 
@@ -320,8 +391,8 @@ asyncio_timer_arm_delta_sec(asyncio_timer_t *at, int delta)
 void
 asyncio_timer_disarm(asyncio_timer_t *at)
 {
-  asyncio_verify_thread();
   if(at->at_expire) {
+    asyncio_verify_reactor(at->at_reactor);
     LIST_REMOVE(at, at_link);
     at->at_expire = 0;
   }
@@ -334,7 +405,7 @@ asyncio_timer_disarm(asyncio_timer_t *at)
 static void
 af_release(asyncio_fd_t *af)
 {
-  asyncio_verify_thread();
+  asyncio_verify_reactor(af->af_reactor);
   af->af_refcount--;
   if(af->af_refcount > 0)
     return;
@@ -364,41 +435,214 @@ events_to_poll(int events)
     (events & ASYNCIO_ERROR ? (POLLHUP|POLLERR) : 0);
 }
 
+/**
+ * Put fd on the list of fds that must be inspected every round even
+ * if the kernel has nothing to report for it
+ */
+static void
+asyncio_fd_attention(asyncio_fd_t *af)
+{
+#if ASYNCIO_EPOLL
+  if(af->af_attention)
+    return;
+  af->af_attention = 1;
+  LIST_INSERT_HEAD(&af->af_reactor->ar_attention_fds, af, af_attention_link);
+#endif
+}
+
+
+#if ASYNCIO_EPOLL
+
+/**
+ *
+ */
+static int
+poll_to_epoll(int events)
+{
+  return
+    (events & POLLIN  ? EPOLLIN  : 0) |
+    (events & POLLOUT ? EPOLLOUT : 0) |
+    (events & POLLHUP ? EPOLLHUP : 0) |
+    (events & POLLERR ? EPOLLERR : 0);
+}
+
+
 /**
  *
  */
+static int
+epoll_to_poll(int events)
+{
+  return
+    (events & EPOLLIN  ? POLLIN  : 0) |
+    (events & EPOLLOUT ? POLLOUT : 0) |
+    (events & EPOLLHUP ? POLLHUP : 0) |
+    (events & EPOLLERR ? POLLERR : 0);
+}
+
+
+/**
+ * Bring the epoll registration of the fd in sync with af_fd and the
+ * given poll events. Only issues a syscall if something changed
+ */
 static void
-asyncio_dopoll(void)
+asyncio_epoll_set(asyncio_fd_t *af, int events)
 {
-  asyncio_timer_t *at;
+  struct epoll_event ev = {0};
+  const int epfd = af->af_reactor->ar_epfd;
 
-  while((at = LIST_FIRST(&asyncio_timers)) != NULL &&
-        at->at_expire <= async_now) {
-    LIST_REMOVE(at, at_link);
-    at->at_expire = 0;
-    at->at_fn(at->at_opaque);
+  if(epfd == -1)
+    return;
+
+  events = poll_to_epoll(events);
+
+  if(af->af_epoll_fd != af->af_fd) {
+
+    if(af->af_epoll_fd != -1)
+      epoll_ctl(epfd, EPOLL_CTL_DEL, af->af_epoll_fd, &ev);
+    af->af_epoll_fd = -1;
+
+    if(af->af_fd == -1)
+      return;
+
+  } else if(af->af_epoll_fd != -1 && af->af_epoll_events == events) {
+    return;
   }
 
+  ev.events = events;
+  ev.data.ptr = af;
+
+  int op = af->af_epoll_fd == -1 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+  if(epoll_ctl(epfd, op, af->af_fd, &ev)) {
+    // The fd number may have been recycled behind our back
+    op = errno == EEXIST ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    if((errno != EEXIST && errno != ENOENT) ||
+       epoll_ctl(epfd, op, af->af_fd, &ev)) {
+      TRACE(TRACE_ERROR, "ASYNCIO", "epoll_ctl failed for %s 0x%x -- %s",
+            af->af_name, af->af_fd, strerror(errno));
+      af->af_epoll_fd = -1;
+      return;
+    }
+  }
+  af->af_epoll_fd = af->af_fd;
+  af->af_epoll_events = events;
+}
+
+#endif
+
+
+/**
+ * Close the fd of an asyncio_fd but keep the asyncio_fd itself around
+ */
+static void
+asyncio_close_fd(asyncio_fd_t *af)
+{
+  if(af->af_fd == -1)
+    return;
+#if ASYNCIO_EPOLL
+  if(af->af_epoll_fd != -1) {
+    struct epoll_event ev = {0};
+    epoll_ctl(af->af_reactor->ar_epfd, EPOLL_CTL_DEL, af->af_epoll_fd, &ev);
+    af->af_epoll_fd = -1;
+  }
+#endif
+  close(af->af_fd);
+  af->af_fd = -1;
+}
+
+
+/**
+ * Compute poll timeout (in ms) given the closest fd timeout
+ */
+static int
+asyncio_poll_timeout(const asyncio_reactor_t *ar, int timeout)
+{
+  const asyncio_timer_t *at = LIST_FIRST(&ar->ar_timers);
+  if(at != NULL)
+    timeout = MIN(timeout, (at->at_expire - ar->ar_now + 999) / 1000);
+
+  return timeout == INT32_MAX ? -1 : timeout;
+}
+
+
+/**
+ * Deliver poll style revents to an fd
+ */
+static void
+asyncio_dispatch(asyncio_fd_t *af, int revents, int poll_error)
+{
+  if(af->af_callback == NULL)
+    return;
+
+  if(revents & POLLHUP) {
+    af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, ECONNRESET);
+    return;
+  }
+
+  if(revents & POLLERR || poll_error) {
+    int err;
+    socklen_t errlen = sizeof(int);
+
+    if(getsockopt(af->af_fd, SOL_SOCKET, SO_ERROR, (void *)&err, &errlen)) {
+      TRACE(TRACE_ERROR, "ASYNCIO", "getsockopt failed for %s 0x%x -- %s",
+            af->af_name, af->af_fd, strerror(errno));
+      af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, ENOBUFS);
+    } else {
+      if(err) {
+        af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, err);
+        return;
+      }
+    }
+  }
+
+  const int events =
+    (revents & POLLIN  ? ASYNCIO_READ  : 0) |
+    (revents & POLLOUT ? ASYNCIO_WRITE : 0);
+
+  if(events)
+    af->af_callback(af, af->af_opaque, events, 0);
+
+  if(0) {
+    asyncio_reactor_t *ar = af->af_reactor;
+    int64_t now = arch_get_ts();
+
+    if(now - ar->ar_now > 10000) {
+      TRACE(TRACE_ERROR, "ASYNCIO", "Long callback on socktet %s (%d µs)",
+            af->af_name, (int) (now - ar->ar_now));
+    }
+    ar->ar_now = now;
+  }
+}
+
+
+/**
+ * Fallback backend. Rebuilds the pollfd array from all fds every round
+ */
+static void
+asyncio_dopoll_poll(asyncio_reactor_t *ar)
+{
   asyncio_fd_t *af;
-  struct pollfd *fds = alloca(asyncio_num_fds * sizeof(struct pollfd));
-  asyncio_fd_t **afds  = alloca(asyncio_num_fds * sizeof(asyncio_fd_t *));
+  struct pollfd *fds = alloca(ar->ar_num_fds * sizeof(struct pollfd));
+  asyncio_fd_t **afds  = alloca(ar->ar_num_fds * sizeof(asyncio_fd_t *));
   int n = 0;
 
   int timeout = INT32_MAX;
 
-  LIST_FOREACH(af, &asyncio_fds, af_link) {
+  LIST_FOREACH(af, &ar->ar_fds, af_link) {
     if(af->af_pending_errno) {
       af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, af->af_pending_errno);
       goto release;
     }
 
     if(af->af_timeout) {
-      if(af->af_timeout <= async_now) {
+      if(af->af_timeout <= ar->ar_now) {
         af->af_timeout = 0;
         af->af_callback(af, af->af_opaque, ASYNCIO_TIMEOUT, 0);
         goto release;
       }
-      timeout = MIN(timeout, (af->af_timeout - async_now + 999) / 1000);
+      timeout = MIN(timeout, (af->af_timeout - ar->ar_now + 999) / 1000);
     }
 
     if(af->af_fd == -1) {
@@ -421,67 +665,129 @@ asyncio_dopoll(void)
     n++;
   }
 
-  if((at = LIST_FIRST(&asyncio_timers)) != NULL)
-    timeout = MIN(timeout, (at->at_expire - async_now + 999) / 1000);
+  int err = poll(fds, n, asyncio_poll_timeout(ar, timeout));
 
-  if(timeout == INT32_MAX)
-    timeout = -1;
+  ar->ar_now = arch_get_ts();
 
-  int err = poll(fds, n, timeout);
+  for(int i = 0; i < n; i++)
+    asyncio_dispatch(afds[i], fds[i].revents, err < 0);
 
-  async_now = arch_get_ts();
+ release:
 
-  for(int i = 0; i < n; i++) {
-    af = afds[i];
+  for(int i = 0; i < n; i++)
+    af_release(afds[i]);
+}
 
-    if(af->af_callback == NULL)
-      continue;
 
-    if(fds[i].revents & POLLHUP) {
-      af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, ECONNRESET);
-      continue;
-    }
+#if ASYNCIO_EPOLL
+/**
+ * epoll backend. Registrations are persistent so idle fds cost nothing.
+ * Only fds on the attention list are looked at before waiting
+ */
+static void
+asyncio_dopoll_epoll(asyncio_reactor_t *ar)
+{
+  struct epoll_event evs[ASYNCIO_EPOLL_MAX_EVENTS];
+  asyncio_fd_t *afds[ASYNCIO_EPOLL_MAX_EVENTS];
+  asyncio_fd_t *af, *next;
+  int timeout = INT32_MAX;
 
-    if(fds[i].revents & POLLERR || err < 0) {
-      int err;
-      socklen_t errlen = sizeof(int);
+  for(af = LIST_FIRST(&ar->ar_attention_fds); af != NULL; af = next) {
+    next = LIST_NEXT(af, af_attention_link);
 
-      if(getsockopt(af->af_fd, SOL_SOCKET, SO_ERROR, (void *)&err, &errlen)) {
-        TRACE(TRACE_ERROR, "ASYNCIO", "getsockopt failed for %s 0x%x -- %s",
-              af->af_name, af->af_fd, strerror(errno));
-        af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, ENOBUFS);
-      } else {
-        if(err) {
-          af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, err);
-          continue;
-        }
+    if(af->af_pending_errno) {
+      af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, af->af_pending_errno);
+      return;
+    }
+
+    if(af->af_timeout) {
+      if(af->af_timeout <= ar->ar_now) {
+        af->af_timeout = 0;
+        af->af_callback(af, af->af_opaque, ASYNCIO_TIMEOUT, 0);
+        return;
       }
+      timeout = MIN(timeout, (af->af_timeout - ar->ar_now + 999) / 1000);
     }
 
-    const int events =
-      (fds[i].revents & POLLIN  ? ASYNCIO_READ  : 0) |
-      (fds[i].revents & POLLOUT ? ASYNCIO_WRITE : 0);
+#if ENABLE_OPENSSL
+    if(af->af_ssl != NULL) {
+      asyncio_epoll_set(af, asyncio_ssl_events(af));
+      continue;
+    }
+#endif
 
-    if(events)
-      af->af_callback(af, af->af_opaque, events, 0);
+    if(!af->af_timeout) {
+      LIST_REMOVE(af, af_attention_link);
+      af->af_attention = 0;
+    }
+  }
 
-    if(0) {
-      int64_t now = arch_get_ts();
+  int n = epoll_wait(ar->ar_epfd, evs, ASYNCIO_EPOLL_MAX_EVENTS,
+                     asyncio_poll_timeout(ar, timeout));
 
-      if(now - async_now > 10000) {
-        TRACE(TRACE_ERROR, "ASYNCIO", "Long callback on socktet %s (%d µs)",
-              af->af_name, (int) (now - async_now));
-      }
-      async_now = now;
-    }
+  ar->ar_now = arch_get_ts();
+
+  if(n < 0) {
+    if(errno != EINTR)
+      TRACE(TRACE_ERROR, "ASYNCIO", "epoll_wait failed -- %s",
+            strerror(errno));
+    return;
   }
 
+  for(int i = 0; i < n; i++) {
+    afds[i] = evs[i].data.ptr;
+    afds[i]->af_refcount++;
+  }
 
- release:
+  for(int i = 0; i < n; i++)
+    asyncio_dispatch(afds[i], epoll_to_poll(evs[i].events), 0);
 
   for(int i = 0; i < n; i++)
     af_release(afds[i]);
 }
+#endif
+
+
+/**
+ *
+ */
+static void
+asyncio_dopoll(asyncio_reactor_t *ar)
+{
+  asyncio_timer_t *at;
+
+  while((at = LIST_FIRST(&ar->ar_timers)) != NULL &&
+        at->at_expire <= ar->ar_now) {
+    LIST_REMOVE(at, at_link);
+    at->at_expire = 0;
+    at->at_fn(at->at_opaque);
+  }
+
+#if ASYNCIO_EPOLL
+  if(ar->ar_epfd != -1 && !ar->ar_force_poll) {
+    asyncio_dopoll_epoll(ar);
+    return;
+  }
+#endif
+  asyncio_dopoll_poll(ar);
+}
+
+
+/**
+ *
+ */
+int
+asyncio_use_epoll(int on)
+{
+#if ASYNCIO_EPOLL
+  asyncio_reactor_t *ar = asyncio_reactor_self();
+  assert(ar != NULL);
+  ar->ar_force_poll = !on;
+  return ar->ar_epfd != -1 && !ar->ar_force_poll;
+#else
+  return 0;
+#endif
+}
 
 
 /**
@@ -490,10 +796,20 @@ asyncio_dopoll(void)
 static void
 asyncio_set_events(asyncio_fd_t *af, int events)
 {
-  asyncio_verify_thread();
+  asyncio_verify_reactor(af->af_reactor);
   af->af_ext_events = events;
 
   af->af_poll_events = events_to_poll(events);
+
+#if ASYNCIO_EPOLL
+#if ENABLE_OPENSSL
+  // SSL fds are synced from the attention list as their
+  // events depend on the state of the SSL session
+  if(af->af_ssl != NULL)
+    return;
+#endif
+  asyncio_epoll_set(af, af->af_poll_events);
+#endif
 }
 
 
@@ -524,12 +840,17 @@ asyncio_fd_t *
 asyncio_add_fd(int fd, int events, asyncio_fd_callback_t *cb, void *opaque,
 	       const char *name)
 {
-  asyncio_verify_thread();
+  asyncio_reactor_t *ar = asyncio_reactor_self();
+  assert(ar != NULL);
   asyncio_fd_t *af = calloc(1, sizeof(asyncio_fd_t));
   htsbuf_queue_init(&af->af_recvq, INT32_MAX);
   htsbuf_queue_init(&af->af_sendq, INT32_MAX);
+  af->af_reactor = ar;
   af->af_refcount = 1;
   af->af_fd = fd;
+#if ASYNCIO_EPOLL
+  af->af_epoll_fd = -1;
+#endif
   af->af_name = strdup(name);
   asyncio_set_events(af, events);
   af->af_callback = cb;
@@ -537,8 +858,8 @@ asyncio_add_fd(int fd, int events, asyncio_fd_callback_t *cb, void *opaque,
 
   net_change_nonblocking(fd, 1);
 
-  LIST_INSERT_HEAD(&asyncio_fds, af, af_link);
-  asyncio_num_fds++;
+  LIST_INSERT_HEAD(&ar->ar_fds, af, af_link);
+  ar->ar_num_fds++;
   return af;
 }
 
@@ -549,7 +870,7 @@ asyncio_add_fd(int fd, int events, asyncio_fd_callback_t *cb, void *opaque,
 void
 asyncio_del_fd(asyncio_fd_t *af)
 {
-  asyncio_verify_thread();
+  asyncio_verify_reactor(af->af_reactor);
 
 #if ENABLE_OPENSSL
   if(af->af_ssl != NULL) {
@@ -559,11 +880,15 @@ asyncio_del_fd(asyncio_fd_t *af)
   }
 #endif
 
-  if(af->af_fd != -1)
-    close(af->af_fd);
-  af->af_fd = -1;
+  asyncio_close_fd(af);
+#if ASYNCIO_EPOLL
+  if(af->af_attention) {
+    LIST_REMOVE(af, af_attention_link);
+    af->af_attention = 0;
+  }
+#endif
   LIST_REMOVE(af, af_link);
-  asyncio_num_fds--;
+  af->af_reactor->ar_num_fds--;
   af->af_callback = NULL;
   af_release(af);
 }
@@ -575,7 +900,8 @@ asyncio_del_fd(asyncio_fd_t *af)
 void
 asyncio_set_timeout_delta_sec(asyncio_fd_t *af, int delta)
 {
-  af->af_timeout = delta * 1000000LL + async_now;
+  af->af_timeout = delta * 1000000LL + af->af_reactor->ar_now;
+  asyncio_fd_attention(af);
 }
 
 /**
@@ -584,12 +910,13 @@ asyncio_set_timeout_delta_sec(asyncio_fd_t *af, int delta)
 static int
 asyncio_handle_pipe(asyncio_fd_t *af, void *opaque, int event, int error)
 {
+  asyncio_reactor_t *ar = opaque;
   char x;
-  if(read(asyncio_pipe[0], &x, 1) != 1)
+  if(read(ar->ar_pipe[0], &x, 1) != 1)
     return 0;
 
   if(x == 0) {
-    prop_courier_poll(opaque);
+    prop_courier_poll(asyncio_courier);
     return 0;
   }
 
@@ -597,10 +924,10 @@ asyncio_handle_pipe(asyncio_fd_t *af, void *opaque, int event, int error)
     struct asyncio_task_queue atq;
     asyncio_task_t *at, *next;
 
-    hts_mutex_lock(&asyncio_task_mutex);
-    TAILQ_MOVE(&atq, &asyncio_tasks, at_link);
-    TAILQ_INIT(&asyncio_tasks);
-    hts_mutex_unlock(&asyncio_task_mutex);
+    hts_mutex_lock(&ar->ar_task_mutex);
+    TAILQ_MOVE(&atq, &ar->ar_tasks, at_link);
+    TAILQ_INIT(&ar->ar_tasks);
+    hts_mutex_unlock(&ar->ar_task_mutex);
 
     for(at = TAILQ_FIRST(&atq); at != NULL; at = next) {
       next = TAILQ_NEXT(at, at_link);
@@ -653,21 +980,26 @@ asyncio_add_worker(void (*fn)(void))
 static void *
 asyncio_thread(void *aux)
 {
-  asyncio_thread_id = hts_thread_current();
+  asyncio_reactor_t *ar = aux;
 
-  asyncio_courier = prop_courier_create_notify(asyncio_courier_notify, NULL);
+  ar->ar_thread = hts_thread_current();
 
-  asyncio_add_fd(asyncio_pipe[0], ASYNCIO_READ, asyncio_handle_pipe,
-                 asyncio_courier, "Pipe");
+  if(ar->ar_id == 0)
+    asyncio_courier = prop_courier_create_notify(asyncio_courier_notify,
+                                                 NULL);
 
-  async_now = arch_get_ts();
+  asyncio_add_fd(ar->ar_pipe[0], ASYNCIO_READ, asyncio_handle_pipe,
+                 ar, "Pipe");
 
-  init_group(INIT_GROUP_ASYNCIO);
+  ar->ar_now = arch_get_ts();
 
-  asyncio_trig_network_change();
+  if(ar->ar_id == 0) {
+    init_group(INIT_GROUP_ASYNCIO);
+    asyncio_trig_network_change();
+  }
 
   while(1)
-    asyncio_dopoll();
+    asyncio_dopoll(ar);
   return NULL;
 }
 
@@ -690,24 +1022,51 @@ asyncio_shutdown(void *opaque, int retcode)
 }
 
 
+/**
+ *
+ */
+static void
+asyncio_reactor_init(asyncio_reactor_t *ar, int id)
+{
+  ar->ar_id = id;
+  if(id == 0)
+    snprintf(ar->ar_name, sizeof(ar->ar_name), "asyncio");
+  else
+    snprintf(ar->ar_name, sizeof(ar->ar_name), "asyncio/%d", id);
+
+  TAILQ_INIT(&ar->ar_tasks);
+  hts_mutex_init(&ar->ar_task_mutex);
+
+  arch_pipe(ar->ar_pipe);
+
+#if ASYNCIO_EPOLL
+  LIST_INIT(&ar->ar_attention_fds);
+  ar->ar_epfd = epoll_create(64);
+  if(ar->ar_epfd == -1)
+    TRACE(TRACE_ERROR, "ASYNCIO", "epoll_create failed, using poll() -- %s",
+          strerror(errno));
+  else
+    fcntl(ar->ar_epfd, F_SETFD, FD_CLOEXEC);
+#endif
+}
+
+
 /**
  *
  */
 void
 asyncio_init_early(void)
 {
-  TAILQ_INIT(&asyncio_tasks);
   TAILQ_INIT(&asyncio_dns_pending);
-  TAILQ_INIT(&asyncio_dns_completed);
-  TAILQ_INIT(&asyncio_tasks);
 
   hts_mutex_init(&asyncio_worker_mutex);
   hts_mutex_init(&asyncio_dns_mutex);
-  hts_mutex_init(&asyncio_task_mutex);
 
-  arch_pipe(asyncio_pipe);
+  if(gconf.asyncio_reactors > 0)
+    asyncio_reactor_count = MIN(gconf.asyncio_reactors, ASYNCIO_MAX_REACTORS);
 
-  asyncio_dns_worker = asyncio_add_worker(adr_deliver_cb);
+  for(int i = 0; i < asyncio_reactor_count; i++)
+    asyncio_reactor_init(&asyncio_reactors[i], i);
 }
 
 /**
@@ -716,28 +1075,87 @@ asyncio_init_early(void)
 void
 asyncio_start(void)
 {
-  hts_thread_create_detached("asyncio", asyncio_thread,
-                             NULL, THREAD_PRIO_MODEL);
+  for(int i = 0; i < asyncio_reactor_count; i++)
+    hts_thread_create_detached(asyncio_reactors[i].ar_name, asyncio_thread,
+                               &asyncio_reactors[i], THREAD_PRIO_MODEL);
 
   shutdown_hook_add(asyncio_shutdown, NULL, 1);
 }
 
+
 /**
  *
  */
-void
-asyncio_run_task(void (*fn)(void *aux), void *aux)
+static void
+asyncio_reactor_run_task(asyncio_reactor_t *ar,
+                         void (*fn)(void *aux), void *aux)
 {
   asyncio_task_t *at = malloc(sizeof(asyncio_task_t));
   at->at_fn = fn;
   at->at_aux = aux;
 
-  hts_mutex_lock(&asyncio_task_mutex);
-  int do_signal = TAILQ_EMPTY(&asyncio_tasks);
-  TAILQ_INSERT_TAIL(&asyncio_tasks, at, at_link);
-  hts_mutex_unlock(&asyncio_task_mutex);
+  hts_mutex_lock(&ar->ar_task_mutex);
+  int do_signal = TAILQ_EMPTY(&ar->ar_tasks);
+  TAILQ_INSERT_TAIL(&ar->ar_tasks, at, at_link);
+  hts_mutex_unlock(&ar->ar_task_mutex);
   if(do_signal)
-    asyncio_wakeup(1);
+    asyncio_wakeup(ar, 1);
+}
+
+
+/**
+ *
+ */
+void
+asyncio_run_task(void (*fn)(void *aux), void *aux)
+{
+  asyncio_reactor_run_task(&asyncio_reactors[0], fn, aux);
+}
+
+
+/**
+ *
+ */
+void
+asyncio_run_task_on(int reactor, void (*fn)(void *aux), void *aux)
+{
+  asyncio_reactor_run_task(&asyncio_reactors[reactor % asyncio_reactor_count],
+                           fn, aux);
+}
+
+
+/**
+ *
+ */
+int
+asyncio_num_reactors(void)
+{
+  return asyncio_reactor_count;
+}
+
+
+/**
+ *
+ */
+int
+asyncio_current_reactor(void)
+{
+  asyncio_reactor_t *ar = asyncio_reactor_self();
+  return ar ? ar->ar_id : -1;
+}
+
+
+/**
+ * Reactor 0 is kept out of the rotation as it already carries
+ * everything that has not opted in to run elsewhere
+ */
+int
+asyncio_pick_reactor(void)
+{
+  if(asyncio_reactor_count == 1)
+    return 0;
+  return 1 + (unsigned int)atomic_add_and_fetch(&asyncio_reactor_rr, 1) %
+    (asyncio_reactor_count - 1);
 }
 
 
@@ -923,6 +1341,7 @@ do_write(asyncio_fd_t *af)
     if(r == -1) {
       asyncio_rem_events(af, ASYNCIO_WRITE);
       af->af_pending_errno = errno;
+      asyncio_fd_attention(af);
       return;
     }
 
@@ -1059,7 +1478,7 @@ asyncio_tcp_connected(asyncio_fd_t *af, void *opaque, int events, int error)
 void
 asyncio_send(asyncio_fd_t *af, const void *buf, size_t len, int cork)
 {
-  asyncio_verify_thread();
+  asyncio_verify_reactor(af->af_reactor);
   htsbuf_append(&af->af_sendq, buf, len);
   if(af->af_fd != -1 && !cork)
     do_write(af);
@@ -1072,7 +1491,7 @@ asyncio_send(asyncio_fd_t *af, const void *buf, size_t len, int cork)
 void
 asyncio_sendq(asyncio_fd_t *af, htsbuf_queue_t *q, int cork)
 {
-  asyncio_verify_thread();
+  asyncio_verify_reactor(af->af_reactor);
   htsbuf_appendq(&af->af_sendq, q);
   if(af->af_fd != -1 && !cork)
     do_write(af);
@@ -1113,6 +1532,7 @@ asyncio_connect(const char *name, const net_addr_t *addr,
   af->af_read_callback  = read_cb;
   af->af_timeout = arch_get_ts() + timeout * 1000;
   af->af_hostname = hostname ? strdup(hostname) : NULL;
+  asyncio_fd_attention(af);
 
 #if ENABLE_OPENSSL
   if(tlsctx != NULL) {
@@ -1131,6 +1551,7 @@ asyncio_connect(const char *name, const net_addr_t *addr,
       // Got fail directly, but we still want to notify the user about
       // the error asynchronously. Just to make things easier
       af->af_pending_errno = errno;
+      asyncio_fd_attention(af);
     }
   } else {
     asyncio_add_events(af, ASYNCIO_WRITE);
@@ -1163,6 +1584,7 @@ asyncio_attach(const char *name, int fd,
       TRACE(TRACE_ERROR, "ASYNCIO", "SSL: Unable to set FD");
     }
     SSL_set_accept_state(af->af_ssl);
+    asyncio_fd_attention(af);
   }
 #endif
 
@@ -1194,6 +1616,7 @@ asyncio_get_port(asyncio_fd_t *af)
 
 struct asyncio_dns_req {
   TAILQ_ENTRY(asyncio_dns_req) adr_link;
+  asyncio_reactor_t *adr_reactor;
   char *adr_hostname;
   void *adr_opaque;
   void (*adr_cb)(void *opaque, int status, const void *data);
@@ -1208,6 +1631,8 @@ struct asyncio_dns_req {
 
 static int adr_resolver_running;
 
+static void adr_deliver(void *aux);
+
 /**
  *
  */
@@ -1239,9 +1664,8 @@ adr_resolver(void *aux)
       adr->adr_status = ASYNCIO_DNS_STATUS_COMPLETED;
       adr->adr_data = &adr->adr_addr;
     }
+    asyncio_reactor_run_task(adr->adr_reactor, adr_deliver, adr);
     hts_mutex_lock(&asyncio_dns_mutex);
-    TAILQ_INSERT_TAIL(&asyncio_dns_completed, adr, adr_link);
-    asyncio_wakeup(asyncio_dns_worker);
   }
 
   adr_resolver_running = 0;
@@ -1262,6 +1686,7 @@ asyncio_dns_lookup_host(const char *hostname,
   asyncio_dns_req_t *adr;
 
   adr = calloc(1, sizeof(asyncio_dns_req_t));
+  adr->adr_reactor = asyncio_reactor_self() ?: &asyncio_reactors[0];
   adr->adr_hostname = strdup(hostname);
   adr->adr_cb = cb;
   adr->adr_opaque = opaque;
@@ -1279,26 +1704,19 @@ asyncio_dns_lookup_host(const char *hostname,
 
 
 /**
- * Return async DNS requests to caller
+ * Return async DNS request to caller, runs on the reactor that
+ * issued the request
  */
 static void
-adr_deliver_cb(void)
+adr_deliver(void *aux)
 {
-  asyncio_dns_req_t *adr;
+  asyncio_dns_req_t *adr = aux;
 
-  hts_mutex_lock(&asyncio_dns_mutex);
-
-  while((adr = TAILQ_FIRST(&asyncio_dns_completed)) != NULL) {
-    TAILQ_REMOVE(&asyncio_dns_completed, adr, adr_link);
-    hts_mutex_unlock(&asyncio_dns_mutex);
-    if(!adr->adr_cancelled)
-      adr->adr_cb(adr->adr_opaque, adr->adr_status, adr->adr_data);
+  if(!adr->adr_cancelled)
+    adr->adr_cb(adr->adr_opaque, adr->adr_status, adr->adr_data);
 
-    free(adr->adr_hostname);
-    free(adr);
-    hts_mutex_lock(&asyncio_dns_mutex);
-  }
-  hts_mutex_unlock(&asyncio_dns_mutex);
+  free(adr->adr_hostname);
+  free(adr);
 }
 
 
@@ -1308,7 +1726,7 @@ adr_deliver_cb(void)
 void
 asyncio_dns_cancel(asyncio_dns_req_t *adr)
 {
-  asyncio_verify_thread();
+  asyncio_verify_reactor(adr->adr_reactor);
   adr->adr_cancelled = 1;
 }
 
@@ -1403,8 +1821,7 @@ asyncio_udp_event(asyncio_fd_t *af, void *opaque, int events, int error)
   static uint8_t udp_recv_buf[8192];
 
   if(events & ASYNCIO_ERROR) {
-    close(af->af_fd);
-    af->af_fd = -1;
+    asyncio_close_fd(af);
     af->af_suspended = 1;
     return 0;
   }
@@ -1555,21 +1972,24 @@ asyncio_trig_network_change(void)
 static void
 asyncio_do_suspend(void *aux)
 {
+  asyncio_reactor_t *ar = aux;
   netifchange_t *nic;
-  LIST_FOREACH(nic, &netifchanges, link) {
-    nic->cb(NULL);
+
+  if(ar->ar_id == 0) {
+    LIST_FOREACH(nic, &netifchanges, link) {
+      nic->cb(NULL);
+    }
   }
-  
+
   asyncio_fd_t *af;
-  LIST_FOREACH(af, &asyncio_fds, af_link) {
+  LIST_FOREACH(af, &ar->ar_fds, af_link) {
     if(af->af_resume == NULL)
       continue; // Socket can't be resumed, skip
     
     if(af->af_fd == -1)
       continue;
     af->af_suspended = 1;
-    close(af->af_fd);
-    af->af_fd = -1;
+    asyncio_close_fd(af);
   }
 }
 
@@ -1579,13 +1999,16 @@ asyncio_do_suspend(void *aux)
 static void
 asyncio_do_resume(void *aux)
 {
+  asyncio_reactor_t *ar = aux;
   asyncio_fd_t *af;
-  LIST_FOREACH(af, &asyncio_fds, af_link) {
+  LIST_FOREACH(af, &ar->ar_fds, af_link) {
     if(af->af_suspended) {
       af->af_resume(af);
     }
   }
-  asyncio_do_network_change(NULL);
+
+  if(ar->ar_id == 0)
+    asyncio_do_network_change(NULL);
 }
 
 
@@ -1595,7 +2018,9 @@ asyncio_do_resume(void *aux)
 void
 asyncio_suspend(void)
 {
-  asyncio_run_task(asyncio_do_suspend, NULL);
+  for(int i = 0; i < asyncio_reactor_count; i++)
+    asyncio_reactor_run_task(&asyncio_reactors[i], asyncio_do_suspend,
+                             &asyncio_reactors[i]);
 }
 
 /**
@@ -1604,7 +2029,9 @@ asyncio_suspend(void)
 void
 asyncio_resume(void)
 {
-  asyncio_run_task(asyncio_do_resume, NULL);
+  for(int i = 0; i < asyncio_reactor_count; i++)
+    asyncio_reactor_run_task(&asyncio_reactors[i], asyncio_do_resume,
+                             &asyncio_reactors[i]);
 }
 
 
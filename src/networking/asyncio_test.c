@@ -0,0 +1,237 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "main.h"
+#include "asyncio.h"
+
+/**
+ * Microbenchmark of the asyncio fd backends. A number of idle socket
+ * pairs are registered and then we measure the round trip time of a
+ * single byte echoed by the asyncio thread. With poll() every round trip
+ * costs O(number of fds), with epoll it should stay flat
+ *
+ * Must not be called from the asyncio thread
+ */
+
+#define BENCH_ROUNDS 2000
+
+typedef struct bench {
+  hts_mutex_t b_mutex;
+  hts_cond_t b_cond;
+  int b_done;
+
+  int b_num_idle;
+  int *b_idle_fds;
+  asyncio_fd_t **b_idle_afs;
+
+  int b_ping[2];
+  asyncio_fd_t *b_ping_af;
+
+  int b_use_epoll;
+  int b_have_epoll;
+} bench_t;
+
+
+/**
+ *
+ */
+static int
+bench_nop(asyncio_fd_t *af, void *opaque, int events, int error)
+{
+  return 0;
+}
+
+
+/**
+ *
+ */
+static int
+bench_echo(asyncio_fd_t *af, void *opaque, int events, int error)
+{
+  bench_t *b = opaque;
+  char x;
+
+  if(events & ASYNCIO_READ && read(b->b_ping[0], &x, 1) == 1) {
+    if(write(b->b_ping[0], &x, 1) != 1)
+      return 0;
+  }
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+bench_signal(bench_t *b)
+{
+  hts_mutex_lock(&b->b_mutex);
+  b->b_done = 1;
+  hts_cond_signal(&b->b_cond);
+  hts_mutex_unlock(&b->b_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+bench_run_sync(bench_t *b, void (*fn)(void *aux))
+{
+  hts_mutex_lock(&b->b_mutex);
+  b->b_done = 0;
+  asyncio_run_task(fn, b);
+  while(!b->b_done)
+    hts_cond_wait(&b->b_cond, &b->b_mutex);
+  hts_mutex_unlock(&b->b_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+bench_setup(void *aux)
+{
+  bench_t *b = aux;
+
+  b->b_have_epoll = asyncio_use_epoll(b->b_use_epoll);
+
+  for(int i = 0; i < b->b_num_idle; i++)
+    b->b_idle_afs[i] = asyncio_add_fd(b->b_idle_fds[i], ASYNCIO_READ,
+                                      bench_nop, b, "bench-idle");
+
+  b->b_ping_af = asyncio_add_fd(b->b_ping[0], ASYNCIO_READ,
+                                bench_echo, b, "bench-ping");
+  bench_signal(b);
+}
+
+
+/**
+ *
+ */
+static void
+bench_teardown(void *aux)
+{
+  bench_t *b = aux;
+
+  for(int i = 0; i < b->b_num_idle; i++)
+    asyncio_del_fd(b->b_idle_afs[i]);
+
+  asyncio_del_fd(b->b_ping_af);
+  asyncio_use_epoll(1);
+  bench_signal(b);
+}
+
+
+/**
+ * Returns average round trip time in ns, or -1 if the backend
+ * is not available. num_idle is updated with the number of idle
+ * fds actually created
+ */
+static int64_t
+bench_backend(int *num_idle, int use_epoll)
+{
+  bench_t b = {0};
+  int peers[*num_idle];
+  int64_t ts = -1;
+  char x = 0;
+  int i;
+
+  hts_mutex_init(&b.b_mutex);
+  hts_cond_init(&b.b_cond, &b.b_mutex);
+
+  b.b_use_epoll = use_epoll;
+  b.b_idle_fds = malloc(*num_idle * sizeof(int));
+  b.b_idle_afs = malloc(*num_idle * sizeof(asyncio_fd_t *));
+
+  for(i = 0; i < *num_idle; i++) {
+    int sp[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sp))
+      break;
+    b.b_idle_fds[i] = sp[0];
+    peers[i] = sp[1];
+  }
+  b.b_num_idle = *num_idle = i;
+
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, b.b_ping))
+    goto out;
+
+  bench_run_sync(&b, bench_setup);
+
+  if(b.b_have_epoll == use_epoll) {
+    ts = arch_get_ts();
+
+    for(i = 0; i < BENCH_ROUNDS; i++) {
+      if(write(b.b_ping[1], &x, 1) != 1 || read(b.b_ping[1], &x, 1) != 1)
+        break;
+    }
+
+    ts = (arch_get_ts() - ts) * 1000 / BENCH_ROUNDS;
+  }
+
+  bench_run_sync(&b, bench_teardown);
+  close(b.b_ping[1]);
+
+ out:
+  for(i = 0; i < b.b_num_idle; i++)
+    close(peers[i]);
+
+  free(b.b_idle_fds);
+  free(b.b_idle_afs);
+  hts_cond_destroy(&b.b_cond);
+  hts_mutex_destroy(&b.b_mutex);
+  return ts;
+}
+
+
+/**
+ *
+ */
+void
+asyncio_benchmark(void)
+{
+  struct rlimit rlim;
+
+  // Each idle fd is one end of a socket pair
+  if(!getrlimit(RLIMIT_NOFILE, &rlim)) {
+    rlim.rlim_cur = rlim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rlim);
+  }
+
+  printf("%8s %14s %14s\n", "Idle fds", "epoll ns/rtt", "poll ns/rtt");
+
+  for(int i = 0; i <= 4096; i = i ? i * 4 : 64) {
+    int num = i;
+    int64_t e = bench_backend(&num, 1);
+    int64_t p = bench_backend(&num, 0);
+
+    if(e == -1)
+      printf("%8d %14s %14d\n", num, "n/a", (int)p);
+    else
+      printf("%8d %14d %14d\n", num, (int)e, (int)p);
+  }
+}
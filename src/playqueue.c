@@ -131,6 +131,8 @@ static prop_t *playqueue_nodes;
 
 static void *player_thread(void *aux);
 
+static void *preload_thread(void *aux);
+
 static media_pipe_t *playqueue_mp;
 
 
@@ -139,6 +141,9 @@ static media_pipe_t *playqueue_mp;
  */
 static hts_mutex_t playqueue_mutex;
 
+static hts_cond_t playqueue_preload_cond;
+static int playqueue_track_seq; // Bumped for every track started
+
 
 TAILQ_HEAD(playqueue_entry_queue, playqueue_entry);
 
@@ -834,6 +839,7 @@ playqueue_init(void)
   shuffle_lfg = time(NULL);
 
   hts_mutex_init(&playqueue_mutex);
+  hts_cond_init(&playqueue_preload_cond, &playqueue_mutex);
 
   playqueue_mp = mp_create("playqueue", MP_PRIMABLE);
 
@@ -864,6 +870,9 @@ playqueue_init(void)
   hts_thread_create_detached("audioplayer", player_thread, NULL,
 			     THREAD_PRIO_DEMUXER);
 
+  hts_thread_create_detached("audiopreload", preload_thread, NULL,
+			     THREAD_PRIO_FILESYSTEM);
+
   prop_subscribe(0,
 		 PROP_TAG_NAME("playqueue", "eventSink"),
 		 PROP_TAG_CALLBACK, pq_eventsink, NULL,
@@ -1124,6 +1133,8 @@ player_thread(void *aux)
 
     mp_set_url(mp, pqe->pqe_url, NULL, NULL);
     pqe_current = pqe;
+    playqueue_track_seq++;
+    hts_cond_signal(&playqueue_preload_cond);
     update_pq_meta();
 
     if(playqueue_advance0(pqe, 0) == NULL && playqueue_source_sub != NULL)
@@ -1196,6 +1207,95 @@ player_thread(void *aux)
 }
 
 
+/**
+ * Open, probe and pre-roll the next track in the background when the
+ * current one is getting close to its end (see backend_preload_audio())
+ * so the player doesn't have to wait for that when it moves on to it
+ */
+static void *
+preload_thread(void *aux)
+{
+  media_pipe_t *mp = playqueue_mp;
+  int preloaded_seq = 0;
+  int current_seq = 0;
+  int64_t track_start = 0;
+  char errbuf[256];
+
+  hts_mutex_lock(&playqueue_mutex);
+
+  while(1) {
+
+    // Nothing to do until the player starts another track
+    if(pqe_current == NULL || playqueue_track_seq == preloaded_seq ||
+       gconf.audio_preload_lead == 0) {
+      hts_cond_wait(&playqueue_preload_cond, &playqueue_mutex);
+      continue;
+    }
+
+    const int seq = playqueue_track_seq;
+    const int64_t lead = gconf.audio_preload_lead * 1000000LL;
+
+    if(seq != current_seq) {
+      current_seq = seq;
+      track_start = arch_get_ts();
+    }
+
+    /*
+     * The backend configures the pipe (duration, etc) a little while
+     * after the track has been started, don't look at it until then
+     */
+    const int64_t settle = track_start + 2000000 - arch_get_ts();
+    if(settle > 0) {
+      hts_cond_wait_timeout(&playqueue_preload_cond, &playqueue_mutex,
+                            settle / 1000 + 1);
+      continue;
+    }
+
+    hts_mutex_unlock(&playqueue_mutex);
+
+    hts_mutex_lock(&mp->mp_mutex);
+    const int64_t duration = mp->mp_duration;
+    const int64_t left = duration - mp->mp_seek_base;
+    hts_mutex_unlock(&mp->mp_mutex);
+
+    hts_mutex_lock(&playqueue_mutex);
+
+    if(seq != playqueue_track_seq || pqe_current == NULL)
+      continue;
+
+    if(duration && left > lead) {
+      /*
+       * Sleep until it's time, but look again now and then in case
+       * the user seeks forward
+       */
+      hts_cond_wait_timeout(&playqueue_preload_cond, &playqueue_mutex,
+                            MIN(left - lead, 5000000) / 1000 + 1);
+      continue;
+    }
+
+    // Tracks without a known duration are never preloaded
+    preloaded_seq = seq;
+    if(!duration)
+      continue;
+
+    playqueue_entry_t *nxt = playqueue_advance0(pqe_current, 0);
+    if(nxt == NULL || nxt->pqe_url == NULL)
+      continue;
+
+    char *url = strdup(nxt->pqe_url);
+    hts_mutex_unlock(&playqueue_mutex);
+
+    if(backend_preload_audio(url, errbuf, sizeof(errbuf), NULL))
+      TRACE(TRACE_DEBUG, "playqueue", "Unable to preload %s -- %s",
+            url, errbuf);
+    free(url);
+
+    hts_mutex_lock(&playqueue_mutex);
+  }
+  return NULL;
+}
+
+
 /**
  *
  */
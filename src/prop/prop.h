@@ -36,6 +36,7 @@
 typedef struct prop_courier prop_courier_t;
 typedef struct prop prop_t;
 typedef struct prop_sub prop_sub_t;
+typedef struct prop_batch prop_batch_t;
 TAILQ_HEAD(prop_notify_queue, prop_notify);
 
 
@@ -143,6 +144,7 @@ void prop_init_late(void);
 #define PROP_SUB_SEND_VALUE_PROP      0x100
 #define PROP_SUB_NO_INITIAL_UPDATE    0x200
 #define PROP_SUB_EARLY_DEL_CHILD      0x400
+#define PROP_SUB_COALESCE             0x800
 // Remember that flags field is uint16_t in prop_i.h so don't go above 0x8000
 // for persistent flags
 
@@ -253,6 +255,26 @@ void prop_setdn(prop_sub_t *skipme, prop_t *p, const char *str, ...);
 #define prop_set(p, name, type, ...) \
   prop_set_ex(p, name, __builtin_constant_p(name), type, ##__VA_ARGS__)
 
+/**
+ * Batched updates. Mutations are queued without holding prop_mutex and
+ * applied in one go by prop_batch_commit(). Consecutive prop_batch_set_parent()
+ * to the same parent are delivered as a single PROP_ADD_CHILD_VECTOR.
+ *
+ * A NULL name for prop_batch_set() means the value is set on 'p' itself
+ */
+prop_batch_t *prop_batch_create(void);
+
+void prop_batch_set_ex(prop_batch_t *pb, prop_t *p, const char *name,
+                       int noalloc, ...);
+
+#define prop_batch_set(pb, p, name, type, ...) \
+  prop_batch_set_ex(pb, p, name, __builtin_constant_p(name), type, \
+                    ##__VA_ARGS__)
+
+void prop_batch_set_parent(prop_batch_t *pb, prop_t *p, prop_t *parent);
+
+void prop_batch_commit(prop_batch_t *pb);
+
 void prop_set_string_ex(prop_t *p, prop_sub_t *skipme, const char *str,
 			prop_str_type_t type);
 
@@ -423,6 +445,7 @@ void prop_request_delete(prop_t *p);
 void prop_request_delete_multi(prop_vec_t *pv);
 
 #define PROP_COURIER_TRACE_TIMES 0x1
+#define PROP_COURIER_COALESCE    0x2  // All subscriptions coalesce values
 
 prop_courier_t *prop_courier_create_thread(hts_mutex_t *entrymutex,
 					   const char *name,
@@ -448,6 +471,15 @@ void prop_courier_poll_with_alarm(prop_courier_t *pc, int maxtime);
 
 int prop_courier_check(prop_courier_t *pc);
 
+void prop_courier_get_stats(prop_courier_t *pc, int *queued, int *coalesced);
+
+void prop_courier_set_flags(prop_courier_t *pc, int flags);
+
+void prop_courier_set_name(prop_courier_t *pc, const char *name);
+
+struct htsbuf_queue;
+void prop_courier_stats_print(struct htsbuf_queue *hq);
+
 void prop_courier_destroy(prop_courier_t *pc);
 
 void prop_notify_dispatch(struct prop_notify_queue *q, const char *tracename);
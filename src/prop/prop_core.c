@@ -31,6 +31,7 @@
 #include "prop_i.h"
 #include "misc/str.h"
 #include "event.h"
+#include "htsmsg/htsbuf.h"
 
 #include "prop_proxy.h"
 
@@ -79,6 +80,8 @@ static void prop_destroy_childs0(prop_t *p);
 static LIST_HEAD(, prop_sub) all_subs;
 #endif
 
+static LIST_HEAD(, prop_courier) all_couriers;
+
 /**
  *
  */
@@ -381,9 +384,7 @@ prop_ref_dec(prop_t *p)
   assert(p->hp_magic == PROP_MAGIC);
   memset(p, 0xdd, sizeof(prop_t));
 #endif
-  hts_mutex_lock(&prop_mutex);
   pool_put(prop_pool, p);
-  hts_mutex_unlock(&prop_mutex);
 }
 
 
@@ -1018,10 +1019,18 @@ prop_courier(void *aux)
     TAILQ_MOVE(&q_exp, &pc->pc_queue_exp, hpn_link);
     TAILQ_INIT(&pc->pc_queue_exp);
 
+    if(pc->pc_coalesce_subs) {
+      TAILQ_FOREACH(n, &q_exp, hpn_link)
+        if(n->hpn_sub->hps_pending == n)
+          n->hpn_sub->hps_pending = NULL;
+    }
+
     TAILQ_INIT(&q_nor);
     if((n = TAILQ_FIRST(&pc->pc_queue_nor)) != NULL) {
       TAILQ_REMOVE(&pc->pc_queue_nor, n, hpn_link);
       TAILQ_INSERT_TAIL(&q_nor, n, hpn_link);
+      if(n->hpn_sub->hps_pending == n)
+        n->hpn_sub->hps_pending = NULL;
     }
 
     const char *tt = pc->pc_flags & PROP_COURIER_TRACE_TIMES ?
@@ -1032,18 +1041,18 @@ prop_courier(void *aux)
     hts_mutex_lock(&prop_mutex);
   }
 
-  while((n = TAILQ_FIRST(&pc->pc_queue_exp)) != NULL) {
-    TAILQ_REMOVE(&pc->pc_queue_exp, n, hpn_link);
-    prop_notify_free(n);
-  }
+  TAILQ_INIT(&q_nor);
+  prop_courier_dequeue(pc, &q_nor);
 
-  while((n = TAILQ_FIRST(&pc->pc_queue_nor)) != NULL) {
-    TAILQ_REMOVE(&pc->pc_queue_nor, n, hpn_link);
+  while((n = TAILQ_FIRST(&q_nor)) != NULL) {
+    TAILQ_REMOVE(&q_nor, n, hpn_link);
     prop_notify_free(n);
   }
 
-  if(pc->pc_detached)
+  if(pc->pc_detached) {
+    LIST_REMOVE(pc, pc_link);
     free(pc);
+  }
 
   hts_mutex_unlock(&prop_mutex);
 
@@ -1206,6 +1215,11 @@ courier_enqueue0(prop_sub_t *s, prop_notify_t *n, int expedite)
     else
       TAILQ_INSERT_TAIL(&pc->pc_queue_nor, n, hpn_link);
 
+    if(s->hps_coalesce) {
+      s->hps_pending = n;
+      s->hps_pending_exp = !!expedite;
+    }
+
     courier_notify(pc);
     break;
 
@@ -1245,6 +1259,90 @@ prop_courier_enqueue(prop_sub_t *s, prop_notify_t *n)
 }
 
 
+/**
+ * Move all pending notifications from courier to the given queue.
+ * From here on the notifications can no longer be coalesced
+ */
+void
+prop_courier_dequeue(prop_courier_t *pc, struct prop_notify_queue *q)
+{
+  prop_notify_t *n;
+
+  if(pc->pc_coalesce_subs) {
+    TAILQ_FOREACH(n, &pc->pc_queue_exp, hpn_link)
+      if(n->hpn_sub->hps_pending == n)
+        n->hpn_sub->hps_pending = NULL;
+
+    TAILQ_FOREACH(n, &pc->pc_queue_nor, hpn_link)
+      if(n->hpn_sub->hps_pending == n)
+        n->hpn_sub->hps_pending = NULL;
+  }
+
+  TAILQ_MERGE(q, &pc->pc_queue_exp, hpn_link);
+  TAILQ_MERGE(q, &pc->pc_queue_nor, hpn_link);
+}
+
+
+/**
+ * If the last notification enqueued for the subscription is a value
+ * update that has not yet been picked up by the courier we can just
+ * overwrite it with the new value
+ */
+static prop_notify_t *
+prop_get_coalesced_value_notify(prop_sub_t *s)
+{
+  prop_notify_t *n = s->hps_pending;
+
+  if(n == NULL)
+    return NULL;
+
+  switch(n->hpn_event) {
+  case PROP_SET_DIR:
+  case PROP_SET_VOID:
+  case PROP_SET_RSTRING:
+  case PROP_SET_CSTRING:
+  case PROP_SET_URI:
+  case PROP_SET_INT:
+  case PROP_SET_FLOAT:
+  case PROP_SET_PROP:
+    break;
+  default:
+    return NULL;
+  }
+
+  prop_notify_free_payload(n);
+  ((prop_courier_t *)s->hps_dispatch)->pc_coalesced++;
+  return n;
+}
+
+
+/**
+ * A child that was added but never seen by the subscriber is deleted
+ * again. Just drop the pending add and don't send the delete
+ */
+static int
+prop_coalesce_del_child(prop_sub_t *s, prop_t *p)
+{
+  prop_notify_t *n = s->hps_pending;
+
+  if(n == NULL || n->hpn_prop != p ||
+     (n->hpn_event != PROP_ADD_CHILD && n->hpn_event != PROP_ADD_CHILD_BEFORE))
+    return 0;
+
+  prop_courier_t *pc = s->hps_dispatch;
+
+  if(s->hps_pending_exp)
+    TAILQ_REMOVE(&pc->pc_queue_exp, n, hpn_link);
+  else
+    TAILQ_REMOVE(&pc->pc_queue_nor, n, hpn_link);
+
+  s->hps_pending = NULL;
+  prop_notify_free(n);
+  pc->pc_coalesced += 2;
+  return 1;
+}
+
+
 /**
  *
  */
@@ -1403,7 +1501,12 @@ prop_build_notify_value(prop_sub_t *s, int direct, const char *origin,
     }
   }
 
-  n = prop_get_notify(s);
+  prop_notify_t *pending = NULL;
+
+  if(pnq == NULL && !(s->hps_flags & PROP_SUB_SEND_VALUE_PROP))
+    pending = prop_get_coalesced_value_notify(s);
+
+  n = pending ?: prop_get_notify(s);
 
   switch(p->hp_type) {
   case PROP_RSTRING:
@@ -1452,6 +1555,9 @@ prop_build_notify_value(prop_sub_t *s, int direct, const char *origin,
     abort();
   }
 
+  if(pending != NULL)
+    return;
+
   if(pnq) {
     TAILQ_INSERT_TAIL(pnq, n, hpn_link);
   } else {
@@ -1481,7 +1587,14 @@ prop_notify_void(prop_sub_t *s)
     return;
   }
 
-  prop_notify_t *n = prop_get_notify(s);
+  prop_notify_t *n = prop_get_coalesced_value_notify(s);
+  if(n != NULL) {
+    n->hpn_event = PROP_SET_VOID;
+    n->hpn_prop_extra = NULL;
+    return;
+  }
+
+  n = prop_get_notify(s);
 
   n->hpn_event = PROP_SET_VOID;
   n->hpn_prop_extra = NULL;
@@ -1576,6 +1689,9 @@ prop_build_notify_child(prop_sub_t *s, prop_t *p, prop_event_t event,
     return;
   }
 
+  if(event == PROP_DEL_CHILD && prop_coalesce_del_child(s, p))
+    return;
+
   n = prop_get_notify(s);
 
   if(p != NULL)
@@ -1866,6 +1982,298 @@ prop_clean(prop_t *p)
 }
 
 
+/**
+ * Child index for wide directories
+ *
+ * Once a lookup in a PROP_DIR has to step over more than
+ * PROP_CHILD_INDEX_THRESHOLD children we build an open addressed
+ * (linear probing) hash table mapping name -> child. It's kept in sync
+ * on every insert and removal.
+ *
+ * The index also carries an ordinal vector used to resolve "*N" paths.
+ * That one is dropped whenever the order of children changes and is
+ * rebuilt on demand.
+ *
+ * All of this is protected by prop_mutex
+ */
+#define PROP_CHILD_INDEX_THRESHOLD 32
+
+struct prop_child_index {
+  prop_t **pci_slots;
+  unsigned int pci_size;  // Always power of 2
+  unsigned int pci_used;
+
+  prop_t **pci_vec;
+  unsigned int pci_veclen;
+};
+
+
+/**
+ *
+ */
+static void
+prop_child_index_drop_vec(struct prop_child_index *pci)
+{
+  free(pci->pci_vec);
+  pci->pci_vec = NULL;
+  pci->pci_veclen = 0;
+}
+
+
+/**
+ *
+ */
+static void
+prop_child_index_free(prop_t *dir)
+{
+  struct prop_child_index *pci = dir->hp_child_index;
+  if(pci == NULL)
+    return;
+  prop_child_index_drop_vec(pci);
+  free(pci->pci_slots);
+  free(pci);
+  dir->hp_child_index = NULL;
+}
+
+
+/**
+ * Return -1 if name already exist in the index
+ */
+static int
+prop_child_index_insert_slot(struct prop_child_index *pci, prop_t *c)
+{
+  const unsigned int mask = pci->pci_size - 1;
+  unsigned int i = mystrhash(c->hp_name) & mask;
+  prop_t *o;
+
+  while((o = pci->pci_slots[i]) != NULL) {
+    if(!strcmp(o->hp_name, c->hp_name))
+      return -1;
+    i = (i + 1) & mask;
+  }
+  pci->pci_slots[i] = c;
+  pci->pci_used++;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+prop_child_index_resize(struct prop_child_index *pci, unsigned int size)
+{
+  prop_t **old = pci->pci_slots;
+  const unsigned int oldsize = pci->pci_size;
+
+  pci->pci_slots = calloc(size, sizeof(prop_t *));
+  pci->pci_size = size;
+  pci->pci_used = 0;
+
+  for(int i = 0; i < oldsize; i++)
+    if(old[i] != NULL)
+      prop_child_index_insert_slot(pci, old[i]);
+  free(old);
+}
+
+
+/**
+ * Give up on indexing this directory. It will go back to linear
+ * searches until all childs have been destroyed
+ */
+static void
+prop_child_index_inhibit(prop_t *dir)
+{
+  prop_child_index_free(dir);
+  dir->hp_flags |= PROP_CHILD_INDEX_INHIBIT;
+}
+
+
+/**
+ *
+ */
+static void
+prop_child_index_add(prop_t *dir, prop_t *c)
+{
+  struct prop_child_index *pci = dir->hp_child_index;
+  if(pci == NULL)
+    return;
+
+  prop_child_index_drop_vec(pci);
+
+  if(c->hp_name == NULL)
+    return;
+
+  if((pci->pci_used + 1) * 2 > pci->pci_size)
+    prop_child_index_resize(pci, pci->pci_size * 2);
+
+  if(prop_child_index_insert_slot(pci, c))
+    prop_child_index_inhibit(dir);
+}
+
+
+/**
+ *
+ */
+static void
+prop_child_index_del(prop_t *dir, prop_t *c)
+{
+  struct prop_child_index *pci = dir->hp_child_index;
+  if(pci == NULL)
+    return;
+
+  prop_child_index_drop_vec(pci);
+
+  if(c->hp_name == NULL)
+    return;
+
+  const unsigned int mask = pci->pci_size - 1;
+  unsigned int i = mystrhash(c->hp_name) & mask;
+  prop_t *o;
+
+  while((o = pci->pci_slots[i]) != c) {
+    assert(o != NULL);
+    i = (i + 1) & mask;
+  }
+
+  pci->pci_slots[i] = NULL;
+  pci->pci_used--;
+
+  // Backward shift entries that would otherwise become unreachable
+  unsigned int j = i;
+  while(1) {
+    j = (j + 1) & mask;
+    if((o = pci->pci_slots[j]) == NULL)
+      break;
+
+    const unsigned int k = mystrhash(o->hp_name) & mask;
+    if(i <= j ? (i < k && k <= j) : (i < k || k <= j))
+      continue;
+
+    pci->pci_slots[i] = o;
+    pci->pci_slots[j] = NULL;
+    i = j;
+  }
+}
+
+
+/**
+ * Order of childs changed, ordinal vector is no longer valid
+ */
+static void
+prop_child_index_reorder(prop_t *dir)
+{
+  if(dir->hp_child_index != NULL)
+    prop_child_index_drop_vec(dir->hp_child_index);
+}
+
+
+/**
+ *
+ */
+static struct prop_child_index *
+prop_child_index_build(prop_t *dir)
+{
+  struct prop_child_index *pci = calloc(1, sizeof(struct prop_child_index));
+  prop_t *c;
+  unsigned int named = 0, size = 64;
+
+  TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link)
+    if(c->hp_name != NULL)
+      named++;
+
+  while(size < named * 2)
+    size *= 2;
+
+  pci->pci_size = size;
+  pci->pci_slots = calloc(size, sizeof(prop_t *));
+  dir->hp_child_index = pci;
+
+  TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link) {
+    if(c->hp_name != NULL && prop_child_index_insert_slot(pci, c)) {
+      prop_child_index_inhibit(dir);
+      return NULL;
+    }
+  }
+  return pci;
+}
+
+
+/**
+ * Find child of a PROP_DIR by name
+ */
+static prop_t *
+prop_find_child0(prop_t *dir, const char *name)
+{
+  struct prop_child_index *pci = dir->hp_child_index;
+  prop_t *c;
+
+  if(pci != NULL) {
+    const unsigned int mask = pci->pci_size - 1;
+    unsigned int i = mystrhash(name) & mask;
+
+    while((c = pci->pci_slots[i]) != NULL) {
+      if(!strcmp(c->hp_name, name))
+        return c;
+      i = (i + 1) & mask;
+    }
+    return NULL;
+  }
+
+  int n = 0;
+  TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link) {
+    if(c->hp_name != NULL && !strcmp(c->hp_name, name))
+      break;
+    n++;
+  }
+
+  if(n > PROP_CHILD_INDEX_THRESHOLD &&
+     !(dir->hp_flags & PROP_CHILD_INDEX_INHIBIT))
+    prop_child_index_build(dir);
+  return c;
+}
+
+
+/**
+ * Find child of a PROP_DIR by position
+ */
+static prop_t *
+prop_find_child_by_index0(prop_t *dir, unsigned int idx)
+{
+  struct prop_child_index *pci = dir->hp_child_index;
+  prop_t *c;
+  unsigned int n = 0;
+
+  if(pci == NULL) {
+
+    TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link) {
+      if(n == idx)
+        break;
+      n++;
+    }
+
+    if(n <= PROP_CHILD_INDEX_THRESHOLD ||
+       dir->hp_flags & PROP_CHILD_INDEX_INHIBIT)
+      return c;
+
+    if((pci = prop_child_index_build(dir)) == NULL)
+      return c;
+  }
+
+  if(pci->pci_vec == NULL) {
+    TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link)
+      n++;
+
+    pci->pci_vec = malloc(sizeof(prop_t *) * n);
+    pci->pci_veclen = n;
+    n = 0;
+    TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link)
+      pci->pci_vec[n++] = c;
+  }
+  return idx < pci->pci_veclen ? pci->pci_vec[idx] : NULL;
+}
+
+
 /**
  *
  */
@@ -1880,6 +2288,8 @@ prop_make_dir(prop_t *p, prop_sub_t *skipme, const char *origin)
   
   TAILQ_INIT(&p->hp_childs);
   p->hp_selected = NULL;
+  p->hp_child_index = NULL;
+  p->hp_flags &= ~PROP_CHILD_INDEX_INHIBIT;
   p->hp_type = PROP_DIR;
   
   prop_notify_value(p, skipme, origin);
@@ -1895,9 +2305,11 @@ prop_insert(prop_t *p, prop_t *parent, prop_t *before, prop_sub_t *skipme)
   if(before != NULL) {
     assert(before->hp_parent == parent);
     TAILQ_INSERT_BEFORE(before, p, hp_parent_link);
+    prop_child_index_add(parent, p);
     prop_notify_child2(p, parent, before, PROP_ADD_CHILD_BEFORE, skipme, 0);
   } else {
     TAILQ_INSERT_TAIL(&parent->hp_childs, p, hp_parent_link);
+    prop_child_index_add(parent, p);
     prop_notify_child(p, parent, PROP_ADD_CHILD, skipme, 0);
   }
 }
@@ -1949,19 +2361,18 @@ prop_create0(prop_t *parent, const char *name, prop_sub_t *skipme, int noalloc)
   prop_make_dir(parent, skipme, "prop_create()");
 
   if(name != NULL) {
-    TAILQ_FOREACH(hp, &parent->hp_childs, hp_parent_link) {
-      if(hp->hp_name != NULL && !strcmp(hp->hp_name, name)) {
-
-	if(!(hp->hp_flags & PROP_NAME_NOT_ALLOCATED) && noalloc) {
-	  // Trick: We have a pointer to a compile time constant string
-	  // and the current prop does not have that, we could switch to
-	  // it and thus save some memory allocation
-	  free((void *)hp->hp_name);
-	  hp->hp_name = name;
-	  hp->hp_flags |= PROP_NAME_NOT_ALLOCATED;
-	}
-	return hp;
+    hp = prop_find_child0(parent, name);
+    if(hp != NULL) {
+
+      if(!(hp->hp_flags & PROP_NAME_NOT_ALLOCATED) && noalloc) {
+        // Trick: We have a pointer to a compile time constant string
+        // and the current prop does not have that, we could switch to
+        // it and thus save some memory allocation
+        free((void *)hp->hp_name);
+        hp->hp_name = name;
+        hp->hp_flags |= PROP_NAME_NOT_ALLOCATED;
       }
+      return hp;
     }
   }
 
@@ -2054,9 +2465,7 @@ prop_create_after(prop_t *parent, const char *name, prop_t *after,
 
     prop_make_dir(parent, skipme, "prop_create_after()");
 
-    TAILQ_FOREACH(p, &parent->hp_childs, hp_parent_link)
-      if(p->hp_name != NULL && !strcmp(p->hp_name, name))
-	break;
+    p = prop_find_child0(parent, name);
 
     if(p == NULL) {
 
@@ -2067,6 +2476,7 @@ prop_create_after(prop_t *parent, const char *name, prop_t *after,
       } else {
 	TAILQ_INSERT_AFTER(&parent->hp_childs, after, p, hp_parent_link);
       }
+      prop_child_index_add(parent, p);
 
       prop_t *next = TAILQ_NEXT(p, hp_parent_link);
       if(next == NULL) {
@@ -2088,7 +2498,8 @@ prop_create_after(prop_t *parent, const char *name, prop_t *after,
 	} else {
 	  TAILQ_INSERT_AFTER(&parent->hp_childs, after, p, hp_parent_link);
 	}
-	
+	prop_child_index_reorder(parent);
+
 	prop_t *next = TAILQ_NEXT(p, hp_parent_link);
 	prop_notify_child2(p, parent, next, PROP_MOVE_CHILD, skipme, 0);
       }
@@ -2151,14 +2562,12 @@ prop_set_parent_ex(prop_t *p, prop_t *parent, prop_t *before,
 /**
  *
  */
-void
-prop_set_parent_vector(prop_vec_t *pv, prop_t *parent, prop_t *before,
-		       prop_sub_t *skipme)
+static void
+prop_set_parent_vector0(prop_vec_t *pv, prop_t *parent, prop_t *before,
+                        prop_sub_t *skipme)
 {
   int i;
 
-  hts_mutex_lock(&prop_mutex);
-
   if(parent == NULL || parent->hp_type == PROP_ZOMBIE) {
 
   for(i = 0; i < pv->pv_length; i++)
@@ -2181,10 +2590,23 @@ prop_set_parent_vector(prop_vec_t *pv, prop_t *parent, prop_t *before,
       } else {
 	TAILQ_INSERT_TAIL(&parent->hp_childs, p, hp_parent_link);
       }
+      prop_child_index_add(parent, p);
     }
     prop_notify_childv(pv, parent, before ? PROP_ADD_CHILD_VECTOR_BEFORE : 
 		       PROP_ADD_CHILD_VECTOR, skipme, before);
   }
+}
+
+
+/**
+ *
+ */
+void
+prop_set_parent_vector(prop_vec_t *pv, prop_t *parent, prop_t *before,
+		       prop_sub_t *skipme)
+{
+  hts_mutex_lock(&prop_mutex);
+  prop_set_parent_vector0(pv, parent, before, skipme);
   hts_mutex_unlock(&prop_mutex);
 }
 
@@ -2204,6 +2626,7 @@ prop_unparent0(prop_t *p, prop_sub_t *skipme)
   prop_notify_child(p, parent, PROP_DEL_CHILD, NULL, 0);
   
   TAILQ_REMOVE(&parent->hp_childs, p, hp_parent_link);
+  prop_child_index_del(parent, p);
   p->hp_parent = NULL;
   
   if(parent->hp_selected == p)
@@ -2248,6 +2671,7 @@ prop_destroy_child(prop_t *p, prop_t *c)
   if(!prop_destroy0(c)) {
     prop_notify_child(c, p, PROP_DEL_CHILD, NULL, 0);
     TAILQ_REMOVE(&p->hp_childs, c, hp_parent_link);
+    prop_child_index_del(p, c);
     c->hp_parent = NULL;
   }
 }
@@ -2311,6 +2735,7 @@ prop_destroy0(prop_t *p)
     abort();
 
   case PROP_DIR:
+    prop_child_index_free(p);
     for(c = TAILQ_FIRST(&p->hp_childs); c != NULL; c = next) {
       next = TAILQ_NEXT(c, hp_parent_link);
       prop_destroy_child(p, c);
@@ -2386,6 +2811,7 @@ prop_destroy0(prop_t *p)
         prop_build_notify_child(s, p, PROP_DEL_CHILD, 0, 0);
 
     TAILQ_REMOVE(&parent->hp_childs, p, hp_parent_link);
+    prop_child_index_del(parent, p);
     p->hp_parent = NULL;
 
     if(parent->hp_selected == p)
@@ -2425,6 +2851,8 @@ prop_destroy_childs0(prop_t *p)
   struct prop_queue childs;
   TAILQ_MOVE(&childs, &p->hp_childs, hp_parent_link);
   TAILQ_INIT(&p->hp_childs);
+  prop_child_index_free(p);
+  p->hp_flags &= ~PROP_CHILD_INDEX_INHIBIT;
 
   p->hp_type = PROP_VOID;
   p->hp_selected = NULL;
@@ -2510,12 +2938,9 @@ prop_destroy_by_name(prop_t *p, const char *name)
 	  prop_destroy_child(p, c);
       }
     } else {
-      TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link) {
-	if(c->hp_name != NULL && !strcmp(c->hp_name, name)) {
-	  prop_destroy_child(p, c);
-	  break;
-	}
-      }
+      c = prop_find_child0(p, name);
+      if(c != NULL)
+	prop_destroy_child(p, c);
     }
   }
   hts_mutex_unlock(&prop_mutex);
@@ -2622,6 +3047,7 @@ prop_move0(prop_t *p, prop_t *before, prop_sub_t *skipme)
     } else {
       TAILQ_INSERT_TAIL(&parent->hp_childs, p, hp_parent_link);
     }  
+    prop_child_index_reorder(parent);
     prop_notify_child2(p, parent, before, PROP_MOVE_CHILD, skipme, 0);
   }
 }
@@ -2703,29 +3129,22 @@ prop_subfind(prop_t *p, const char **name, int follow_symlinks,
 
       TAILQ_INIT(&p->hp_childs);
       p->hp_selected = NULL;
+      p->hp_child_index = NULL;
+      p->hp_flags &= ~PROP_CHILD_INDEX_INHIBIT;
       p->hp_type = PROP_DIR;
 
       prop_notify_value(p, NULL, "prop_subfind()");
     }
 
     if(allow_indexing && name[0][0] == '*') {
-      unsigned int i = atoi(name[0]+1);
-      TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link) {
-	if(i == 0)
-	  break;
-	i--;
-      }
+      c = prop_find_child_by_index0(p, atoi(name[0]+1));
       if(c == NULL) {
         if(origin_chain)
           origin_chain[0] = NULL;
 	return NULL;
       }
     } else {
-
-      TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link) {
-	if(c->hp_name != NULL && !strcmp(c->hp_name, name[0]))
-	  break;
-      }
+      c = prop_find_child0(p, name[0]);
     }
     p = c ?: prop_create0(p, name[0], NULL, 0);    
     name++;
@@ -3202,6 +3621,8 @@ prop_subscribe_ex(const char *file, int line, int flags, ...)
   s->hps_multiple_origins = 0;
   s->hps_origin = NULL;
   s->hps_zombie = 0;
+  s->hps_coalesce = 0;
+  s->hps_pending = NULL;
   s->hps_flags = flags;
   s->hps_trampoline = trampoline;
   s->hps_callback = cb;
@@ -3246,6 +3667,10 @@ prop_subscribe_ex(const char *file, int line, int flags, ...)
     s->hps_lock = pc->pc_entry_lock;
     s->hps_lockmgr = pc->pc_lockmgr ?: lockmgr;
     pc->pc_refcount++;
+    if(flags & PROP_SUB_COALESCE || pc->pc_flags & PROP_COURIER_COALESCE) {
+      s->hps_coalesce = 1;
+      pc->pc_coalesce_subs++;
+    }
     break;
 
   case PROP_SUB_DISPATCH_MODE_GLOBAL:
@@ -3407,6 +3832,10 @@ prop_unsubscribe0(prop_sub_t *s)
   if(s->hps_dispatch_mode == PROP_SUB_DISPATCH_MODE_COURIER) {
     prop_courier_t *pc = s->hps_dispatch;
     pc->pc_refcount--;
+    if(s->hps_coalesce) {
+      pc->pc_coalesce_subs--;
+      s->hps_pending = NULL;
+    }
   }
 
 
@@ -3504,7 +3933,11 @@ prop_sub_reemit(prop_sub_t *s)
 void
 prop_init(void)
 {
-  hts_mutex_init(&prop_mutex);
+  // Spinning is a waste when the lock holder can't be running meanwhile
+  if(gconf.concurrency > 1)
+    hts_mutex_init_adaptive(&prop_mutex);
+  else
+    hts_mutex_init(&prop_mutex);
   hts_mutex_init(&prop_tag_mutex);
   hts_cond_init(&prop_global_dispatch_cond, &prop_mutex);
 
@@ -3512,9 +3945,9 @@ prop_init(void)
   TAILQ_INIT(&prop_global_dispatch_dispatching_queue);
 
 
-  prop_pool   = pool_create("prop", sizeof(prop_t), 0);
-  notify_pool = pool_create("notify", sizeof(prop_notify_t), 0);
-  sub_pool    = pool_create("subs", sizeof(prop_sub_t), 0);
+  prop_pool   = pool_create("prop", sizeof(prop_t), POOL_MAGAZINES);
+  notify_pool = pool_create("notify", sizeof(prop_notify_t), POOL_MAGAZINES);
+  sub_pool    = pool_create("subs", sizeof(prop_sub_t), POOL_MAGAZINES);
   pot_pool    = pool_create("pots", sizeof(prop_originator_tracking_t), 0);
   psd_pool    = pool_create("psds", sizeof(prop_sub_dispatch_t), 0);
 
@@ -5063,9 +5496,7 @@ prop_findv(prop_t *p, char **names)
       break;
     }
 
-    TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-      if(c->hp_name != NULL && !strcmp(c->hp_name, n))
-	break;
+    c = prop_find_child0(p, n);
     if(c == NULL)
       break;
 
@@ -5095,9 +5526,7 @@ prop_find0(prop_t *p, va_list ap)
       break;
     }
 
-    TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-      if(c->hp_name != NULL && !strcmp(c->hp_name, n))
-	break;
+    c = prop_find_child0(p, n);
     if(c == NULL)
 	return NULL;
     p = c;
@@ -5206,6 +5635,10 @@ prop_courier_create(void)
   TAILQ_INIT(&pc->pc_queue_exp);
   TAILQ_INIT(&pc->pc_dispatch_queue);
   TAILQ_INIT(&pc->pc_free_queue);
+
+  hts_mutex_lock(&prop_mutex);
+  LIST_INSERT_HEAD(&all_couriers, pc, pc_link);
+  hts_mutex_unlock(&prop_mutex);
   return pc;
 }
 
@@ -5290,8 +5723,8 @@ prop_courier_wait(prop_courier_t *pc, struct prop_notify_queue *q, int timeout)
       hts_cond_wait(&pc->pc_cond, &prop_mutex);
   }
 
-  TAILQ_MOVE(q, &pc->pc_queue_exp, hpn_link);
-  TAILQ_MERGE(q, &pc->pc_queue_nor, hpn_link);
+  TAILQ_INIT(q);
+  prop_courier_dequeue(pc, q);
   hts_mutex_unlock(&prop_mutex);
   return r;
 }
@@ -5358,6 +5791,10 @@ prop_courier_destroy(prop_courier_t *pc)
   if(pc->pc_has_cond)
     hts_cond_destroy(&pc->pc_cond);
 
+  hts_mutex_lock(&prop_mutex);
+  LIST_REMOVE(pc, pc_link);
+  hts_mutex_unlock(&prop_mutex);
+
   free(pc->pc_name);
 
   free(pc);
@@ -5383,9 +5820,9 @@ void
 prop_courier_poll(prop_courier_t *pc)
 {
   struct prop_notify_queue q;
+  TAILQ_INIT(&q);
   hts_mutex_lock(&prop_mutex);
-  TAILQ_MOVE(&q, &pc->pc_queue_exp, hpn_link);
-  TAILQ_MERGE(&q, &pc->pc_queue_nor, hpn_link);
+  prop_courier_dequeue(pc, &q);
   hts_mutex_unlock(&prop_mutex);
   prop_notify_dispatch(&q, 0);
 }
@@ -5403,8 +5840,7 @@ prop_courier_poll_timed(prop_courier_t *pc, int maxtime)
   prop_notify_t *n, *next;
 
   if(!hts_mutex_trylock(&prop_mutex)) {
-    TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_exp, hpn_link);
-    TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_nor, hpn_link);
+    prop_courier_dequeue(pc, &pc->pc_dispatch_queue);
 
     for(n = TAILQ_FIRST(&pc->pc_free_queue); n != NULL; n = next) {
       next = TAILQ_NEXT(n, hpn_link);
@@ -5429,6 +5865,80 @@ prop_courier_poll_timed(prop_courier_t *pc, int maxtime)
 }
 
 
+/**
+ *
+ */
+void
+prop_courier_get_stats(prop_courier_t *pc, int *queued, int *coalesced)
+{
+  prop_notify_t *n;
+  int cnt = 0;
+
+  hts_mutex_lock(&prop_mutex);
+  TAILQ_FOREACH(n, &pc->pc_queue_exp, hpn_link)
+    cnt++;
+  TAILQ_FOREACH(n, &pc->pc_queue_nor, hpn_link)
+    cnt++;
+  *coalesced = pc->pc_coalesced;
+  hts_mutex_unlock(&prop_mutex);
+  *queued = cnt;
+}
+
+
+/**
+ * Set PROP_COURIER_ flags. Only affects subscriptions created after
+ * this call
+ */
+void
+prop_courier_set_flags(prop_courier_t *pc, int flags)
+{
+  hts_mutex_lock(&prop_mutex);
+  pc->pc_flags |= flags;
+  hts_mutex_unlock(&prop_mutex);
+}
+
+
+/**
+ * Name used for tracing and in stats
+ */
+void
+prop_courier_set_name(prop_courier_t *pc, const char *name)
+{
+  hts_mutex_lock(&prop_mutex);
+  mystrset(&pc->pc_name, name);
+  hts_mutex_unlock(&prop_mutex);
+}
+
+
+/**
+ * Queue length and number of coalesced notifications for all couriers
+ */
+void
+prop_courier_stats_print(struct htsbuf_queue *hq)
+{
+  prop_courier_t *pc;
+  prop_notify_t *n;
+
+  htsbuf_qprintf(hq, "%-24s %8s %8s %10s %8s\n",
+                 "Courier", "Subs", "Queued", "Coalesced", "Coalesce");
+
+  hts_mutex_lock(&prop_mutex);
+  LIST_FOREACH(pc, &all_couriers, pc_link) {
+    int queued = 0;
+    TAILQ_FOREACH(n, &pc->pc_queue_exp, hpn_link)
+      queued++;
+    TAILQ_FOREACH(n, &pc->pc_queue_nor, hpn_link)
+      queued++;
+
+    htsbuf_qprintf(hq, "%-24s %8d %8d %10d %8d\n",
+                   pc->pc_name ? pc->pc_name : "<unnamed>",
+                   pc->pc_refcount, queued, pc->pc_coalesced,
+                   pc->pc_coalesce_subs);
+  }
+  hts_mutex_unlock(&prop_mutex);
+}
+
+
 /**
  *
  */
@@ -5700,6 +6210,246 @@ prop_set_ex(prop_t *p, const char *name, int noalloc, ...)
 }
 
 
+/**
+ * A queued mutation. Strings are always converted to rstr's when queued
+ * so the caller's buffers does not need to outlive the batch
+ */
+typedef struct prop_batch_op {
+  prop_t *pbo_prop;
+  prop_t *pbo_parent;         // PROP_ADD_CHILD only
+  prop_vec_t *pbo_vec;        // Released after commit
+  char *pbo_name;
+  char pbo_name_alloced;
+  prop_event_t pbo_event;
+  union {
+    rstr_t *rstr;
+    int i;
+    float f;
+  } u;
+} prop_batch_op_t;
+
+
+struct prop_batch {
+  prop_batch_op_t *pb_ops;
+  int pb_num;
+  int pb_capacity;
+};
+
+
+/**
+ *
+ */
+prop_batch_t *
+prop_batch_create(void)
+{
+  return calloc(1, sizeof(prop_batch_t));
+}
+
+
+/**
+ *
+ */
+static prop_batch_op_t *
+prop_batch_op_alloc(prop_batch_t *pb, prop_t *p, prop_event_t event)
+{
+  prop_batch_op_t *op;
+
+  if(pb->pb_num == pb->pb_capacity) {
+    pb->pb_capacity = pb->pb_capacity ? pb->pb_capacity * 2 : 16;
+    pb->pb_ops = realloc(pb->pb_ops, pb->pb_capacity * sizeof(prop_batch_op_t));
+  }
+  op = &pb->pb_ops[pb->pb_num++];
+  memset(op, 0, sizeof(prop_batch_op_t));
+  op->pbo_prop = prop_ref_inc(p);
+  op->pbo_event = event;
+  return op;
+}
+
+
+/**
+ *
+ */
+void
+prop_batch_set_ex(prop_batch_t *pb, prop_t *p, const char *name,
+                  int noalloc, ...)
+{
+  prop_batch_op_t *op;
+  const char *str;
+  rstr_t *rstr;
+  va_list ap;
+  int ev;
+
+  if(p == NULL)
+    return;
+
+  va_start(ap, noalloc);
+  ev = va_arg(ap, prop_event_t);
+
+  switch(ev) {
+  case PROP_SET_STRING:
+    str = va_arg(ap, const char *);
+    if(str == NULL) {
+      op = prop_batch_op_alloc(pb, p, PROP_SET_VOID);
+    } else {
+      op = prop_batch_op_alloc(pb, p, PROP_SET_RSTRING);
+      op->u.rstr = rstr_alloc(str);
+    }
+    break;
+  case PROP_SET_RSTRING:
+  case PROP_ADOPT_RSTRING:
+    rstr = va_arg(ap, rstr_t *);
+    if(rstr == NULL) {
+      op = prop_batch_op_alloc(pb, p, PROP_SET_VOID);
+    } else {
+      op = prop_batch_op_alloc(pb, p, PROP_SET_RSTRING);
+      op->u.rstr = ev == PROP_ADOPT_RSTRING ? rstr : rstr_dup(rstr);
+    }
+    break;
+  case PROP_SET_INT:
+    op = prop_batch_op_alloc(pb, p, PROP_SET_INT);
+    op->u.i = va_arg(ap, int);
+    break;
+  case PROP_SET_FLOAT:
+    op = prop_batch_op_alloc(pb, p, PROP_SET_FLOAT);
+    op->u.f = va_arg(ap, double);
+    break;
+  case PROP_SET_VOID:
+    op = prop_batch_op_alloc(pb, p, PROP_SET_VOID);
+    break;
+  default:
+    fprintf(stderr, "Unable to batch event: %d\n", ev);
+    assert(0);
+    va_end(ap);
+    return;
+  }
+  va_end(ap);
+
+  if(name != NULL) {
+    op->pbo_name_alloced = !noalloc;
+    op->pbo_name = noalloc ? (char *)name : strdup(name);
+  }
+}
+
+
+/**
+ *
+ */
+void
+prop_batch_set_parent(prop_batch_t *pb, prop_t *p, prop_t *parent)
+{
+  if(p == NULL || parent == NULL)
+    return;
+
+  prop_batch_op_t *op = prop_batch_op_alloc(pb, p, PROP_ADD_CHILD);
+  op->pbo_parent = prop_ref_inc(parent);
+}
+
+
+/**
+ * Insert pending childs as one vector. The vector is kept around until
+ * after prop_mutex is released as prop_vec_release() may need the lock
+ */
+static void
+prop_batch_flush_childs(prop_batch_op_t *op, prop_vec_t *pv, prop_t *parent)
+{
+  if(pv == NULL)
+    return;
+  prop_set_parent_vector0(pv, parent, NULL, NULL);
+  op->pbo_vec = pv;
+}
+
+
+/**
+ * Apply all queued mutations with a single acquisition of prop_mutex
+ * and free the batch.
+ *
+ * Unparented props sent to the same parent are collected and inserted
+ * as one vector when another parent shows up or at end of the batch
+ */
+void
+prop_batch_commit(prop_batch_t *pb)
+{
+  prop_batch_op_t *op, *pvop = NULL;
+  prop_vec_t *pv = NULL;
+  prop_t *p, *parent = NULL;
+  int i;
+
+  hts_mutex_lock(&prop_mutex);
+
+  for(i = 0; i < pb->pb_num; i++) {
+    op = &pb->pb_ops[i];
+    p = op->pbo_prop;
+
+    if(p->hp_type == PROP_ZOMBIE)
+      continue;
+
+    if(op->pbo_event == PROP_ADD_CHILD) {
+      if(op->pbo_parent->hp_type == PROP_ZOMBIE)
+        continue;
+
+      if(p->hp_parent == NULL && pv != NULL && parent == op->pbo_parent) {
+        // Claim it right away so a duplicate entry is not inserted twice
+        p->hp_parent = parent;
+        pv = prop_vec_append(pv, p);
+        continue;
+      }
+
+      prop_batch_flush_childs(pvop, pv, parent);
+      pv = NULL;
+
+      if(p->hp_parent != NULL) {
+        prop_set_parent0(p, op->pbo_parent, NULL, NULL);
+        continue;
+      }
+
+      pvop = op;
+      parent = op->pbo_parent;
+      p->hp_parent = parent;
+      pv = prop_vec_append(prop_vec_create(pb->pb_num - i), p);
+      continue;
+    }
+
+    if(op->pbo_name != NULL)
+      p = prop_create0(p, op->pbo_name, NULL, !op->pbo_name_alloced);
+
+    switch(op->pbo_event) {
+    case PROP_SET_RSTRING:
+      prop_set_rstring_exl(p, NULL, op->u.rstr, 0);
+      break;
+    case PROP_SET_INT:
+      prop_set_int_exl(p, NULL, op->u.i);
+      break;
+    case PROP_SET_FLOAT:
+      prop_set_float_exl(p, NULL, op->u.f);
+      break;
+    case PROP_SET_VOID:
+      prop_set_void_exl(p, NULL);
+      break;
+    default:
+      abort();
+    }
+  }
+
+  prop_batch_flush_childs(pvop, pv, parent);
+
+  hts_mutex_unlock(&prop_mutex);
+
+  for(i = 0; i < pb->pb_num; i++) {
+    op = &pb->pb_ops[i];
+    if(op->pbo_vec != NULL)
+      prop_vec_release(op->pbo_vec);
+    if(op->pbo_event == PROP_SET_RSTRING)
+      rstr_release(op->u.rstr);
+    if(op->pbo_name_alloced)
+      free(op->pbo_name);
+    prop_ref_dec(op->pbo_parent);
+    prop_ref_dec(op->pbo_prop);
+  }
+  free(pb->pb_ops);
+  free(pb);
+}
+
+
 /**
  *
  */
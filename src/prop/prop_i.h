@@ -72,6 +72,19 @@ struct prop_courier {
 
   int pc_refcount;
   char *pc_name;
+
+  LIST_ENTRY(prop_courier) pc_link;  // In all_couriers, for stats
+
+  /**
+   * Number of subscriptions with coalescing enabled. As long as this
+   * is non-zero we must clear hps_pending when dequeueing notifications
+   */
+  int pc_coalesce_subs;
+
+  /**
+   * Number of notifications dropped due to coalescing
+   */
+  int pc_coalesced;
 };
 
 
@@ -313,6 +326,12 @@ struct prop {
 #define PROP_HAVE_MORE               0x1000
 #define PROP_HAVE_MORE_YES           0x2000
 
+  /**
+   * Set on a PROP_DIR when its children can't be indexed by name
+   * (duplicate names). Inhibits (re)building of hp_child_index
+   */
+#define PROP_CHILD_INDEX_INHIBIT     0x4000
+
   /**
    * Tags. Protected by prop_tag_mutex
    */
@@ -338,6 +357,7 @@ struct prop {
     struct {
       struct prop_queue childs;
       struct prop *selected;
+      struct prop_child_index *index;
     } c;
     struct pixmap *pixmap;
     struct {
@@ -359,6 +379,7 @@ struct prop {
 #define hp_int      u.i.val
 #define hp_childs   u.c.childs
 #define hp_selected u.c.selected
+#define hp_child_index u.c.index
 #define hp_pixmap   u.pixmap
 #define hp_uri_title u.uri.title
 #define hp_uri       u.uri.uri
@@ -528,6 +549,19 @@ struct prop_sub {
 
   uint8_t hps_proxy : 1;
 
+  /**
+   * Set if value notifications should be coalesced, see hps_pending
+   */
+  uint8_t hps_coalesce : 1;
+  uint8_t hps_pending_exp : 1;
+
+  /**
+   * Last notification enqueued on the courier for this subscription.
+   * Only maintained when hps_coalesce is set and cleared as soon as
+   * the courier dequeues the notification. Protected by global mutex
+   */
+  struct prop_notify *hps_pending;
+
   /**
    * Flags as passed to prop_subscribe(). May never be changed
    */
@@ -603,6 +637,8 @@ int prop_dispatch_one(prop_notify_t *n, int lockmode);
 
 void prop_courier_enqueue(prop_sub_t *s, prop_notify_t *n);
 
+void prop_courier_dequeue(prop_courier_t *pc, struct prop_notify_queue *q);
+
 const char *prop_get_DN(prop_t *p, int compact);
 
 #endif // PROP_I_H__
@@ -256,7 +256,7 @@ makesub(JNIEnv *env,
   if(RB_INSERT_SORTED(&jni_subscriptions, js, js_link, js_cmp))
     abort();
 
-  js->js_sub = prop_subscribe(PROP_SUB_ALT_PATH,
+  js->js_sub = prop_subscribe(PROP_SUB_ALT_PATH | PROP_SUB_COALESCE,
 			      PROP_TAG_NAMESTR, path,
 			      PROP_TAG_CALLBACK, cb, js,
 			      PROP_TAG_ROOT, p,
@@ -47,8 +47,7 @@ prop_courier_poll_with_alarm(prop_courier_t *pc, int maxtime)
   prop_notify_t *n, *next;
 
   if(!hts_mutex_trylock(&prop_mutex)) {
-    TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_exp, hpn_link);
-    TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_nor, hpn_link);
+    prop_courier_dequeue(pc, &pc->pc_dispatch_queue);
 
     for(n = TAILQ_FIRST(&pc->pc_free_queue); n != NULL; n = next) {
       next = TAILQ_NEXT(n, hpn_link);
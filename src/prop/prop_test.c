@@ -27,6 +27,9 @@
 #include <sys/time.h>
 
 #include "arch/atomic.h"
+#include "arch/threads.h"
+#include "main.h"
+#include "misc/minmax.h"
 
 #include "prop.h"
 #include "prop_i.h"
@@ -318,6 +321,332 @@ prop_test2(void)
 
 
 
+/**
+ * Tests lookups in wide directories (hashed child index)
+ */
+static void
+prop_test3(void)
+{
+  printf("Running test 3\n");
+  char name[32];
+  int i;
+
+#define NUM_CHILDS 1000
+
+  prop_t *r = prop_create_root("root");
+  prop_t *dir = prop_create(r, "dir");
+  prop_t *childs[NUM_CHILDS];
+
+  for(i = 0; i < NUM_CHILDS; i++) {
+    snprintf(name, sizeof(name), "c%d", i);
+    childs[i] = prop_create(dir, name);
+  }
+
+  for(i = 0; i < NUM_CHILDS; i += 2)
+    prop_destroy(childs[i]);
+
+  for(i = 0; i < NUM_CHILDS; i++) {
+    snprintf(name, sizeof(name), "c%d", i);
+    prop_t *c = prop_find(dir, name, NULL);
+    if(c != (i & 1 ? childs[i] : NULL)) {
+      printf("Lookup of %s failed\n", name);
+      exit(1);
+    }
+    prop_ref_dec(c);
+
+    snprintf(name, sizeof(name), "*%d", i);
+    c = prop_get_by_name(PNVEC("root", "dir", name), 0,
+                         PROP_TAG_ROOT, r,
+                         NULL);
+    if(c != (i < NUM_CHILDS / 2 ? childs[i * 2 + 1] : NULL)) {
+      printf("Lookup of %s failed\n", name);
+      exit(1);
+    }
+    prop_ref_dec(c);
+  }
+
+  prop_destroy(r);
+}
+
+
+/**
+ * Tests coalescing of notifications on a courier
+ */
+static int child_events;
+
+static void
+count_child_events(void *opaque, prop_event_t event, ...)
+{
+  if(event == PROP_ADD_CHILD || event == PROP_DEL_CHILD)
+    child_events++;
+}
+
+
+static void
+prop_test4(void)
+{
+  printf("Running test 4\n");
+  prop_courier_t *pc = prop_courier_create_passive();
+  prop_t *r = prop_create_root(NULL);
+  prop_t *v = prop_create(r, "value");
+  prop_t *d = prop_create(r, "dir");
+  int i, queued, coalesced;
+
+  prop_sub_t *s1 =
+    prop_subscribe(PROP_SUB_COALESCE | PROP_SUB_NO_INITIAL_UPDATE,
+                   PROP_TAG_CALLBACK_INT, set_testval, NULL,
+                   PROP_TAG_COURIER, pc,
+                   PROP_TAG_ROOT, v,
+                   NULL);
+
+  prop_sub_t *s2 =
+    prop_subscribe(PROP_SUB_COALESCE | PROP_SUB_NO_INITIAL_UPDATE,
+                   PROP_TAG_CALLBACK, count_child_events, NULL,
+                   PROP_TAG_COURIER, pc,
+                   PROP_TAG_ROOT, d,
+                   NULL);
+
+  prop_courier_poll(pc);
+
+  for(i = 0; i < 1000; i++)
+    prop_set_int(v, i);
+
+  prop_courier_get_stats(pc, &queued, &coalesced);
+  if(queued != 1 || coalesced != 999) {
+    printf("Expected 1 queued, 999 coalesced, got %d, %d\n",
+           queued, coalesced);
+    exit(1);
+  }
+
+  prop_courier_poll(pc);
+  CHECKTESTVAL(999);
+
+  prop_t *c = prop_create(d, NULL);
+  prop_destroy(c);
+  prop_courier_poll(pc);
+  if(child_events != 0) {
+    printf("Expected add+del child to be coalesced\n");
+    exit(1);
+  }
+
+  prop_unsubscribe(s1);
+  prop_unsubscribe(s2);
+  prop_destroy(r);
+  prop_courier_destroy(pc);
+}
+
+
+/**
+ * Tests batched updates
+ */
+static int vector_events;
+static int vector_childs;
+
+static void
+count_vector_events(void *opaque, prop_event_t event, ...)
+{
+  va_list ap;
+  va_start(ap, event);
+
+  switch(event) {
+  case PROP_ADD_CHILD:
+    vector_childs++;
+    break;
+  case PROP_ADD_CHILD_VECTOR:
+    vector_events++;
+    vector_childs += prop_vec_len(va_arg(ap, prop_vec_t *));
+    break;
+  default:
+    break;
+  }
+  va_end(ap);
+}
+
+
+static void
+prop_test5(void)
+{
+  printf("Running test 5\n");
+  prop_courier_t *pc = prop_courier_create_passive();
+  prop_t *r = prop_create_root(NULL);
+  prop_t *d = prop_create(r, "dir");
+  prop_t *v = prop_create(r, "value");
+  prop_t *childs[NUM_CHILDS];
+  char name[32];
+  int i;
+
+  prop_sub_t *s1 =
+    prop_subscribe(PROP_SUB_NO_INITIAL_UPDATE,
+                   PROP_TAG_CALLBACK, count_vector_events, NULL,
+                   PROP_TAG_COURIER, pc,
+                   PROP_TAG_ROOT, d,
+                   NULL);
+
+  prop_sub_t *s2 =
+    prop_subscribe(PROP_SUB_NO_INITIAL_UPDATE,
+                   PROP_TAG_CALLBACK_INT, set_testval, NULL,
+                   PROP_TAG_COURIER, pc,
+                   PROP_TAG_ROOT, v,
+                   NULL);
+
+  prop_batch_t *pb = prop_batch_create();
+
+  for(i = 0; i < NUM_CHILDS; i++) {
+    snprintf(name, sizeof(name), "c%d", i);
+    childs[i] = prop_create_root(name);
+    prop_batch_set(pb, childs[i], name, PROP_SET_STRING, name);
+    prop_batch_set(pb, childs[i], "index", PROP_SET_INT, i);
+    prop_batch_set_parent(pb, childs[i], d);
+  }
+  prop_batch_set(pb, v, NULL, PROP_SET_INT, 42);
+
+  prop_courier_poll(pc);
+  prop_batch_commit(pb);
+  prop_courier_poll(pc);
+
+  CHECKTESTVAL(42);
+
+  if(vector_events != 1 || vector_childs != NUM_CHILDS) {
+    printf("Expected 1 vector with %d childs, got %d events, %d childs\n",
+           NUM_CHILDS, vector_events, vector_childs);
+    exit(1);
+  }
+
+  for(i = 0; i < NUM_CHILDS; i++) {
+    snprintf(name, sizeof(name), "c%d", i);
+    prop_t *c = prop_find(d, name, NULL);
+    if(c != childs[i]) {
+      printf("Lookup of %s failed\n", name);
+      exit(1);
+    }
+    prop_ref_dec(c);
+  }
+
+  prop_unsubscribe(s1);
+  prop_unsubscribe(s2);
+  prop_destroy(r);
+  prop_courier_destroy(pc);
+}
+
+
+/**
+ * Stress test of prop_mutex with concurrent writers
+ *
+ * prop_mutex can't be re-initialized while the rest of the system is
+ * running so to compare lock types each operation is also run under an
+ * outer test lock, plain and adaptive. prop_mutex itself is then
+ * uncontended and the outer lock sees the same hold times as prop_mutex
+ * would
+ */
+#define STRESS_ITERATIONS 100000
+#define STRESS_MAX_WRITERS 16
+
+typedef struct stress_writer {
+  prop_t *sw_root;
+  int sw_id;
+  hts_thread_t sw_tid;
+  hts_mutex_t *sw_outer;
+} stress_writer_t;
+
+
+static void *
+stress_writer_thread(void *aux)
+{
+  stress_writer_t *sw = aux;
+  hts_mutex_t *m = sw->sw_outer;
+  char name[32];
+  int i;
+
+  snprintf(name, sizeof(name), "writer%d", sw->sw_id);
+  prop_t *p = prop_create_r(sw->sw_root, name);
+
+  for(i = 0; i < STRESS_ITERATIONS; i++) {
+    if(m) hts_mutex_lock(m);
+    prop_set(p, "int",    PROP_SET_INT, i);
+    if(m) hts_mutex_unlock(m);
+
+    if(m) hts_mutex_lock(m);
+    prop_set(p, "float",  PROP_SET_FLOAT, i * 0.5f);
+    if(m) hts_mutex_unlock(m);
+
+    if(m) hts_mutex_lock(m);
+    prop_set(p, "string", PROP_SET_STRING, i & 1 ? "odd" : "even");
+    if(m) hts_mutex_unlock(m);
+
+    if(m) hts_mutex_lock(m);
+    prop_t *c = prop_get_by_name(PNVEC("stress", name, "int"), 0,
+                                 PROP_TAG_ROOT, sw->sw_root,
+                                 NULL);
+    if(m) hts_mutex_unlock(m);
+    prop_ref_dec(c);
+  }
+  prop_ref_dec(p);
+  return NULL;
+}
+
+
+/**
+ * Returns throughput in kops/s
+ */
+static int
+prop_test_stress_run(int writers, hts_mutex_t *outer)
+{
+  stress_writer_t sw[STRESS_MAX_WRITERS];
+  prop_t *r = prop_create_root("stress");
+  int i;
+
+  int64_t ts = arch_get_ts();
+
+  for(i = 0; i < writers; i++) {
+    sw[i].sw_root = r;
+    sw[i].sw_id = i;
+    sw[i].sw_outer = outer;
+    hts_thread_create_joinable("propstress", &sw[i].sw_tid,
+                               stress_writer_thread, &sw[i], 0);
+  }
+
+  for(i = 0; i < writers; i++)
+    hts_thread_join(&sw[i].sw_tid);
+
+  ts = arch_get_ts() - ts;
+
+  for(i = 0; i < writers; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "writer%d", i);
+    int v = prop_get_int(r, name, "int", NULL);
+    if(v != STRESS_ITERATIONS - 1) {
+      printf("Stress: %s ended at %d, expected %d\n",
+             name, v, STRESS_ITERATIONS - 1);
+      exit(1);
+    }
+  }
+
+  prop_destroy(r);
+  return (int64_t)writers * STRESS_ITERATIONS * 4 * 1000 / MAX(ts, 1);
+}
+
+
+static void
+prop_test_stress(int writers)
+{
+  hts_mutex_t plain, adaptive;
+
+  hts_mutex_init(&plain);
+  hts_mutex_init_adaptive(&adaptive);
+
+  int direct = prop_test_stress_run(writers, NULL);
+  int p      = prop_test_stress_run(writers, &plain);
+  int a      = prop_test_stress_run(writers, &adaptive);
+
+  printf("%2d writers: prop_mutex %d kops/s, "
+         "plain lock %d kops/s, adaptive lock %d kops/s (%+d%%)\n",
+         writers, direct, p, a, p ? (a - p) * 100 / p : 0);
+
+  hts_mutex_destroy(&plain);
+  hts_mutex_destroy(&adaptive);
+}
+
+
 /**
  *
  */
@@ -326,5 +655,11 @@ prop_test(void)
 {
   prop_test1();
   prop_test2();
+  prop_test3();
+  prop_test4();
+  prop_test5();
+
+  for(int i = 1; i <= STRESS_MAX_WRITERS; i *= 2)
+    prop_test_stress(i);
 }
 #endif
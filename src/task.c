@@ -21,35 +21,89 @@
 
 #include "main.h"
 #include "arch/threads.h"
+#include "arch/atomic.h"
 
 #include "task.h"
 #include "misc/queue.h"
+#include "misc/minmax.h"
+#include "htsmsg/htsbuf.h"
 
-#define MAX_TASK_THREADS 16
-#define MAX_IDLE_TASK_THREADS 2
+/**
+ * Workers are started on demand and park on task_cond when idle. Only
+ * TASK_MAX_IDLE workers are kept parked, the rest exit. Blocking tasks
+ * (HTTP requests, etc) are common so we allow more workers than there
+ * are CPUs
+ */
+#define TASK_WORKERS_PER_CPU 4
+#define TASK_MIN_WORKERS     16
+#define TASK_MAX_IDLE        2
+
+/**
+ * A task with a deadline is run before anything else once it is this
+ * close (in µs) to its deadline
+ */
+#define TASK_DEADLINE_MARGIN 5000
 
 TAILQ_HEAD(task_queue, task);
-TAILQ_HEAD(task_group_queue, task_group);
 
 struct task_group {
   atomic_t tg_refcount;
   struct task_queue tg_tasks;
-  TAILQ_ENTRY(task_group) tg_link;
+  struct task *tg_token;
 };
 
 
+/**
+ * A task with t_fn == NULL is a token for running the next task in
+ * t_group. A group has at most one token queued at any time, which is
+ * how the FIFO ordering within a group is maintained.
+ *
+ * Tasks with a deadline are only queued globally and are linked on
+ * both tasks[] and deadline_tasks
+ */
 typedef struct task {
   TAILQ_ENTRY(task) t_link;
+  TAILQ_ENTRY(task) t_deadline_link;
   task_fn_t *t_fn;
   void *t_opaque;
   task_group_t *t_group;
+  int64_t t_enqueued;
+  int64_t t_deadline;
+  task_prio_t t_prio;
 } task_t;
 
 
-static struct task_queue tasks = TAILQ_HEAD_INITIALIZER(tasks);
-static struct task_group_queue task_groups =TAILQ_HEAD_INITIALIZER(task_groups);
+/**
+ * The owner pushes and pops at the tail of tw_tasks, thieves steal
+ * from the head. Counters are only updated by the owner
+ */
+typedef struct task_worker {
+  hts_mutex_t tw_mutex;
+  struct task_queue tw_tasks[TASK_PRIO_num];
+  int tw_id;
+  int tw_running;  // Protected by task_mutex
+
+  int64_t tw_steals;
+  struct {
+    int64_t executed;
+    int64_t wait_sum;
+    int64_t wait_max;
+    int64_t deadline_missed;
+    int64_t wait_hist[TASK_WAIT_HIST_BUCKETS];
+  } tw_class[TASK_PRIO_num];
+} task_worker_t;
+
+
+static struct task_queue tasks[TASK_PRIO_num];
+static struct task_queue deadline_tasks;
 static unsigned int num_task_threads;
 static unsigned int num_task_threads_avail;
+static unsigned int task_max_workers;
+static unsigned int task_workers_used; // Slots that have ever had a thread
+static task_worker_t *task_workers;
+static hts_key_t task_worker_key;
+static atomic_t task_queued;
+static atomic_t task_deadlines;
 static hts_mutex_t task_mutex;
 static hts_cond_t task_cond;
 
@@ -63,71 +117,218 @@ task_group_release(task_group_t *tg)
   if(atomic_dec(&tg->tg_refcount))
     return;
   assert(TAILQ_FIRST(&tg->tg_tasks) == NULL);
+  free(tg->tg_token);
   free(tg);
 }
 
 
+/**
+ * Must be called with task_mutex held
+ */
+static void
+task_enqueue_global(task_t *t)
+{
+  atomic_inc(&task_queued);
+  TAILQ_INSERT_TAIL(&tasks[t->t_prio], t, t_link);
+
+  if(t->t_deadline) {
+    task_t *n;
+    // Keep deadline_tasks sorted, new tasks typically end up at the tail
+    TAILQ_FOREACH_REVERSE(n, &deadline_tasks, task_queue, t_deadline_link)
+      if(n->t_deadline <= t->t_deadline)
+        break;
+    if(n == NULL)
+      TAILQ_INSERT_HEAD(&deadline_tasks, t, t_deadline_link);
+    else
+      TAILQ_INSERT_AFTER(&deadline_tasks, n, t, t_deadline_link);
+    atomic_inc(&task_deadlines);
+  }
+}
+
+
+/**
+ * Must be called with task_mutex held
+ */
+static void
+task_dequeue_global(task_t *t)
+{
+  TAILQ_REMOVE(&tasks[t->t_prio], t, t_link);
+  if(t->t_deadline) {
+    TAILQ_REMOVE(&deadline_tasks, t, t_deadline_link);
+    atomic_dec(&task_deadlines);
+  }
+}
+
+
 /**
  *
  */
-static void *
-task_thread(void *aux)
+static task_t *
+task_next_urgent(void)
 {
   task_t *t;
-  task_group_t *tg;
+
+  if(atomic_get(&task_deadlines) == 0)
+    return NULL;
 
   hts_mutex_lock(&task_mutex);
-  while(1) {
-    t = TAILQ_FIRST(&tasks);
-    tg = TAILQ_FIRST(&task_groups);
+  t = TAILQ_FIRST(&deadline_tasks);
+  if(t != NULL && t->t_deadline - TASK_DEADLINE_MARGIN <= arch_get_ts())
+    task_dequeue_global(t);
+  else
+    t = NULL;
+  hts_mutex_unlock(&task_mutex);
+  return t;
+}
 
-    if(t == NULL && tg == NULL) {
-      if(num_task_threads_avail == MAX_IDLE_TASK_THREADS)
-        break;
 
-      num_task_threads_avail++;
-      hts_cond_wait(&task_cond, &task_mutex);
-      num_task_threads_avail--;
-      continue;
+/**
+ * Find something to do: Tasks about to miss their deadline first.
+ * Then, for each class: Our own deque, the global queue and finally
+ * try to steal from other workers
+ */
+static task_t *
+task_next(task_worker_t *tw)
+{
+  task_t *t;
+  int i, n, prio;
+
+  t = task_next_urgent();
+
+  for(prio = 0; t == NULL && prio < TASK_PRIO_num; prio++) {
+    hts_mutex_lock(&tw->tw_mutex);
+    t = TAILQ_LAST(&tw->tw_tasks[prio], task_queue);
+    if(t != NULL)
+      TAILQ_REMOVE(&tw->tw_tasks[prio], t, t_link);
+    hts_mutex_unlock(&tw->tw_mutex);
+
+    if(t != NULL)
+      break;
+
+    hts_mutex_lock(&task_mutex);
+    t = TAILQ_FIRST(&tasks[prio]);
+    if(t != NULL)
+      task_dequeue_global(t);
+    n = task_workers_used;
+    hts_mutex_unlock(&task_mutex);
+
+    for(i = 1; t == NULL && i < n; i++) {
+      task_worker_t *victim = &task_workers[(tw->tw_id + i) % n];
+
+      hts_mutex_lock(&victim->tw_mutex);
+      t = TAILQ_FIRST(&victim->tw_tasks[prio]);
+      if(t != NULL) {
+        TAILQ_REMOVE(&victim->tw_tasks[prio], t, t_link);
+        tw->tw_steals++;
+      }
+      hts_mutex_unlock(&victim->tw_mutex);
     }
+  }
 
-    if(t != NULL) {
-      TAILQ_REMOVE(&tasks, t, t_link);
-      hts_mutex_unlock(&task_mutex);
-      t->t_fn(t->t_opaque);
-      free(t);
-      hts_mutex_lock(&task_mutex);
-      // Released lock, must recheck for task groups
-      tg = TAILQ_FIRST(&task_groups);
-    }
+  if(t != NULL)
+    atomic_dec(&task_queued);
+  return t;
+}
 
-    if(tg != NULL) {
-      // Remove task group while processing as we don't want anyone
-      // else to dispatch from this group
-      TAILQ_REMOVE(&task_groups, tg, tg_link);
 
-      t = TAILQ_FIRST(&tg->tg_tasks);
-      hts_mutex_unlock(&task_mutex);
-      t->t_fn(t->t_opaque);
-      hts_mutex_lock(&task_mutex);
+/**
+ *
+ */
+static void
+task_account(task_worker_t *tw, const task_t *t)
+{
+  int64_t now = arch_get_ts();
+  int64_t wait = now - t->t_enqueued;
+  int64_t limit = 1000;
+  int i;
+
+  for(i = 0; i < TASK_WAIT_HIST_BUCKETS - 1 && wait >= limit; i++)
+    limit *= 4;
+
+  tw->tw_class[t->t_prio].executed++;
+  tw->tw_class[t->t_prio].wait_sum += wait;
+  tw->tw_class[t->t_prio].wait_max = MAX(tw->tw_class[t->t_prio].wait_max,
+                                         wait);
+  tw->tw_class[t->t_prio].wait_hist[i]++;
+  if(t->t_deadline && now > t->t_deadline)
+    tw->tw_class[t->t_prio].deadline_missed++;
+}
 
-      // Note that we remove _after_ execution because we don't want
-      // any newly inserted task in this group to cause the group
-      // to activate (ie, get inserted in task_groups)
-      TAILQ_REMOVE(&tg->tg_tasks, t, t_link);
-      free(t);
 
-      if(TAILQ_FIRST(&tg->tg_tasks) != NULL) {
-        // Still more tasks to work on in this group
-        // Reinsert group at tail to maintain fairness between groups
-        TAILQ_INSERT_TAIL(&task_groups, tg, tg_link);
+/**
+ *
+ */
+static void
+task_group_execute(task_worker_t *tw, task_group_t *tg)
+{
+  task_t *t;
+
+  hts_mutex_lock(&task_mutex);
+  t = TAILQ_FIRST(&tg->tg_tasks);
+  hts_mutex_unlock(&task_mutex);
+
+  task_account(tw, t);
+  t->t_fn(t->t_opaque);
+
+  hts_mutex_lock(&task_mutex);
+
+  // Note that we remove _after_ execution because we don't want
+  // any newly inserted task in this group to cause the group
+  // to activate (ie, get its token queued)
+  TAILQ_REMOVE(&tg->tg_tasks, t, t_link);
+
+  if(TAILQ_FIRST(&tg->tg_tasks) != NULL) {
+    // Still more tasks to work on in this group
+    // Requeue token at global tail to maintain fairness between groups
+    task_enqueue_global(tg->tg_token);
+  }
+  hts_mutex_unlock(&task_mutex);
+
+  free(t);
+
+  // Decrease refcount owned by task
+  task_group_release(tg);
+}
+
+
+/**
+ *
+ */
+static void *
+task_thread(void *aux)
+{
+  task_worker_t *tw = aux;
+  task_t *t;
+
+  hts_thread_set_specific(task_worker_key, tw);
+
+  while(1) {
+    t = task_next(tw);
+
+    if(t == NULL) {
+      hts_mutex_lock(&task_mutex);
+      if(atomic_get(&task_queued) == 0) {
+        if(num_task_threads_avail == TASK_MAX_IDLE)
+          break;
+        num_task_threads_avail++;
+        hts_cond_wait(&task_cond, &task_mutex);
+        num_task_threads_avail--;
       }
+      hts_mutex_unlock(&task_mutex);
+      continue;
+    }
 
-      // Decrease refcount owned by task
-      task_group_release(tg);
+    if(t->t_fn == NULL) {
+      task_group_execute(tw, t->t_group);
+    } else {
+      task_account(tw, t);
+      t->t_fn(t->t_opaque);
+      free(t);
     }
   }
 
+  // Our deque is empty since nothing is queued anywhere
+  tw->tw_running = 0;
   num_task_threads--;
   hts_mutex_unlock(&task_mutex);
   return NULL;
@@ -135,7 +336,37 @@ task_thread(void *aux)
 
 
 /**
- *
+ * Must be called with task_mutex held
+ */
+static void
+task_workers_init(void)
+{
+  task_worker_t *workers;
+  int i, j;
+
+  hts_thread_key_create(&task_worker_key, NULL);
+
+  task_max_workers = MAX(TASK_MIN_WORKERS,
+                         gconf.concurrency * TASK_WORKERS_PER_CPU);
+
+  workers = calloc(task_max_workers, sizeof(task_worker_t));
+  for(i = 0; i < task_max_workers; i++) {
+    task_worker_t *tw = &workers[i];
+    hts_mutex_init(&tw->tw_mutex);
+    for(j = 0; j < TASK_PRIO_num; j++)
+      TAILQ_INIT(&tw->tw_tasks[j]);
+    tw->tw_id = i;
+  }
+
+  // task_run_ex() peeks at task_workers without holding task_mutex, the
+  // key must be visible before it does
+  __sync_synchronize();
+  task_workers = workers;
+}
+
+
+/**
+ * Must be called with task_mutex held
  */
 static void
 task_schedule()
@@ -143,9 +374,14 @@ task_schedule()
   if(num_task_threads_avail > 0) {
     hts_cond_signal(&task_cond);
   } else {
-    if(num_task_threads < MAX_TASK_THREADS) {
+    if(num_task_threads < task_max_workers) {
+      task_worker_t *tw = task_workers;
+      while(tw->tw_running)
+        tw++;
+      tw->tw_running = 1;
       num_task_threads++;
-      hts_thread_create_detached("tasks", task_thread, NULL,
+      task_workers_used = MAX(task_workers_used, tw->tw_id + 1);
+      hts_thread_create_detached("tasks", task_thread, tw,
                                  THREAD_PRIO_BGTASK);
     }
   }
@@ -156,13 +392,35 @@ task_schedule()
  *
  */
 void
-task_run(task_fn_t *fn, void *opaque)
+task_run_ex(task_fn_t *fn, void *opaque, task_prio_t prio, int64_t deadline)
 {
+  task_worker_t *tw = NULL;
   task_t *t = calloc(1, sizeof(task_t));
   t->t_fn = fn;
   t->t_opaque = opaque;
-  hts_mutex_lock(&task_mutex);
-  TAILQ_INSERT_TAIL(&tasks, t, t_link);
+  t->t_prio = prio;
+  t->t_deadline = deadline;
+  t->t_enqueued = arch_get_ts();
+
+  if(task_workers != NULL && !deadline) {
+    // Pairs with the barrier in task_workers_init()
+    __sync_synchronize();
+    tw = hts_thread_get_specific(task_worker_key);
+  }
+
+  if(tw != NULL) {
+    // Submitted from a worker, put it on our own deque
+    atomic_inc(&task_queued);
+    hts_mutex_lock(&tw->tw_mutex);
+    TAILQ_INSERT_TAIL(&tw->tw_tasks[prio], t, t_link);
+    hts_mutex_unlock(&tw->tw_mutex);
+    hts_mutex_lock(&task_mutex);
+  } else {
+    hts_mutex_lock(&task_mutex);
+    if(task_workers == NULL)
+      task_workers_init();
+    task_enqueue_global(t);
+  }
   task_schedule();
   hts_mutex_unlock(&task_mutex);
 }
@@ -178,6 +436,9 @@ task_group_create(void)
   task_group_t *tg = calloc(1, sizeof(task_group_t));
   atomic_set(&tg->tg_refcount, 1);
   TAILQ_INIT(&tg->tg_tasks);
+  tg->tg_token = calloc(1, sizeof(task_t));
+  tg->tg_token->t_group = tg;
+  tg->tg_token->t_prio = TASK_PRIO_NORMAL;
   return tg;
 }
 
@@ -202,10 +463,15 @@ task_run_in_group(task_fn_t *fn, void *opaque, task_group_t *tg)
   t->t_fn = fn;
   t->t_opaque = opaque;
   t->t_group = tg;
+  t->t_prio = tg->tg_token->t_prio;
+  t->t_enqueued = arch_get_ts();
   atomic_inc(&tg->tg_refcount);
   hts_mutex_lock(&task_mutex);
+  if(task_workers == NULL)
+    task_workers_init();
+
   if(TAILQ_FIRST(&tg->tg_tasks) == NULL)
-    TAILQ_INSERT_TAIL(&task_groups, tg, tg_link);
+    task_enqueue_global(tg->tg_token);
 
   TAILQ_INSERT_TAIL(&tg->tg_tasks, t, t_link);
   task_schedule();
@@ -213,11 +479,98 @@ task_run_in_group(task_fn_t *fn, void *opaque, task_group_t *tg)
 }
 
 
+/**
+ * Counters are read without locking so they might be slightly off
+ */
+void
+task_get_stats(task_stats_t *ts)
+{
+  int64_t wait_sum[TASK_PRIO_num] = {0};
+  int i, j, k;
+
+  memset(ts, 0, sizeof(task_stats_t));
+
+  hts_mutex_lock(&task_mutex);
+  ts->ts_workers = num_task_threads;
+  ts->ts_idle    = num_task_threads_avail;
+  ts->ts_queued  = atomic_get(&task_queued);
+
+  for(i = 0; i < task_workers_used; i++) {
+    const task_worker_t *tw = &task_workers[i];
+    ts->ts_steals += tw->tw_steals;
+
+    for(j = 0; j < TASK_PRIO_num; j++) {
+      task_class_stats_t *tcs = &ts->ts_class[j];
+      tcs->tcs_executed        += tw->tw_class[j].executed;
+      tcs->tcs_deadline_missed += tw->tw_class[j].deadline_missed;
+      tcs->tcs_wait_max = MAX(tcs->tcs_wait_max, tw->tw_class[j].wait_max);
+      wait_sum[j]              += tw->tw_class[j].wait_sum;
+      for(k = 0; k < TASK_WAIT_HIST_BUCKETS; k++)
+        tcs->tcs_wait_hist[k] += tw->tw_class[j].wait_hist[k];
+    }
+  }
+  hts_mutex_unlock(&task_mutex);
+
+  for(j = 0; j < TASK_PRIO_num; j++) {
+    task_class_stats_t *tcs = &ts->ts_class[j];
+    if(tcs->tcs_executed)
+      tcs->tcs_wait_avg = wait_sum[j] / tcs->tcs_executed;
+  }
+}
+
+
+/**
+ *
+ */
+void
+task_stats_print(htsbuf_queue_t *hq)
+{
+  static const char *classnames[TASK_PRIO_num] = {
+    [TASK_PRIO_INTERACTIVE] = "interactive",
+    [TASK_PRIO_NORMAL]      = "normal",
+    [TASK_PRIO_BULK]        = "bulk",
+  };
+  static const char *bucketnames[TASK_WAIT_HIST_BUCKETS] = {
+    "<1ms", "<4ms", "<16ms", "<64ms", "<256ms", "<1s", "<4s", ">=4s"
+  };
+  task_stats_t ts;
+  int i, j;
+
+  task_get_stats(&ts);
+
+  htsbuf_qprintf(hq,
+                 "Workers:  %d (%d idle, max %d)\n"
+                 "Queued:   %d\n"
+                 "Steals:   %"PRId64"\n\n",
+                 ts.ts_workers, ts.ts_idle, task_max_workers,
+                 ts.ts_queued, ts.ts_steals);
+
+  for(i = 0; i < TASK_PRIO_num; i++) {
+    const task_class_stats_t *tcs = &ts.ts_class[i];
+    htsbuf_qprintf(hq,
+                   "%s: %"PRId64" executed, %"PRId64" missed deadline\n"
+                   "  Wait: %"PRId64" us avg, %"PRId64" us max\n",
+                   classnames[i], tcs->tcs_executed, tcs->tcs_deadline_missed,
+                   tcs->tcs_wait_avg, tcs->tcs_wait_max);
+
+    for(j = 0; j < TASK_WAIT_HIST_BUCKETS; j++)
+      htsbuf_qprintf(hq, "  %-7s %"PRId64"\n",
+                     bucketnames[j], tcs->tcs_wait_hist[j]);
+  }
+}
+
+
 /**
  *
  */
 INITIALIZER(taskinit)
 {
+  int i;
+
   hts_mutex_init(&task_mutex);
   hts_cond_init(&task_cond, &task_mutex);
+
+  for(i = 0; i < TASK_PRIO_num; i++)
+    TAILQ_INIT(&tasks[i]);
+  TAILQ_INIT(&deadline_tasks);
 }
@@ -18,12 +18,28 @@
  *  For more information, contact andreas@lonelycoder.com
  */
 #pragma once
+#include <stdint.h>
 
 typedef struct task_group task_group_t;
 
 typedef void (task_fn_t)(void *opaque);
 
-void task_run(task_fn_t *fn, void *opaque);
+typedef enum {
+  TASK_PRIO_INTERACTIVE,  // Someone is waiting for the result
+  TASK_PRIO_NORMAL,
+  TASK_PRIO_BULK,         // Background work, prefetching, etc
+  TASK_PRIO_num,
+} task_prio_t;
+
+/**
+ * 'deadline' is the time (as returned by arch_get_ts()) at which the
+ * task should have started, or 0 for none. A task close to its deadline
+ * is run before anything else
+ */
+void task_run_ex(task_fn_t *fn, void *opaque, task_prio_t prio,
+                 int64_t deadline);
+
+#define task_run(fn, opaque) task_run_ex(fn, opaque, TASK_PRIO_NORMAL, 0)
 
 task_group_t *task_group_create(void);
 
@@ -31,3 +47,25 @@ void task_group_destroy(task_group_t *tg);
 
 void task_run_in_group(task_fn_t *fn, void *opaque, task_group_t *tg);
 
+#define TASK_WAIT_HIST_BUCKETS 8
+
+typedef struct task_class_stats {
+  int64_t tcs_executed;
+  int64_t tcs_wait_avg;  // Time from submit until start, in µs
+  int64_t tcs_wait_max;
+  int64_t tcs_deadline_missed;
+  int64_t tcs_wait_hist[TASK_WAIT_HIST_BUCKETS];
+} task_class_stats_t;
+
+typedef struct task_stats {
+  int ts_workers;
+  int ts_idle;
+  int ts_queued;
+  int64_t ts_steals;
+  task_class_stats_t ts_class[TASK_PRIO_num];
+} task_stats_t;
+
+void task_get_stats(task_stats_t *ts);
+
+struct htsbuf_queue;
+void task_stats_print(struct htsbuf_queue *hq);
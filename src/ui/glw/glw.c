@@ -221,6 +221,10 @@ glw_init4(glw_root_t *gr,
 
   gr->gr_prop_dispatcher = dispatcher;
   gr->gr_courier = courier;
+
+  // Widgets only care about the latest value of what they bind to
+  prop_courier_set_flags(courier, PROP_COURIER_COALESCE);
+  prop_courier_set_name(courier, "glw");
   gr->gr_init_flags = flags;
   gr->gr_prop_maxtime = -1;
 
@@ -215,6 +215,8 @@ glw_video_compute_avdiff(glw_root_t *gr, media_pipe_t *mp,
 
     if(abs(gv->gv_avdiff) < 30000000) {
 
+      media_latency_add(&mp->mp_latency_avdrift, gv->gv_avdiff);
+
       gv->gv_avdiff_x = kalman_update(&gv->gv_avfilter,
 				      (double)gv->gv_avdiff / 1000000);
       gv->gv_avdiff_x = MAX(MIN(gv->gv_avdiff_x, 30.0f), -30.0f);
@@ -100,7 +100,7 @@ add_events(htsmsg_t *m)
 static void
 usage_periodic(struct callout *c, void *aux)
 {
-  task_run(try_send, NULL);
+  task_run_ex(try_send, NULL, TASK_PRIO_BULK, 0);
 }
 
 
@@ -177,7 +177,7 @@ usage_start(void)
 {
   if(gconf.disable_analytics)
     return;
-  task_run(try_send, NULL);
+  task_run_ex(try_send, NULL, TASK_PRIO_BULK, 0);
 }
 
 /**
@@ -142,9 +142,18 @@ video_decoder_set_current_time(video_decoder_t *vd, int64_t user_time,
 int
 video_deliver_frame(video_decoder_t *vd, const frame_info_t *info)
 {
+  media_queue_t *mq = &vd->vd_mp->mp_video;
+  const int64_t ts = arch_get_ts();
   int r = vd->vd_mp->mp_video_frame_deliver(info,
                                             vd->vd_mp->mp_video_frame_opaque);
 
+  if(!r) {
+    const int64_t now = arch_get_ts();
+    media_latency_add(&mq->mq_latency_output, now - ts);
+    if(info->fi_enq_time)
+      media_latency_add(&mq->mq_latency_total, now - info->fi_enq_time);
+  }
+
   if(info->fi_drive_clock && !r)
     video_decoder_set_current_time(vd, info->fi_user_time, info->fi_epoch,
                                    info->fi_pts, info->fi_drive_clock);
@@ -219,6 +228,8 @@ vd_thread(void *aux)
       continue;
     }
 
+    mq_ring_drain_locked(mp, mq);
+
     media_buf_t *ctrl = TAILQ_FIRST(&mq->mq_q_ctrl);
     media_buf_t *data = TAILQ_FIRST(&mq->mq_q_data);
     media_buf_t *aux  = TAILQ_FIRST(&mq->mq_q_aux);
@@ -258,6 +269,7 @@ vd_thread(void *aux)
       mb = data;
       if(mb->mb_dts != PTS_UNSET)
         mq->mq_last_deq_dts = mb->mb_dts;
+      mq_latency_dequeued(mq, mb);
 
     } else {
       hts_cond_wait(&mq->mq_avail, &mp->mp_mutex);